@@ -0,0 +1,391 @@
+#include <omp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <mpi.h>
+
+#include "antialias.h"
+#include "kernel.h"
+
+/** Most pixels refined together, all of a single row */
+#define ANTIALIAS_CHUNK 64
+
+/*--- Type definitions -----------------------------------------------------*/
+
+/**
+ * Pixel to refine, sent to the process that refines it.
+ */
+typedef struct {
+  int x;
+  int y;
+} aa_pixel_t;
+
+/*--- Implementation -------------------------------------------------------*/
+
+/**
+ * Returns the iteration count of a local pixel of @p counts as a float.
+ */
+static float countAt(const image_t *counts, int x, int y) {
+  const unsigned char *pixel = imagePixel(counts, x, y);
+
+  switch (counts->format) {
+  case PIXEL_ITER16:
+    return *(const uint16_t *)pixel;
+  case PIXEL_ITER32:
+    return (float)*(const uint32_t *)pixel;
+  default:
+    return *(const float *)pixel;
+  }
+}
+
+/**
+ * Returns a pseudo-random offset in [0, ANTIALIAS_JITTER) for the sample
+ * @p sample of the pixel (@p x, @p y). The offsets only depend on these, so
+ * the image does not depend on the number of processes.
+ */
+static int jitter(unsigned int x, unsigned int y, unsigned int sample) {
+  unsigned int h = x * 0x9e3779b1u ^ y * 0x85ebca77u ^ sample * 0xc2b2ae3du;
+
+  h ^= h >> 15;
+  h *= 0x2c1b3c6du;
+  h ^= h >> 12;
+  h *= 0x297a2d39u;
+  h ^= h >> 15;
+  return (int)(h % ANTIALIAS_JITTER);
+}
+
+/**
+ * Finds the pixels in the rows data->from to data->to whose iteration
+ * count varies too much against their neighbours: the variance of the
+ * counts in the 3x3 pixels around them exceeds data->variance. The rows
+ * next to those of the calling process are computed again for that, which
+ * costs less than fetching them from the processes they belong to.
+ *
+ * @param  data   Mandelbrot parameters, data->image holds the counts
+ * @param  count  Output: number of pixels found
+ *
+ * @return The pixels found, row by row, to be freed by the caller
+ */
+static aa_pixel_t *findPixels(const mandel_t *data, int *count) {
+  int columns = data->columns;
+  int first = data->from > 0 ? data->from - 1 : 0;
+  int last = data->to < data->rows ? data->to + 1 : data->rows;
+  int height = data->to > data->from ? last - first : 0;
+  float *counts = (float *)malloc((size_t)height * columns * sizeof(float));
+  int *iters = (int *)malloc(columns * sizeof(int));
+  float *smooth = (float *)malloc(columns * sizeof(float));
+  unsigned char *flags = (unsigned char *)malloc(
+      (size_t)(data->to - data->from) * columns + 1);
+  aa_pixel_t *pixels;
+  mandel_stats_t stats = {0, 0, 0, 0, 0, 0, 0};
+  int x;
+  int y;
+
+  if ((height && !counts) || !iters || !smooth || !flags) {
+    fprintf(stderr, "Memory allocation error!\n");
+    MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+  }
+
+  for (y = first; y < first + height; ++y) {
+    float *row = counts + (size_t)(y - first) * columns;
+
+    if (y >= data->from && y < data->to) {
+      for (x = 0; x < columns; ++x)
+        row[x] = countAt(data->image, x, y);
+      continue;
+    }
+    kernelRow(data, y, 0, columns, iters,
+              data->count_format == PIXEL_SMOOTH32 ? smooth : NULL, &stats);
+    for (x = 0; x < columns; ++x)
+      row[x] = data->count_format == PIXEL_SMOOTH32 ? smooth[x]
+                                                    : (float)iters[x];
+  }
+
+#pragma omp parallel for schedule(static) private(x)
+  for (y = data->from; y < data->to; ++y) {
+    for (x = 0; x < columns; ++x) {
+      double sum = 0.0;
+      double squares = 0.0;
+      int n = 0;
+      int i;
+      int j;
+
+      for (j = y > first ? y - 1 : y; j <= y + 1 && j < first + height; ++j)
+        for (i = x > 0 ? x - 1 : x; i <= x + 1 && i < columns; ++i) {
+          double c = counts[(size_t)(j - first) * columns + i];
+
+          sum += c;
+          squares += c * c;
+          ++n;
+        }
+      sum /= n;
+      flags[(size_t)(y - data->from) * columns + x] =
+          squares / n - sum * sum > data->variance;
+    }
+  }
+
+  *count = 0;
+  for (y = data->from; y < data->to; ++y)
+    for (x = 0; x < columns; ++x)
+      *count += flags[(size_t)(y - data->from) * columns + x];
+  pixels = (aa_pixel_t *)malloc(*count * sizeof(aa_pixel_t) + 1);
+  if (!pixels) {
+    fprintf(stderr, "Memory allocation error!\n");
+    MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+  }
+  *count = 0;
+  for (y = data->from; y < data->to; ++y)
+    for (x = 0; x < columns; ++x)
+      if (flags[(size_t)(y - data->from) * columns + x]) {
+        pixels[*count].x = x;
+        pixels[*count].y = y;
+        ++*count;
+      }
+
+  free(counts);
+  free(iters);
+  free(smooth);
+  free(flags);
+  return pixels;
+}
+
+/**
+ * Computes the colors of the @p count pixels @p pixels from
+ * data->antialias^2 samples each: one jittered sample in each stratum of a
+ * grid of data->antialias strata per side. The samples lie on a grid of
+ * data->antialias * ANTIALIAS_JITTER positions per pixel and side, and all
+ * samples of a stratum row share their position in y, so the samples of
+ * the pixels of an image row are computed together by the vector kernels,
+ * in chunks of up to ANTIALIAS_CHUNK pixels shared among the OpenMP
+ * threads. The samples are computed in the precision of the image.
+ *
+ * @param  data     Mandelbrot parameters
+ * @param  palette  Colors of the iteration counts
+ * @param  pixels   Pixels to refine, row by row
+ * @param  count    Number of pixels
+ * @param  colors   Output: mean RGB color per pixel
+ * @param  stats    Statistics to add the samples and iterations to
+ */
+static void refinePixels(const mandel_t *data, const palette_t *palette,
+                         const aa_pixel_t *pixels, int count,
+                         unsigned char *colors, mandel_stats_t *stats) {
+  int side = data->antialias;
+  int scale = side * ANTIALIAS_JITTER;
+  int samples = side * ANTIALIAS_CHUNK;
+  int threads = omp_get_max_threads();
+  int *chunks = (int *)malloc((count + 1) * sizeof(int));
+  int *columns = (int *)malloc(threads * samples * sizeof(int));
+  int *iters = (int *)malloc(threads * samples * sizeof(int));
+  float *smooth = (float *)malloc(threads * samples * sizeof(float));
+  unsigned int *sums =
+      (unsigned int *)malloc(threads * ANTIALIAS_CHUNK * 3 * sizeof(int));
+  mandel_t fine = *data;
+  int chunk_count = 0;
+  int chunk;
+  int i;
+
+  if (!chunks || !columns || !iters || !smooth || !sums) {
+    fprintf(stderr, "Memory allocation error!\n");
+    MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+  }
+
+  // the samples are pixels of an image of scale times the size
+  fine.columns = data->columns * scale;
+  fine.rows = data->rows * scale;
+
+  for (i = 0; i < count; ++i)
+    if (i == 0 || pixels[i].y != pixels[i - 1].y ||
+        i - chunks[chunk_count - 1] == ANTIALIAS_CHUNK)
+      chunks[chunk_count++] = i;
+  chunks[chunk_count] = count;
+
+#pragma omp parallel private(i)
+  {
+    mandel_stats_t local = {0, 0, 0, 0, 0, 0, 0};
+    int offset = omp_get_thread_num() * samples;
+    unsigned int *sum = sums + omp_get_thread_num() * ANTIALIAS_CHUNK * 3;
+    int smoothed = data->count_format == PIXEL_SMOOTH32;
+
+#pragma omp for schedule(dynamic)
+    for (chunk = 0; chunk < chunk_count; ++chunk) {
+      const aa_pixel_t *first = pixels + chunks[chunk];
+      int n = chunks[chunk + 1] - chunks[chunk];
+      int y = first->y;
+      int sy;
+
+      memset(sum, 0, n * 3 * sizeof(int));
+      for (sy = 0; sy < side; ++sy) {
+        int row = y * scale + sy * ANTIALIAS_JITTER +
+                  jitter(0, y, 1 + side * side + sy);
+        int *column = columns + offset;
+        int sx;
+
+        for (i = 0; i < n; ++i)
+          for (sx = 0; sx < side; ++sx)
+            *column++ = first[i].x * scale + sx * ANTIALIAS_JITTER +
+                        jitter(first[i].x, y, 1 + sy * side + sx);
+
+        kernelColumns(&fine, row, columns + offset, n * side, iters + offset,
+                      smoothed ? smooth + offset : NULL, &local);
+        for (i = 0; i < n * side; ++i) {
+          int iter = iters[offset + i];
+          color_t color =
+              smoothed ? paletteSmooth(palette, smooth[offset + i])
+                       : palette->colors[iter < data->maxiter ? iter
+                                                              : data->maxiter];
+
+          sum[(i / side) * 3] += color.red;
+          sum[(i / side) * 3 + 1] += color.green;
+          sum[(i / side) * 3 + 2] += color.blue;
+        }
+      }
+
+      for (i = 0; i < n * 3; ++i)
+        colors[(size_t)chunks[chunk] * 3 + i] =
+            (unsigned char)((sum[i] + side * side / 2) / (side * side));
+    }
+
+#pragma omp atomic
+    stats->pixels += local.pixels;
+#pragma omp atomic
+    stats->iterations += local.iterations;
+  }
+
+  free(chunks);
+  free(columns);
+  free(iters);
+  free(smooth);
+  free(sums);
+}
+
+/**
+ * Anti-aliases the colored rows data->from to data->to of @p image with
+ * adaptive supersampling: only the pixels whose counts vary a lot against
+ * their neighbours (see findPixels()) get data->antialias^2 jittered
+ * samples (see refinePixels()), and take the mean color of those.
+ *
+ * Such pixels cluster along the boundary of the set, so some processes
+ * have many more of them than others. All processes therefore deal the
+ * pixels out evenly with MPI_Alltoallv(), in the order of the image, refine
+ * their share and send the colors back to the processes the pixels belong
+ * to. Prints the number of refined pixels and the time taken. Has to be
+ * called by all processes.
+ *
+ * @param  data     Mandelbrot parameters, data->image holds the counts
+ * @param  palette  Colors of the iteration counts
+ * @param  image    Colored rows of the calling process, RGB24 or RGBA32
+ */
+void antialiasRender(const mandel_t *data, const palette_t *palette,
+                     image_t *image) {
+  double start_time = MPI_Wtime();
+  mandel_stats_t stats = {0, 0, 0, 0, 0, 0, 0};
+  long long *found;
+  int *send_counts;
+  int *send_displs;
+  int *recv_counts;
+  int *recv_displs;
+  aa_pixel_t *pixels;
+  aa_pixel_t *share;
+  unsigned char *colors;
+  unsigned char *share_colors;
+  MPI_Datatype pixel_type;
+  MPI_Datatype color_type;
+  long long offset = 0;
+  long long total = 0;
+  long long begin;
+  long long end;
+  int share_count = 0;
+  int numprocs;
+  int rank;
+  int count;
+  int i;
+
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  MPI_Comm_size(MPI_COMM_WORLD, &numprocs);
+
+  pixels = findPixels(data, &count);
+
+  found = (long long *)malloc(numprocs * sizeof(long long));
+  send_counts = (int *)malloc(4 * numprocs * sizeof(int));
+  if (!found || !send_counts) {
+    fprintf(stderr, "Memory allocation error!\n");
+    MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+  }
+  send_displs = send_counts + numprocs;
+  recv_counts = send_displs + numprocs;
+  recv_displs = recv_counts + numprocs;
+
+  // the pixels of all processes in the order of the image, dealt out in
+  // even shares
+  begin = count;
+  MPI_Allgather(&begin, 1, MPI_LONG_LONG, found, 1, MPI_LONG_LONG,
+                MPI_COMM_WORLD);
+  for (i = 0; i < numprocs; ++i) {
+    if (i < rank)
+      offset += found[i];
+    total += found[i];
+  }
+  for (i = 0; i < numprocs; ++i) {
+    long long from = total * i / numprocs;
+    long long to = total * (i + 1) / numprocs;
+
+    // own pixels in the share of process i
+    begin = offset > from ? offset : from;
+    end = offset + count < to ? offset + count : to;
+    send_counts[i] = end > begin ? (int)(end - begin) : 0;
+    send_displs[i] = i ? send_displs[i - 1] + send_counts[i - 1] : 0;
+  }
+  begin = total * rank / numprocs;
+  end = total * (rank + 1) / numprocs;
+  for (i = 0, offset = 0; i < numprocs; offset += found[i++]) {
+    // pixels of process i in the own share
+    long long from = offset > begin ? offset : begin;
+    long long to = offset + found[i] < end ? offset + found[i] : end;
+
+    recv_counts[i] = to > from ? (int)(to - from) : 0;
+    recv_displs[i] = share_count;
+    share_count += recv_counts[i];
+  }
+
+  share = (aa_pixel_t *)malloc(share_count * sizeof(aa_pixel_t) + 1);
+  colors = (unsigned char *)malloc((size_t)count * 3 + 1);
+  share_colors = (unsigned char *)malloc((size_t)share_count * 3 + 1);
+  if (!share || !colors || !share_colors) {
+    fprintf(stderr, "Memory allocation error!\n");
+    MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+  }
+  MPI_Type_contiguous(2, MPI_INT, &pixel_type);
+  MPI_Type_commit(&pixel_type);
+  MPI_Type_contiguous(3, MPI_UNSIGNED_CHAR, &color_type);
+  MPI_Type_commit(&color_type);
+
+  MPI_Alltoallv(pixels, send_counts, send_displs, pixel_type, share,
+                recv_counts, recv_displs, pixel_type, MPI_COMM_WORLD);
+  refinePixels(data, palette, share, share_count, share_colors, &stats);
+  MPI_Alltoallv(share_colors, recv_counts, recv_displs, color_type, colors,
+                send_counts, send_displs, color_type, MPI_COMM_WORLD);
+
+  for (i = 0; i < count; ++i) {
+    color_t color = {colors[i * 3], colors[i * 3 + 1], colors[i * 3 + 2], 0};
+
+    imageSetPixel(image, pixels[i].x, pixels[i].y, color);
+  }
+
+  if (rank == 0)
+    printf("Anti-aliasing: %lld of %lld pixels refined with %d samples "
+           "each\n",
+           total, (long long)data->columns * data->rows,
+           data->antialias * data->antialias);
+  printf("Anti-aliasing time: %2.6f seconds (%d pixels, %lld iterations)\n",
+         MPI_Wtime() - start_time, share_count, stats.iterations);
+
+  MPI_Type_free(&pixel_type);
+  MPI_Type_free(&color_type);
+  free(found);
+  free(send_counts);
+  free(pixels);
+  free(share);
+  free(colors);
+  free(share_colors);
+}
@@ -0,0 +1,26 @@
+#ifndef _ANTIALIAS_H
+#define _ANTIALIAS_H
+
+#include "image_distributed.h"
+#include "mandelbrot.h"
+#include "palette.h"
+
+/** Most samples per side of a refined pixel */
+#define ANTIALIAS_MAX 16
+
+/** Count variance above which a pixel is refined (default) */
+#define ANTIALIAS_VARIANCE 1.0
+
+/**
+ * Positions per side of the stratum of a sample that it is jittered among.
+ * A refined pixel is sampled on a grid of data->antialias *
+ * ANTIALIAS_JITTER positions per side.
+ */
+#define ANTIALIAS_JITTER 8
+
+/*--- Function prototypes --------------------------------------------------*/
+
+void antialiasRender(const mandel_t *data, const palette_t *palette,
+                     image_t *image);
+
+#endif /* !_ANTIALIAS_H */
@@ -0,0 +1,120 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cache.h"
+
+/*--- Implementation -------------------------------------------------------*/
+
+/**
+ * Creates an empty cache of @p capacity tiles of @p tile_size bytes. The
+ * memory of a tile is only allocated once it is inserted.
+ *
+ * @return The cache, or NULL if out of memory
+ */
+cache_t *cacheCreate(int capacity, size_t tile_size) {
+  cache_t *cache = (cache_t *)malloc(sizeof(cache_t));
+
+  if (!cache) {
+    fprintf(stderr, "Memory allocation error!\n");
+    return NULL;
+  }
+  cache->entries = (cache_entry_t *)calloc(capacity, sizeof(cache_entry_t));
+  if (!cache->entries) {
+    fprintf(stderr, "Memory allocation error!\n");
+    free(cache);
+    return NULL;
+  }
+  cache->capacity = capacity;
+  cache->tile_size = tile_size;
+  cache->clock = 0;
+  cache->hits = 0;
+  cache->misses = 0;
+  return cache;
+}
+
+/**
+ * Frees a cache and all its tiles.
+ */
+void cacheFree(cache_t *cache) {
+  int i;
+
+  if (!cache)
+    return;
+  for (i = 0; i < cache->capacity; ++i)
+    free(cache->entries[i].pixels);
+  free(cache->entries);
+  free(cache);
+}
+
+/**
+ * Returns non-zero if @p a and @p b identify the same tile.
+ */
+static int sameKey(const tile_key_t *a, const tile_key_t *b) {
+  return a->scale == b->scale && a->maxiter == b->maxiter &&
+         a->precision == b->precision && a->x == b->x && a->y == b->y;
+}
+
+/**
+ * Looks up the tile @p key and marks it as used. The entries are searched
+ * one by one: a cache holds a few thousand tiles at most, and comparing
+ * them all costs next to nothing against computing a single tile.
+ *
+ * @return The pixels of the tile, valid until the next cacheInsert(), or
+ *         NULL if the tile is not cached
+ */
+const unsigned char *cacheFind(cache_t *cache, const tile_key_t *key) {
+  int i;
+
+  for (i = 0; i < cache->capacity; ++i) {
+    cache_entry_t *entry = &cache->entries[i];
+
+    if (entry->pixels && sameKey(&entry->key, key)) {
+      entry->used = ++cache->clock;
+      cache->hits++;
+      return entry->pixels;
+    }
+  }
+
+  cache->misses++;
+  return NULL;
+}
+
+/**
+ * Copies the pixels of the tile @p key into the cache. The tile takes a
+ * free entry or, once the cache is full, the least recently used one.
+ *
+ * @return 0 on success, -1 if out of memory
+ */
+int cacheInsert(cache_t *cache, const tile_key_t *key,
+                const unsigned char *pixels) {
+  cache_entry_t *entry = &cache->entries[0];
+  int i;
+
+  for (i = 0; i < cache->capacity; ++i) {
+    cache_entry_t *candidate = &cache->entries[i];
+
+    if (candidate->pixels && sameKey(&candidate->key, key)) {
+      entry = candidate;
+      break;
+    }
+    if (!candidate->pixels) {
+      if (entry->pixels)
+        entry = candidate; // keep looking for the tile itself
+    } else if (entry->pixels && candidate->used < entry->used) {
+      entry = candidate;
+    }
+  }
+
+  if (!entry->pixels) {
+    entry->pixels = (unsigned char *)malloc(cache->tile_size);
+    if (!entry->pixels) {
+      fprintf(stderr, "Memory allocation error!\n");
+      return -1;
+    }
+  }
+  entry->key = *key;
+  entry->used = ++cache->clock;
+  memcpy(entry->pixels, pixels, cache->tile_size);
+  return 0;
+}
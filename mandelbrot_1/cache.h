@@ -0,0 +1,49 @@
+#ifndef _CACHE_H
+#define _CACHE_H
+
+#include <stddef.h>
+
+/*--- Type definitions -----------------------------------------------------*/
+
+/**
+ * Identifies a tile of the render server (see server.c): tile (x, y) of a
+ * scale holds the same pixels in every view of that scale.
+ */
+typedef struct {
+  double scale;  /**< Width of a pixel in the complex plane */
+  int maxiter;   /**< Maximum number of iterations */
+  int precision; /**< Arithmetic of the kernels (precision_t) */
+  long long x;   /**< Column of the tile */
+  long long y;   /**< Row of the tile */
+} tile_key_t;
+
+/**
+ * Entry of the cache, free while its pixels are NULL.
+ */
+typedef struct {
+  tile_key_t key;          /**< Tile held by the entry */
+  unsigned long long used; /**< Time of the last use, see cache_t */
+  unsigned char *pixels;   /**< Pixels of the tile */
+} cache_entry_t;
+
+/**
+ * Least recently used cache of a fixed number of tiles of the same size.
+ */
+typedef struct {
+  cache_entry_t *entries;   /**< The entries */
+  int capacity;             /**< Number of entries */
+  size_t tile_size;         /**< Bytes per tile */
+  unsigned long long clock; /**< Counts the uses of entries */
+  long long hits;           /**< Number of tiles found */
+  long long misses;         /**< Number of tiles not found */
+} cache_t;
+
+/*--- Function prototypes --------------------------------------------------*/
+
+cache_t *cacheCreate(int capacity, size_t tile_size);
+void cacheFree(cache_t *cache);
+const unsigned char *cacheFind(cache_t *cache, const tile_key_t *key);
+int cacheInsert(cache_t *cache, const tile_key_t *key,
+                const unsigned char *pixels);
+
+#endif /* !_CACHE_H */
@@ -0,0 +1,100 @@
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <mpi.h>
+
+#include "image_distributed.h"
+#include "palette.h"
+#include "utility.h"
+
+/**
+ * Prints the command line usage of the program.
+ *
+ * @param  program  Name of the executable
+ */
+static void usage(const char *program) {
+  fprintf(stderr,
+          "Usage: %s [options] COUNTS OUTPUT\n"
+          "Colors a count file saved by mandel --save-counts into a PPM "
+          "image\n"
+          "(PNG or QOI if OUTPUT ends in .png or .qoi).\n"
+          "  -p, --palette=NAME\n"
+          "      Colors of the iteration counts: hsv (default) or gray\n"
+          "  -h, --help\n"
+          "      Print this help\n",
+          program);
+}
+
+/**
+ * Main program. Runs on a single process.
+ */
+int main(int argc, char *argv[]) {
+  static const struct option options[] = {
+      {"palette", required_argument, NULL, 'p'},
+      {"help", no_argument, NULL, 'h'},
+      {NULL, 0, NULL, 0}};
+  palette_kind_t kind = PALETTE_HSV;
+  int numprocs;
+  int opt;
+
+  MPI_Init(&argc, &argv);
+  MPI_Comm_size(MPI_COMM_WORLD, &numprocs);
+
+  while ((opt = getopt_long(argc, argv, "p:h", options, NULL)) != -1) {
+    switch (opt) {
+    case 'p':
+      if (paletteParse(optarg, &kind) != 0) {
+        fprintf(stderr, "Invalid palette \"%s\"!\n", optarg);
+        MPI_Finalize();
+        return EXIT_FAILURE;
+      }
+      break;
+    case 'h':
+      usage(argv[0]);
+      MPI_Finalize();
+      return EXIT_SUCCESS;
+    default:
+      usage(argv[0]);
+      MPI_Finalize();
+      return EXIT_FAILURE;
+    }
+  }
+  if (optind + 2 != argc || numprocs != 1) {
+    usage(argv[0]);
+    MPI_Finalize();
+    return EXIT_FAILURE;
+  }
+
+  /* Load the counts */
+  int maxiter;
+  image_t *counts = imageLoadCounts(argv[optind], &maxiter);
+  if (!counts) {
+    MPI_Finalize();
+    return EXIT_FAILURE;
+  }
+
+  image_t *image =
+      imageCreate(counts->global_width, counts->global_height,
+                  counts->global_width, counts->global_height, 0, 0,
+                  PIXEL_RGB24);
+  palette_t *palette = paletteCreate(kind, maxiter);
+  if (!image || !palette) {
+    fprintf(stderr, "Memory allocation error!\n");
+    return EXIT_FAILURE;
+  }
+
+  /* Coloring pass */
+  double start_time = get_wtime();
+  paletteApply(palette, counts, image);
+  printf("Coloring time: %2.6f seconds\n", get_wtime() - start_time);
+
+  /* Save the output image & free resources */
+  imageSave(image, argv[optind + 1], MPI_INFO_NULL);
+  paletteFree(palette);
+  imageFree(counts);
+  imageFree(image);
+
+  MPI_Finalize();
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,369 @@
+#include <omp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <zlib.h>
+
+#include "compress.h"
+
+/** zlib stream header: deflate with a 32K window, no dictionary */
+#define ZLIB_CMF 0x78
+#define ZLIB_FLG 0x01
+
+/** QOI chunk tags */
+#define QOI_OP_INDEX 0x00
+#define QOI_OP_DIFF 0x40
+#define QOI_OP_LUMA 0x80
+#define QOI_OP_RUN 0xc0
+#define QOI_OP_RGB 0xfe
+
+/*--- Implementation -------------------------------------------------------*/
+
+/**
+ * Stores @p value as 4 bytes, most significant first.
+ */
+static void putBE32(unsigned char *out, uint32_t value) {
+  out[0] = value >> 24;
+  out[1] = value >> 16;
+  out[2] = value >> 8;
+  out[3] = value;
+}
+
+/**
+ * Writes a PNG chunk of @p length bytes of @p data to @p out.
+ *
+ * @return Number of bytes written, @p length + 12
+ */
+static size_t pngChunk(unsigned char *out, const char *type,
+                       const unsigned char *data, size_t length) {
+  uint32_t crc;
+
+  putBE32(out, (uint32_t)length);
+  memcpy(out + 4, type, 4);
+  if (data != out + 8)
+    memcpy(out + 8, data, length);
+  crc = crc32(0, out + 4, (uInt)length + 4);
+  putBE32(out + 8 + length, crc);
+
+  return length + 12;
+}
+
+/**
+ * Returns the format for an output file, from the extension of its name:
+ * ".png" for PNG, ".qoi" for QOI and PPM for anything else.
+ */
+codec_t codecFromName(const char *filename) {
+  size_t length = strlen(filename);
+
+  if (length >= 4 && strcmp(filename + length - 4, ".png") == 0)
+    return CODEC_PNG;
+  if (length >= 4 && strcmp(filename + length - 4, ".qoi") == 0)
+    return CODEC_QOI;
+  return CODEC_PPM;
+}
+
+/**
+ * Writes what comes in front of the rows of a file in @p codec. For PNG,
+ * this is the signature, the IHDR chunk and an IDAT chunk with the zlib
+ * header, so the segments only contain deflate data.
+ *
+ * @param  codec   Format of the file
+ * @param  width   Image width in pixels
+ * @param  height  Image height in pixels
+ * @param  header  Output: the header, at most CODEC_MAX_HEADER bytes
+ *
+ * @return Number of bytes of the header
+ */
+int codecHeader(codec_t codec, int width, int height, unsigned char *header) {
+  static const unsigned char signature[8] = {0x89, 'P',  'N',  'G',
+                                             '\r', '\n', 0x1a, '\n'};
+  unsigned char ihdr[13];
+  unsigned char zlib[2] = {ZLIB_CMF, ZLIB_FLG};
+  int size;
+
+  switch (codec) {
+  case CODEC_PNG:
+    memcpy(header, signature, sizeof(signature));
+    putBE32(ihdr, width);
+    putBE32(ihdr + 4, height);
+    ihdr[8] = 8;  // bits per sample
+    ihdr[9] = 2;  // truecolor
+    ihdr[10] = 0; // deflate
+    ihdr[11] = 0; // adaptive filtering
+    ihdr[12] = 0; // not interlaced
+    size = sizeof(signature);
+    size += pngChunk(header + size, "IHDR", ihdr, sizeof(ihdr));
+    size += pngChunk(header + size, "IDAT", zlib, sizeof(zlib));
+    return size;
+  case CODEC_QOI:
+    memcpy(header, "qoif", 4);
+    putBE32(header + 4, width);
+    putBE32(header + 8, height);
+    header[12] = 3; // RGB
+    header[13] = 0; // sRGB with linear alpha
+    return 14;
+  default:
+    return snprintf((char *)header, CODEC_MAX_HEADER, "P6\n%d %d\n255\n",
+                    width, height);
+  }
+}
+
+/**
+ * Writes what comes after the rows of a file in @p codec. For PNG, this is
+ * an IDAT chunk that ends the deflate stream and holds the Adler-32 of all
+ * segments (see segmentAppend()), followed by the IEND chunk.
+ *
+ * @param  codec    Format of the file
+ * @param  adler    Adler-32 of all segments, for PNG
+ * @param  trailer  Output: the trailer, at most CODEC_MAX_HEADER bytes
+ *
+ * @return Number of bytes of the trailer
+ */
+int codecTrailer(codec_t codec, uint32_t adler, unsigned char *trailer) {
+  // a final, empty block with fixed Huffman codes
+  unsigned char end[6] = {0x03, 0x00};
+  int size;
+
+  switch (codec) {
+  case CODEC_PNG:
+    putBE32(end + 2, adler);
+    size = pngChunk(trailer, "IDAT", end, sizeof(end));
+    size += pngChunk(trailer + size, "IEND", NULL, 0);
+    return size;
+  case CODEC_QOI:
+    memset(trailer, 0, 7);
+    trailer[7] = 1;
+    return 8;
+  default:
+    return 0;
+  }
+}
+
+/**
+ * Initializes an empty segment.
+ */
+void segmentInit(segment_t *segment) {
+  segment->data = NULL;
+  segment->size = 0;
+  segment->adler = adler32(0, NULL, 0);
+  segment->length = 0;
+}
+
+/**
+ * Appends the segment @p next to @p segment, which then covers the rows of
+ * both. A segment without data only adds its Adler-32; this is how the
+ * checksums of segments compressed elsewhere are combined.
+ *
+ * @return 0 on success, -1 if out of memory
+ */
+int segmentAppend(segment_t *segment, const segment_t *next) {
+  if (next->size > 0) {
+    unsigned char *data =
+        (unsigned char *)realloc(segment->data, segment->size + next->size);
+
+    if (!data)
+      return -1;
+    memcpy(data + segment->size, next->data, next->size);
+    segment->data = data;
+    segment->size += next->size;
+  }
+  segment->adler =
+      adler32_combine(segment->adler, next->adler, (z_off_t)next->length);
+  segment->length += next->length;
+
+  return 0;
+}
+
+/**
+ * Deflates @p rows rows with the PNG Sub filter into one IDAT chunk. The
+ * deflate data ends with a sync flush instead of a final block, so that
+ * the segments can be joined.
+ */
+static int compressPNG(const unsigned char *pixels, size_t stride,
+                       int pixel_size, int width, int rows,
+                       segment_t *segment) {
+  size_t row_size = (size_t)width * 3 + 1;
+  unsigned char *row = (unsigned char *)malloc(row_size);
+  z_stream stream;
+  size_t bound;
+  int x;
+  int y;
+
+  memset(&stream, 0, sizeof(stream));
+  if (!row || deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -15,
+                           8, Z_DEFAULT_STRATEGY) != Z_OK) {
+    free(row);
+    return -1;
+  }
+  bound = deflateBound(&stream, row_size * rows) + 16;
+  segment->data = (unsigned char *)malloc(bound + 12);
+  if (!segment->data) {
+    deflateEnd(&stream);
+    free(row);
+    return -1;
+  }
+
+  // the deflate data goes right behind the chunk length and type
+  stream.next_out = segment->data + 8;
+  stream.avail_out = bound;
+  for (y = 0; y < rows; ++y) {
+    const unsigned char *in = pixels + y * stride;
+
+    row[0] = 1; // Sub: difference to the pixel on the left
+    for (x = 0; x < width; ++x) {
+      const unsigned char *left = x > 0 ? in - pixel_size : NULL;
+
+      row[1 + 3 * x] = in[0] - (left ? left[0] : 0);
+      row[2 + 3 * x] = in[1] - (left ? left[1] : 0);
+      row[3 + 3 * x] = in[2] - (left ? left[2] : 0);
+      in += pixel_size;
+    }
+    segment->adler = adler32(segment->adler, row, row_size);
+    segment->length += row_size;
+
+    stream.next_in = row;
+    stream.avail_in = row_size;
+    deflate(&stream, y == rows - 1 ? Z_SYNC_FLUSH : Z_NO_FLUSH);
+  }
+  if (rows == 0)
+    deflate(&stream, Z_SYNC_FLUSH);
+  if (stream.avail_out == 0) {
+    deflateEnd(&stream);
+    free(row);
+    return -1;
+  }
+
+  segment->size = pngChunk(segment->data, "IDAT", segment->data + 8,
+                           bound - stream.avail_out);
+  deflateEnd(&stream);
+  free(row);
+  return 0;
+}
+
+/**
+ * Encodes @p rows rows as QOI chunks. The first pixel is stored in full
+ * and the color index only refers to pixels of this segment, so the
+ * segment decodes the same after any other one.
+ */
+static int compressQOI(const unsigned char *pixels, size_t stride,
+                       int pixel_size, int width, int rows,
+                       segment_t *segment) {
+  uint32_t index[64];
+  char used[64] = {0};
+  unsigned char *out;
+  unsigned char previous[3] = {0, 0, 0};
+  int first = 1;
+  int run = 0;
+  int x;
+  int y;
+
+  // worst case: every pixel stored in full
+  segment->data = (unsigned char *)malloc((size_t)width * rows * 4 + 1);
+  if (!segment->data)
+    return -1;
+  out = segment->data;
+
+  for (y = 0; y < rows; ++y) {
+    const unsigned char *px = pixels + y * stride;
+
+    for (x = 0; x < width; ++x, px += pixel_size) {
+      uint32_t color = px[0] << 16 | px[1] << 8 | px[2];
+      int hash = (px[0] * 3 + px[1] * 5 + px[2] * 7 + 255 * 11) % 64;
+      signed char dr = px[0] - previous[0];
+      signed char dg = px[1] - previous[1];
+      signed char db = px[2] - previous[2];
+
+      if (!first && dr == 0 && dg == 0 && db == 0) {
+        if (++run == 62) {
+          *out++ = QOI_OP_RUN | (run - 1);
+          run = 0;
+        }
+        continue;
+      }
+      if (run > 0) {
+        *out++ = QOI_OP_RUN | (run - 1);
+        run = 0;
+      }
+
+      if (used[hash] && index[hash] == color) {
+        *out++ = QOI_OP_INDEX | hash;
+      } else if (!first && dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 &&
+                 db >= -2 && db <= 1) {
+        *out++ = QOI_OP_DIFF | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2);
+      } else if (!first && dg >= -32 && dg <= 31 && dr - dg >= -8 &&
+                 dr - dg <= 7 && db - dg >= -8 && db - dg <= 7) {
+        *out++ = QOI_OP_LUMA | (dg + 32);
+        *out++ = (dr - dg + 8) << 4 | (db - dg + 8);
+      } else {
+        *out++ = QOI_OP_RGB;
+        *out++ = px[0];
+        *out++ = px[1];
+        *out++ = px[2];
+      }
+      index[hash] = color;
+      used[hash] = 1;
+      memcpy(previous, px, 3);
+      first = 0;
+    }
+  }
+  if (run > 0)
+    *out++ = QOI_OP_RUN | (run - 1);
+
+  segment->size = out - segment->data;
+  return 0;
+}
+
+/**
+ * Compresses @p rows full rows of RGB pixels into @p segment. The rows are
+ * shared among the OpenMP threads in contiguous parts; each thread
+ * compresses its part into a segment of its own, and these are joined in
+ * order. Must not be called from within a parallel region.
+ *
+ * @param  codec       CODEC_PNG or CODEC_QOI
+ * @param  pixels      First row
+ * @param  stride      Bytes from row to row
+ * @param  pixel_size  Bytes from pixel to pixel (3 or 4)
+ * @param  width       Pixels per row
+ * @param  rows        Number of rows
+ * @param  segment     Output: the compressed rows, to be freed by the caller
+ *
+ * @return 0 on success, -1 if out of memory
+ */
+int compressRows(codec_t codec, const unsigned char *pixels, size_t stride,
+                 int pixel_size, int width, int rows, segment_t *segment) {
+  int parts = omp_get_max_threads();
+  segment_t *part = (segment_t *)malloc(parts * sizeof(segment_t));
+  int status = 0;
+  int i;
+
+  segmentInit(segment);
+  if (!part)
+    return -1;
+  // only split up what is worth the extra chunks
+  if (parts > rows / 16)
+    parts = rows / 16 > 0 ? rows / 16 : 1;
+
+#pragma omp parallel for schedule(static, 1) reduction(| : status)
+  for (i = 0; i < parts; ++i) {
+    int first = (int)((long long)rows * i / parts);
+    int last = (int)((long long)rows * (i + 1) / parts);
+    const unsigned char *in = pixels + first * stride;
+
+    segmentInit(&part[i]);
+    if (codec == CODEC_PNG)
+      status |= compressPNG(in, stride, pixel_size, width, last - first,
+                            &part[i]);
+    else
+      status |= compressQOI(in, stride, pixel_size, width, last - first,
+                            &part[i]);
+  }
+
+  for (i = 0; i < parts; ++i) {
+    if (status == 0)
+      status = segmentAppend(segment, &part[i]);
+    free(part[i].data);
+  }
+  free(part);
+  return status;
+}
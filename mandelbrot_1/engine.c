@@ -0,0 +1,184 @@
+#include "engine.h"
+#include "kernel.h"
+
+/**
+ * Rectangles with less pixels than this in either direction are computed
+ * pixel by pixel instead of being subdivided further.
+ */
+#define RECT_MIN_SIZE 6
+
+/** Marks a pixel whose iteration count has not been computed yet */
+#define NOT_COMPUTED -1
+
+/*--- Type definitions -----------------------------------------------------*/
+
+/**
+ * Image region an engine fills with iteration counts.
+ */
+typedef struct {
+  const mandel_t *data;  /**< Mandelbrot parameters */
+  int x0;                /**< First column of the region */
+  int y0;                /**< First row of the region */
+  int *iters;            /**< Iteration counts, iters[0] is (x0, y0) */
+  float *smooth;         /**< Continuous iteration counts, or NULL */
+  int stride;            /**< Distance between two rows in @p iters */
+  mandel_stats_t *stats; /**< Statistics to add the work done to */
+} region_t;
+
+/*--- Implementation -------------------------------------------------------*/
+
+/**
+ * Returns a pointer to the iteration count of a pixel of the region.
+ */
+static inline int *regionAt(const region_t *region, int x, int y) {
+  return region->iters + (y - region->y0) * region->stride + (x - region->x0);
+}
+
+/**
+ * Computes the pixels @p from (inclusive) to @p to (exclusive) of row @p y
+ * that have not been computed yet. Consecutive pixels are handed to the
+ * kernel together, so they can be vectorized.
+ */
+static void regionSpan(const region_t *region, int y, int from, int to) {
+  int *iters = regionAt(region, from, y);
+  float *smooth = NULL;
+  int x = 0;
+
+  if (region->smooth)
+    smooth = region->smooth + (iters - region->iters);
+
+  /* iters[x] is the pixel from + x */
+  while (x < to - from) {
+    int end;
+
+    if (iters[x] != NOT_COMPUTED) {
+      ++x;
+      continue;
+    }
+    for (end = x + 1; end < to - from && iters[end] == NOT_COMPUTED; ++end)
+      ;
+    kernelRow(region->data, y, from + x, from + end, iters + x,
+              smooth ? smooth + x : NULL, region->stats);
+    x = end;
+  }
+}
+
+/**
+ * Mariani-Silver algorithm: computes the border of the rectangle
+ * [@p x0, @p x1) x [@p y0, @p y1). If all border pixels share the same
+ * iteration count, the whole rectangle is filled with it. Otherwise the
+ * rectangle is split in half along its longer side and both halves, which
+ * share the dividing line, are processed recursively.
+ *
+ * For bounded pixels this is exact, as the Mandelbrot set is connected and
+ * has no holes; for escaping pixels it assumes that no feature smaller than
+ * the rectangle crosses a uniform border. Filled pixels get the integer
+ * count as continuous count.
+ */
+static void regionSubdivide(const region_t *region, int x0, int y0, int x1,
+                            int y1) {
+  int value;
+  int x;
+  int y;
+
+  /* Small rectangles: compute whatever is left */
+  if (x1 - x0 < RECT_MIN_SIZE || y1 - y0 < RECT_MIN_SIZE) {
+    for (y = y0; y < y1; ++y)
+      regionSpan(region, y, x0, x1);
+    return;
+  }
+
+  /* Border */
+  regionSpan(region, y0, x0, x1);
+  regionSpan(region, y1 - 1, x0, x1);
+  for (y = y0 + 1; y < y1 - 1; ++y) {
+    regionSpan(region, y, x0, x0 + 1);
+    regionSpan(region, y, x1 - 1, x1);
+  }
+
+  /* Check whether the border is uniform */
+  value = *regionAt(region, x0, y0);
+  for (x = x0; x < x1; ++x)
+    if (*regionAt(region, x, y0) != value ||
+        *regionAt(region, x, y1 - 1) != value)
+      break;
+  for (y = y0 + 1; x == x1 && y < y1 - 1; ++y)
+    if (*regionAt(region, x0, y) != value ||
+        *regionAt(region, x1 - 1, y) != value)
+      break;
+
+  if (x == x1 && y >= y1 - 1) {
+    /* Uniform => fill the inside */
+    for (y = y0 + 1; y < y1 - 1; ++y) {
+      int *iters = regionAt(region, x0 + 1, y);
+
+      for (x = 0; x < x1 - x0 - 2; ++x)
+        iters[x] = value;
+      if (region->smooth) {
+        float *smooth = region->smooth + (iters - region->iters);
+
+        for (x = 0; x < x1 - x0 - 2; ++x)
+          smooth[x] = (float)value;
+      }
+    }
+    region->stats->filled += (long long)(x1 - x0 - 2) * (y1 - y0 - 2);
+  } else if (x1 - x0 >= y1 - y0) {
+    int mid = x0 + (x1 - x0) / 2;
+
+    regionSubdivide(region, x0, y0, mid + 1, y1);
+    regionSubdivide(region, mid, y0, x1, y1);
+  } else {
+    int mid = y0 + (y1 - y0) / 2;
+
+    regionSubdivide(region, x0, y0, x1, mid + 1);
+    regionSubdivide(region, x0, mid, x1, y1);
+  }
+}
+
+/**
+ * Calculates the iteration counts of the pixels in the rectangle
+ * [@p x0, @p x1) x [@p y0, @p y1) using the engine selected in
+ * @p data->engine.
+ *
+ * @param  data    Mandelbrot parameters
+ * @param  x0      First column
+ * @param  y0      First row
+ * @param  x1      Column after the last one
+ * @param  y1      Row after the last one
+ * @param  iters   Output: iteration counts, @p iters[0] is (@p x0, @p y0)
+ * @param  smooth  Output: continuous iteration counts laid out like
+ *                 @p iters, or NULL if not needed
+ * @param  stride  Distance between two rows in @p iters and @p smooth
+ * @param  stats   Statistics to add the work done to
+ */
+void engineRect(const mandel_t *data, int x0, int y0, int x1, int y1,
+                int *iters, float *smooth, int stride,
+                mandel_stats_t *stats) {
+  region_t region;
+  int y;
+
+  if (data->engine == ENGINE_PIXEL) {
+    for (y = y0; y < y1; ++y)
+      kernelRow(data, y, x0, x1, iters + (y - y0) * stride,
+                smooth ? smooth + (y - y0) * stride : NULL, stats);
+    return;
+  }
+
+  region.data = data;
+  region.x0 = x0;
+  region.y0 = y0;
+  region.iters = iters;
+  region.smooth = smooth;
+  region.stride = stride;
+  region.stats = stats;
+
+  for (y = y0; y < y1; ++y) {
+    int x;
+    int *row = regionAt(&region, x0, y);
+
+    for (x = 0; x < x1 - x0; ++x)
+      row[x] = NOT_COMPUTED;
+  }
+
+  regionSubdivide(&region, x0, y0, x1, y1);
+}
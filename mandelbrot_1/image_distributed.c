@@ -1,26 +1,38 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
-#include <assert.h>
 #include <mpi.h>
 
+#include "compress.h"
 #include "image_distributed.h"
 
+/** Bytes per element of the datatypes large blocks are written with */
+#define IMAGE_CHUNK (1 << 20)
+
 /*--- Implementation -------------------------------------------------------*/
 
 /**
  * Allocates and initializes an image data structure of the given
- * dimensions.
+ * dimensions. The pixels are stored row by row in one buffer aligned to
+ * IMAGE_ALIGNMENT bytes. The image is distributed among all processes
+ * (MPI_COMM_WORLD).
  *
- * @param  width   Image width in pixels
- * @param  height  Image height in pixels
+ * @param  global_width   Image width in pixels
+ * @param  global_height  Image height in pixels
+ * @param  local_width    Width of the local block in pixels
+ * @param  local_height   Height of the local block in pixels
+ * @param  x_offset       First column of the local block
+ * @param  y_offset       First row of the local block
+ * @param  format         Format to store the pixels in
  *
  * @return Pointer to image data structure if successful, NULL otherwise
  */
 image_t *imageCreate(int global_width, int global_height, int local_width,
-                     int local_height, int x_offset, int y_offset) {
-  int x;
+                     int local_height, int x_offset, int y_offset,
+                     pixel_format_t format) {
   image_t *image;
+  size_t size;
 
   /* Allocate image data structure */
   image = (image_t *)malloc(sizeof(image_t));
@@ -29,124 +41,932 @@ image_t *imageCreate(int global_width, int global_height, int local_width,
     return NULL;
   }
 
-  /* Allocate imaga data array */
-  image->data = (color_t **)malloc(local_width * sizeof(color_t *));
+  /* Set attributes */
+  image->global_width = global_width;
+  image->global_height = global_height;
+
+  image->local_width = local_width;
+  image->local_height = local_height;
+
+  image->x_offset = x_offset;
+  image->y_offset = y_offset;
+
+  image->format = format;
+  image->pixel_size = imagePixelSize(format);
+  image->stride = (size_t)local_width * image->pixel_size;
+  image->comm = MPI_COMM_WORLD;
+  image->win = MPI_WIN_NULL;
+
+  /* Allocate image data array */
+  size = image->stride * local_height;
+  // aligned_alloc() wants a multiple of the alignment
+  size = (size + IMAGE_ALIGNMENT - 1) / IMAGE_ALIGNMENT * IMAGE_ALIGNMENT;
+  image->data = (unsigned char *)aligned_alloc(IMAGE_ALIGNMENT,
+                                               size ? size : IMAGE_ALIGNMENT);
   if (!image->data) {
     fprintf(stderr, "Memory allocation error!\n");
     free(image);
     return NULL;
   }
-  for (x = 0; x < local_width; ++x) {
-    image->data[x] = (color_t *)malloc(local_height * sizeof(color_t));
-    if (!image->data[x]) {
-      int i;
 
-      fprintf(stderr, "Memory allocation error!\n");
-      for (i = x - 1; i >= 0; --i)
-        free(image->data[i]);
-      free(image->data);
-      free(image);
-      return NULL;
-    }
+  return image;
+}
+
+/**
+ * Creates an image of full rows like imageCreate(), but with the pixels of
+ * all processes of a node in a single MPI_Win_allocate_shared() window.
+ * The first process of @p node allocates the window, and each process
+ * gets its rows in it, after those of the processes of lower rank in
+ * @p node. Those have to hold the rows right above, so that the window
+ * holds the rows of the node back to back, as imageSaveShared() writes
+ * them. Collective over @p node; has to be freed with imageFree() by all
+ * processes of @p node.
+ *
+ * @param  global_width   Image width in pixels
+ * @param  global_height  Image height in pixels
+ * @param  local_height   Number of rows of the calling process
+ * @param  y_offset       First row of the calling process
+ * @param  format         Format to store the pixels in
+ * @param  node           Processes of the node, see MPI_Comm_split_type()
+ *
+ * @return Pointer to image data structure if successful, NULL otherwise
+ */
+image_t *imageCreateShared(int global_width, int global_height,
+                           int local_height, int y_offset,
+                           pixel_format_t format, MPI_Comm node) {
+  image_t *image;
+  MPI_Aint size;
+  MPI_Aint total;
+  MPI_Aint offset = 0;
+  int disp_unit;
+  int rank;
+  unsigned char *base;
+
+  image = (image_t *)malloc(sizeof(image_t));
+  if (!image) {
+    fprintf(stderr, "Memory allocation error!\n");
+    return NULL;
   }
 
-  /* Set attributes */
   image->global_width = global_width;
   image->global_height = global_height;
-
-  image->local_width = local_width;
+  image->local_width = global_width;
   image->local_height = local_height;
-
-  image->x_offset = x_offset;
+  image->x_offset = 0;
   image->y_offset = y_offset;
+  image->format = format;
+  image->pixel_size = imagePixelSize(format);
+  image->stride = (size_t)global_width * image->pixel_size;
+  image->comm = MPI_COMM_WORLD;
+
+  /* The rows of this process follow those of the lower ranks */
+  MPI_Comm_rank(node, &rank);
+  size = (MPI_Aint)image->stride * local_height;
+  MPI_Exscan(&size, &offset, 1, MPI_AINT, MPI_SUM, node);
+  if (rank == 0)
+    offset = 0; // MPI_Exscan() leaves it undefined
+  MPI_Allreduce(&size, &total, 1, MPI_AINT, MPI_SUM, node);
+
+  if (MPI_Win_allocate_shared(rank == 0 ? (total ? total : 1) : 0, 1,
+                              MPI_INFO_NULL, node, &base,
+                              &image->win) != MPI_SUCCESS) {
+    fprintf(stderr, "Memory allocation error!\n");
+    free(image);
+    return NULL;
+  }
+  MPI_Win_shared_query(image->win, 0, &size, &disp_unit, &base);
+  image->data = base + offset;
 
   return image;
 }
 
 /**
- * Releases all resources occupied by the given image data structure.
+ * Releases all resources occupied by the given image data structure. The
+ * window of an image of imageCreateShared() is freed collectively.
  *
  * @param  image  Image data structure to be freed
  */
 void imageFree(image_t *image) {
-  int x;
-
   /* Free up resources */
-  for (x = 0; x < image->local_width; ++x)
-    free(image->data[x]);
-  free(image->data);
+  if (image->win != MPI_WIN_NULL)
+    MPI_Win_free(&image->win);
+  else
+    free(image->data);
   free(image);
 }
 
 /**
- * Set the color of a single pixel.
- *
- * @param  image  Image data structure
- * @param  x      X coordinate
- * @param  y      Y coordinate
- * @param  color  Color value
+ * Returns the name of a pixel format of iteration counts, as used in the
+ * header of count files, or NULL for the color formats.
+ */
+static const char *countFormatName(pixel_format_t format) {
+  switch (format) {
+  case PIXEL_ITER16:
+    return "iter16";
+  case PIXEL_ITER32:
+    return "iter32";
+  case PIXEL_SMOOTH32:
+    return "smooth32";
+  default:
+    return NULL;
+  }
+}
+
+/**
+ * Returns a committed datatype of @p size bytes, so that a single element
+ * of it covers buffers beyond the INT_MAX bytes a count can express. The
+ * caller frees it with MPI_Type_free(), which may be done as soon as the
+ * write using it has been started.
  */
-void imageSetPixel(image_t *image, int x, int y, color_t color) {
-  // assert that acess is to a local px
-  assert(x - image->x_offset >= 0 && x - image->x_offset < image->local_width);
-  assert(y - image->y_offset >= 0 && y - image->y_offset < image->local_height);
-  image->data[x - image->x_offset][y - image->y_offset] = color;
+static MPI_Datatype bytesType(MPI_Offset size) {
+  MPI_Datatype chunk;
+  MPI_Datatype type;
+  int lengths[2];
+  MPI_Aint displacements[2];
+  MPI_Datatype types[2];
+
+  MPI_Type_contiguous(IMAGE_CHUNK, MPI_BYTE, &chunk);
+  lengths[0] = (int)(size / IMAGE_CHUNK);
+  lengths[1] = (int)(size % IMAGE_CHUNK);
+  displacements[0] = 0;
+  displacements[1] = (MPI_Aint)lengths[0] * IMAGE_CHUNK;
+  types[0] = chunk;
+  types[1] = MPI_BYTE;
+  MPI_Type_create_struct(2, lengths, displacements, types, &type);
+  MPI_Type_commit(&type);
+  MPI_Type_free(&chunk);
+
+  return type;
 }
 
 /**
- * Writes the given image to a PPM file with the provided name.
+ * Creates the file @p filename of @p header_size bytes of @p header
+ * followed by the pixels of the global image, and sets a file view that
+ * only shows the block of the calling process. Collective.
  *
- * @param  image     Image data structure
- * @param  filename  Name of output file
+ * @return 0 on success, -1 if the file could not be created
  */
-void imageSave(image_t *image, const char *filename) {
+static int openBlocks(const image_t *image, const char *filename,
+                      const char *header, int header_size, int pixel_size,
+                      MPI_Info info, MPI_File *file) {
+  int rank;
+  MPI_Comm_rank(image->comm, &rank);
+
+  MPI_Datatype filetype;
+  int sizes[2];
+  int subsizes[2];
+  int starts[2];
+  MPI_Offset size = header_size + (MPI_Offset)image->global_width *
+                                      image->global_height * pixel_size;
+
+  if (MPI_File_open(image->comm, filename,
+                    MPI_MODE_WRONLY | MPI_MODE_CREATE, info,
+                    file) != MPI_SUCCESS) {
+    if (rank == 0)
+      fprintf(stderr, "Could not create output file \"%s\"!\n", filename);
+    return -1;
+  }
+  // drop the contents of an older, larger file
+  MPI_File_set_size(*file, size);
+
+  if (rank == 0) { // only rank 0 writes the header
+    MPI_File_write_at(*file, 0, header, header_size, MPI_CHAR,
+                      MPI_STATUS_IGNORE);
+  }
+
+  /* Block of this process within the pixel data (in bytes) */
+  // a subarray cannot be empty: a process without pixels gets a plain
+  // view and writes nothing to it
+  if ((size_t)image->local_width * image->local_height == 0) {
+    MPI_File_set_view(*file, header_size, MPI_BYTE, MPI_BYTE, "native",
+                      info);
+    return 0;
+  }
+  sizes[0] = image->global_height;
+  sizes[1] = image->global_width * pixel_size;
+  subsizes[0] = image->local_height;
+  subsizes[1] = image->local_width * pixel_size;
+  starts[0] = image->y_offset;
+  starts[1] = image->x_offset * pixel_size;
+  MPI_Type_create_subarray(2, sizes, subsizes, starts, MPI_ORDER_C, MPI_BYTE,
+                           &filetype);
+  MPI_Type_commit(&filetype);
+  MPI_File_set_view(*file, header_size, MPI_BYTE, filetype, "native", info);
+  MPI_Type_free(&filetype);
+
+  return 0;
+}
+
+/**
+ * Writes a file consisting of @p header followed by the pixels of the
+ * global image. Each process writes its block from @p buffer, which holds
+ * the local rows back to back. The position of the block in the file is
+ * described with a file view, so the whole image is written with a single
+ * collective MPI_File_write_at_all() call. The MPI-IO implementation may
+ * then aggregate the blocks on a few processes (two-phase I/O), which can
+ * be tuned with hints like "cb_buffer_size" or "cb_nodes" in @p info.
+ * Rank 0 prints the achieved bandwidth.
+ */
+static void writeBlocks(const image_t *image, const char *filename,
+                        const char *header, int header_size,
+                        const unsigned char *buffer, int pixel_size,
+                        MPI_Info info) {
+  int rank;
+  MPI_Comm_rank(image->comm, &rank);
+
+  MPI_File file;
+  MPI_Datatype type;
+  double start_time;
+  double elapsed;
+  double max_elapsed;
+  MPI_Offset size = header_size + (MPI_Offset)image->global_width *
+                                      image->global_height * pixel_size;
+
+  start_time = MPI_Wtime();
+
+  if (openBlocks(image, filename, header, header_size, pixel_size, info,
+                 &file) != 0)
+    return;
+
+  /* Write pixel data */
+  type = bytesType((MPI_Offset)image->local_width * image->local_height *
+                   pixel_size);
+  MPI_File_write_at_all(file, 0, buffer, image->local_height ? 1 : 0, type,
+                        MPI_STATUS_IGNORE);
+  MPI_Type_free(&type);
+
+  /* Close output file */
+  MPI_File_close(&file);
+
+  elapsed = MPI_Wtime() - start_time;
+  MPI_Reduce(&elapsed, &max_elapsed, 1, MPI_DOUBLE, MPI_MAX, 0,
+             image->comm);
+  if (rank == 0) {
+    printf("Write time (%s): %2.6f seconds (%.1f MB/s)\n", filename,
+           max_elapsed, size / 1e6 / max_elapsed);
+  }
+}
+
+/**
+ * Copies the local pixels of an RGB24 or RGBA32 image to @p out as packed
+ * RGB rows, back to back.
+ */
+static void packRGB(const image_t *image, unsigned char *out) {
   int x;
   int y;
 
-  int rank, numprocs;
-  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
-  MPI_Comm_size(MPI_COMM_WORLD, &numprocs);
+  for (y = 0; y < image->local_height; ++y) {
+    const unsigned char *row = image->data + y * image->stride;
 
-  MPI_File file;
+    for (x = 0; x < image->local_width; ++x) {
+      out[3 * x] = row[image->pixel_size * x];
+      out[3 * x + 1] = row[image->pixel_size * x + 1];
+      out[3 * x + 2] = row[image->pixel_size * x + 2];
+    }
+    out += (size_t)image->local_width * 3;
+  }
+}
 
-  if (rank == 0) { // only rank 0 writes the header
-    FILE *fp;
-    /* Open output file */
-    fp = fopen(filename, "w");
-    if (!fp) {
+/**
+ * Starts writing the rows of an RGB24 or RGBA32 image to a PNG or QOI
+ * file, with a nonblocking collective write (see imageSaveBegin()). Each
+ * process compresses its rows on its own (see compressRows()) and learns
+ * where they go in the file from the compressed sizes of the lower ranks
+ * with MPI_Exscan(). Rank 0 writes the header and, with the checksum of
+ * all rows for PNG, the trailer. The local block has to consist of full
+ * rows.
+ *
+ * @param  size  Output: size of the file in bytes
+ *
+ * @return 0 on success, -1 if the file could not be created
+ */
+static int saveCompressedBegin(const image_t *image, const char *filename,
+                               codec_t codec, MPI_Info info,
+                               image_write_t *write, MPI_Offset *size) {
+  int rank;
+  int numprocs;
+  MPI_Comm_rank(image->comm, &rank);
+  MPI_Comm_size(image->comm, &numprocs);
+
+  segment_t segment;
+  MPI_Offset local_size;
+  MPI_Offset offset = 0;
+  MPI_Offset total;
+  unsigned long long checksum[2];
+  unsigned long long *checksums = NULL;
+  unsigned char header[CODEC_MAX_HEADER];
+  unsigned char trailer[CODEC_MAX_HEADER];
+  int header_size;
+  int trailer_size;
+  MPI_Datatype type;
+  int i;
+
+  assert(image->x_offset == 0 && image->local_width == image->global_width);
+  if (compressRows(codec, image->data, image->stride, image->pixel_size,
+                   image->local_width, image->local_height, &segment) != 0) {
+    fprintf(stderr, "Memory allocation error!\n");
+    MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+  }
+
+  /* The rows of this process follow those of the lower ranks */
+  local_size = segment.size;
+  MPI_Exscan(&local_size, &offset, 1, MPI_OFFSET, MPI_SUM, image->comm);
+  if (rank == 0)
+    offset = 0; // MPI_Exscan() leaves it undefined
+  MPI_Allreduce(&local_size, &total, 1, MPI_OFFSET, MPI_SUM, image->comm);
+
+  /* The PNG checksum combines those of all processes, in order */
+  checksum[0] = segment.adler;
+  checksum[1] = segment.length;
+  if (rank == 0) {
+    checksums = (unsigned long long *)malloc(2 * numprocs *
+                                             sizeof(unsigned long long));
+    if (!checksums) {
+      fprintf(stderr, "Memory allocation error!\n");
+      MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+    }
+  }
+  MPI_Gather(checksum, 2, MPI_UNSIGNED_LONG_LONG, checksums, 2,
+             MPI_UNSIGNED_LONG_LONG, 0, image->comm);
+  if (rank == 0) {
+    segment_t all;
+    segment_t part;
+
+    segmentInit(&all);
+    segmentInit(&part);
+    for (i = 0; i < numprocs; ++i) {
+      part.adler = (uint32_t)checksums[2 * i];
+      part.length = (size_t)checksums[2 * i + 1];
+      segmentAppend(&all, &part);
+    }
+    free(checksums);
+    checksum[0] = all.adler;
+  }
+
+  header_size = codecHeader(codec, image->global_width, image->global_height,
+                            header);
+  trailer_size = codecTrailer(codec, (uint32_t)checksum[0], trailer);
+  *size = header_size + total + trailer_size;
+
+  if (MPI_File_open(image->comm, filename,
+                    MPI_MODE_WRONLY | MPI_MODE_CREATE, info,
+                    &write->file) != MPI_SUCCESS) {
+    if (rank == 0)
       fprintf(stderr, "Could not create output file \"%s\"!\n", filename);
+    free(segment.data);
+    write->buffer = NULL;
+    return -1;
+  }
+  // drop the contents of an older, larger file
+  MPI_File_set_size(write->file, *size);
+
+  if (rank == 0) { // only rank 0 writes header and trailer
+    MPI_File_write_at(write->file, 0, header, header_size, MPI_BYTE,
+                      MPI_STATUS_IGNORE);
+    MPI_File_write_at(write->file, header_size + total, trailer,
+                      trailer_size, MPI_BYTE, MPI_STATUS_IGNORE);
+  }
+
+  write->buffer = segment.data;
+  write->close = 1;
+  type = bytesType(local_size);
+  MPI_File_iwrite_at_all(write->file, header_size + offset, write->buffer,
+                         local_size ? 1 : 0, type, &write->request);
+  MPI_Type_free(&type);
+  return 0;
+}
+
+/**
+ * Writes the given image to a PPM file with the provided name. Has to be
+ * called by all processes.
+ *
+ * RGB24 images are written straight from the image buffer, RGBA32 images
+ * are packed into an RGB copy first (see writeBlocks()). Names ending in
+ * ".png" or ".qoi" give a compressed file instead, which all processes
+ * compress their rows for in parallel (see saveCompressedBegin()); rank 0
+ * then prints the time including the compression.
+ *
+ * @param  image     Image data structure
+ * @param  filename  Name of output file
+ * @param  info      Hints for the MPI-IO implementation, or MPI_INFO_NULL
+ */
+void imageSave(image_t *image, const char *filename, MPI_Info info) {
+  int rank;
+  MPI_Comm_rank(image->comm, &rank);
+
+  char header[64];
+  int header_size;
+  codec_t codec = codecFromName(filename);
+
+  header_size = snprintf(header, sizeof(header), "P6\n%d %d\n255\n",
+                         image->global_width, image->global_height);
+
+  /* RGB24 rows can be written as they are, RGBA32 rows are packed */
+  unsigned char *buffer = image->data;
+  if (countFormatName(image->format)) {
+    if (rank == 0)
+      fprintf(stderr, "Cannot save iteration counts as PPM image!\n");
+    return;
+  }
+  if (codec != CODEC_PPM) {
+    image_write_t write;
+    MPI_Offset size;
+    double elapsed = MPI_Wtime();
+    double max_elapsed;
+
+    if (saveCompressedBegin(image, filename, codec, info, &write, &size) !=
+        0)
       return;
+    imageWriteEnd(&write);
+
+    elapsed = MPI_Wtime() - elapsed;
+    MPI_Reduce(&elapsed, &max_elapsed, 1, MPI_DOUBLE, MPI_MAX, 0,
+               image->comm);
+    if (rank == 0) {
+      printf("Write time (%s): %2.6f seconds (%.1f MB, %.1f%% of PPM)\n",
+             filename, max_elapsed, size / 1e6,
+             100.0 * size / (header_size + 3.0 * image->global_width *
+                                               image->global_height));
+    }
+    return;
+  }
+  if (image->format != PIXEL_RGB24) {
+    buffer = (unsigned char *)malloc((size_t)image->local_width *
+                                     image->local_height * 3);
+    if (!buffer) {
+      fprintf(stderr, "Memory allocation error!\n");
+      MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
     }
+    packRGB(image, buffer);
+  }
 
-    /* Write PPM header */
-    fprintf(fp, "P6\n%d %d\n255\n", image->global_width, image->global_height);
-    fclose(fp);
+  writeBlocks(image, filename, header, header_size, buffer, 3, info);
+
+  if (buffer != image->data)
+    free(buffer);
+}
+
+/**
+ * Writes an image of imageCreateShared() like imageSave(), but with only
+ * one process per node touching the file: once all processes of a node
+ * have their pixels in the window, its first process writes the rows of
+ * the whole node, which are contiguous in the file, with imageSave() over
+ * @p leaders. The file system thus only sees one client per node. Has to
+ * be called by all processes.
+ *
+ * @param  image     Image data structure of imageCreateShared()
+ * @param  filename  Name of output file
+ * @param  info      Hints for the MPI-IO implementation, or MPI_INFO_NULL
+ * @param  node      Processes of the node, as given to imageCreateShared()
+ * @param  leaders   First processes of all nodes, MPI_COMM_NULL on the
+ *                   other processes
+ */
+void imageSaveShared(image_t *image, const char *filename, MPI_Info info,
+                     MPI_Comm node, MPI_Comm leaders) {
+  image_t block = *image;
+  int first = image->y_offset;
+  int rows = image->local_height;
+
+  // the pixels of all processes of the node have to be in the window
+  MPI_Win_lock_all(MPI_MODE_NOCHECK, image->win);
+  MPI_Win_sync(image->win);
+  MPI_Barrier(node);
+  MPI_Win_sync(image->win);
+  MPI_Win_unlock_all(image->win);
+
+  /* The block of the node starts with the rows of its first process */
+  MPI_Reduce(&image->local_height, &rows, 1, MPI_INT, MPI_SUM, 0, node);
+  if (leaders == MPI_COMM_NULL)
+    return;
+  block.local_height = rows;
+  block.y_offset = first;
+  block.comm = leaders;
+  imageSave(&block, filename, info);
+}
+
+/**
+ * Starts writing an RGB24 or RGBA32 image to a PPM file like imageSave(),
+ * but with a nonblocking collective write, so the caller can go on with
+ * the next image meanwhile. The pixels are copied, the image may be
+ * changed right away. Has to be called by all processes, and every write
+ * has to be finished with imageWriteEnd(). Like imageSave(), this writes
+ * PNG or QOI files for names ending in ".png" or ".qoi".
+ *
+ * @param  image     Image data structure
+ * @param  filename  Name of output file
+ * @param  info      Hints for the MPI-IO implementation, or MPI_INFO_NULL
+ * @param  write     Output: state of the write
+ *
+ * @return 0 on success, -1 if the file could not be created
+ */
+int imageSaveBegin(const image_t *image, const char *filename, MPI_Info info,
+                   image_write_t *write) {
+  char header[64];
+  int header_size;
+  size_t size = (size_t)image->local_width * image->local_height * 3;
+  MPI_Datatype type;
+  codec_t codec = codecFromName(filename);
+
+  if (codec != CODEC_PPM) {
+    MPI_Offset file_size;
+
+    return saveCompressedBegin(image, filename, codec, info, write,
+                               &file_size);
+  }
+
+  header_size = snprintf(header, sizeof(header), "P6\n%d %d\n255\n",
+                         image->global_width, image->global_height);
+
+  write->buffer = (unsigned char *)malloc(size ? size : 1);
+  if (!write->buffer) {
+    fprintf(stderr, "Memory allocation error!\n");
+    MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+  }
+  packRGB(image, write->buffer);
+
+  if (openBlocks(image, filename, header, header_size, 3, info,
+                 &write->file) != 0) {
+    free(write->buffer);
+    write->buffer = NULL;
+    return -1;
+  }
+  write->close = 1;
+  type = bytesType(size);
+  MPI_File_iwrite_at_all(write->file, 0, write->buffer, size ? 1 : 0, type,
+                         &write->request);
+  MPI_Type_free(&type);
+  return 0;
+}
+
+/**
+ * Creates a YUV4MPEG2 (Y4M) video file for frames of the size of @p image,
+ * in full resolution 4:4:4 color. The file view of each process covers its
+ * block of every frame, and rank 0 also writes the "FRAME" line in front
+ * of each frame. Frames are written with imageSaveY4MBegin(); the file is
+ * closed with MPI_File_close(). Collective.
+ *
+ * @param  image     Image data structure, for the size and the local block
+ * @param  filename  Name of output file
+ * @param  fps       Frames per second
+ * @param  info      Hints for the MPI-IO implementation, or MPI_INFO_NULL
+ * @param  file      Output: the open file
+ *
+ * @return 0 on success, -1 if the file could not be created
+ */
+int imageOpenY4M(const image_t *image, const char *filename, int fps,
+                 MPI_Info info, MPI_File *file) {
+  static const char frame[] = "FRAME\n";
+  int rank;
+  MPI_Comm_rank(image->comm, &rank);
+
+  char header[96];
+  int header_size;
+  MPI_Offset plane =
+      (MPI_Offset)image->global_width * image->global_height;
+  MPI_Datatype block;
+  MPI_Datatype frametype;
+  MPI_Datatype filetype;
+  int sizes[3];
+  int subsizes[3];
+  int starts[3];
+  int lengths[2] = {sizeof(frame) - 1, 1};
+  MPI_Aint displacements[2] = {0, sizeof(frame) - 1};
+  MPI_Datatype types[2];
+
+  header_size = snprintf(header, sizeof(header),
+                         "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C444\n",
+                         image->global_width, image->global_height, fps);
+
+  if (MPI_File_open(image->comm, filename,
+                    MPI_MODE_WRONLY | MPI_MODE_CREATE, info,
+                    file) != MPI_SUCCESS) {
+    if (rank == 0)
+      fprintf(stderr, "Could not create output file \"%s\"!\n", filename);
+    return -1;
   }
+  MPI_File_set_size(*file, 0);
+  if (rank == 0) {
+    MPI_File_write_at(*file, 0, header, header_size, MPI_CHAR,
+                      MPI_STATUS_IGNORE);
+  }
+
+  /* Block of this process in each of the Y, U and V planes */
+  sizes[0] = 3;
+  sizes[1] = image->global_height;
+  sizes[2] = image->global_width;
+  subsizes[0] = 3;
+  subsizes[1] = image->local_height;
+  subsizes[2] = image->local_width;
+  starts[0] = 0;
+  starts[1] = image->y_offset;
+  starts[2] = image->x_offset;
+  MPI_Type_create_subarray(3, sizes, subsizes, starts, MPI_ORDER_C, MPI_BYTE,
+                           &block);
+
+  /* Rank 0 adds the "FRAME" line; the frames follow each other */
+  types[0] = MPI_BYTE;
+  types[1] = block;
+  if (rank == 0)
+    MPI_Type_create_struct(2, lengths, displacements, types, &frametype);
+  else
+    MPI_Type_create_struct(1, lengths + 1, displacements + 1, types + 1,
+                           &frametype);
+  MPI_Type_create_resized(frametype, 0, sizeof(frame) - 1 + 3 * plane,
+                          &filetype);
+  MPI_Type_commit(&filetype);
+  MPI_File_set_view(*file, header_size, MPI_BYTE, filetype, "native", info);
+  MPI_Type_free(&filetype);
+  MPI_Type_free(&frametype);
+  MPI_Type_free(&block);
+
+  return 0;
+}
 
-  // barrier to ensure that file was properly closed on rank 0 before any
-  // process may open it
-  MPI_Barrier(MPI_COMM_WORLD);
+/**
+ * Starts writing an RGB24 or RGBA32 image as frame number @p frame of a
+ * Y4M file opened with imageOpenY4M(), with a nonblocking collective write
+ * (see imageSaveBegin()). The colors are converted to limited range
+ * BT.601 YUV. Has to be called by all processes, and every write has to be
+ * finished with imageWriteEnd().
+ *
+ * @param  image  Image data structure
+ * @param  file   Y4M file
+ * @param  frame  Number of the frame, counting from 0
+ * @param  write  Output: state of the write
+ */
+void imageSaveY4MBegin(const image_t *image, MPI_File file, int frame,
+                       image_write_t *write) {
+  int rank;
+  MPI_Comm_rank(image->comm, &rank);
 
-  MPI_File_open(MPI_COMM_WORLD, filename,
-                MPI_MODE_WRONLY | MPI_MODE_EXCL | MPI_MODE_APPEND,
-                MPI_INFO_NULL, &file);
+  size_t plane = (size_t)image->local_width * image->local_height;
+  int header_size = rank == 0 ? 6 : 0;
+  size_t size = header_size + 3 * plane;
+  MPI_Datatype type;
+  unsigned char *y_plane;
+  unsigned char *u_plane;
+  unsigned char *v_plane;
+  int x;
+  int y;
 
-  // offset where the local part begins (assuming a row wise distribution of the
-  // img)
-  int file_offset = image->y_offset * image->global_width * 3;
+  write->buffer = (unsigned char *)malloc(size ? size : 1);
+  if (!write->buffer) {
+    fprintf(stderr, "Memory allocation error!\n");
+    MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+  }
+  memcpy(write->buffer, "FRAME\n", header_size);
+  y_plane = write->buffer + header_size;
+  u_plane = y_plane + plane;
+  v_plane = u_plane + plane;
 
-  // goto the part assigned to this process
-  MPI_File_seek(file, file_offset, MPI_SEEK_END);
-  // seek after end: after header
+  for (y = 0; y < image->local_height; ++y) {
+    const unsigned char *row = image->data + y * image->stride;
 
-  /* Write PPM data */
-  for (y = 0; y < image->local_height; ++y)
     for (x = 0; x < image->local_width; ++x) {
+      int red = row[image->pixel_size * x];
+      int green = row[image->pixel_size * x + 1];
+      int blue = row[image->pixel_size * x + 2];
 
-      MPI_File_write(file, &(image->data[x][y]), 3, MPI_CHAR,
-                     MPI_STATUS_IGNORE);
+      *y_plane++ = ((66 * red + 129 * green + 25 * blue + 128) >> 8) + 16;
+      *u_plane++ = ((-38 * red - 74 * green + 112 * blue + 128) >> 8) + 128;
+      *v_plane++ = ((112 * red - 94 * green - 18 * blue + 128) >> 8) + 128;
     }
+  }
 
-  /* Close output file */
-  MPI_File_close(&file);
+  // the file view tiles the frames, so frame n starts n local sizes in
+  write->file = file;
+  write->close = 0;
+  type = bytesType(size);
+  MPI_File_iwrite_at_all(file, (MPI_Offset)frame * size, write->buffer, 1,
+                         type, &write->request);
+  MPI_Type_free(&type);
+}
+
+/**
+ * Waits for a write started by imageSaveBegin() or imageSaveY4MBegin() to
+ * finish and releases its resources. Has to be called by all processes.
+ *
+ * @param  write  State of the write
+ */
+void imageWriteEnd(image_write_t *write) {
+  MPI_Wait(&write->request, MPI_STATUS_IGNORE);
+  if (write->close)
+    MPI_File_close(&write->file);
+  free(write->buffer);
+  write->buffer = NULL;
+}
+
+/**
+ * Creates a file for an image that is too large to be held in memory, so
+ * that it can be written band by band with imageStreamWrite(). The file
+ * gets the pixels of the format of @p band: a PPM image for RGB24 and
+ * RGBA32, or a count file (see imageSaveCounts()) for iteration counts.
+ * The calling process owns the full rows [@p from, @p to), which it will
+ * write in bands of at most band->local_height rows. Collective.
+ *
+ * @param  band      Image of the size of a band, full width
+ * @param  from      First row of the calling process
+ * @param  to        Row after the last one of the calling process
+ * @param  filename  Name of output file
+ * @param  maxiter   Maximum number of iterations, for count files
+ * @param  info      Hints for the MPI-IO implementation, or MPI_INFO_NULL
+ * @param  stream    Output: state of the file
+ *
+ * @return 0 on success, -1 if the file could not be created
+ */
+int imageStreamOpen(const image_t *band, int from, int to,
+                    const char *filename, int maxiter, MPI_Info info,
+                    image_stream_t *stream) {
+  const char *name = countFormatName(band->format);
+  char header[96];
+  int header_size;
+  image_t block = *band;
+  size_t size;
+
+  if (name) {
+    stream->pixel_size = band->pixel_size;
+    header_size = snprintf(header, sizeof(header), "MANDEL\n%s %d %d %d\n",
+                           name, band->global_width, band->global_height,
+                           maxiter);
+  } else {
+    stream->pixel_size = 3;
+    header_size = snprintf(header, sizeof(header), "P6\n%d %d\n255\n",
+                           band->global_width, band->global_height);
+  }
+
+  stream->first = from;
+  stream->time = MPI_Wtime();
+  stream->size = header_size + (MPI_Offset)band->global_width *
+                                   band->global_height * stream->pixel_size;
+  stream->filename = filename;
+  stream->bands = 0;
+
+  size = (size_t)band->local_width * band->local_height * stream->pixel_size;
+  stream->buffer = (unsigned char *)malloc(size ? size : 1);
+  if (!stream->buffer) {
+    fprintf(stderr, "Memory allocation error!\n");
+    MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+  }
+
+  // the file view covers all rows of the process, not just the first band
+  block.local_height = to - from;
+  block.y_offset = from;
+  if (openBlocks(&block, filename, header, header_size, stream->pixel_size,
+                 info, &stream->file) != 0) {
+    free(stream->buffer);
+    stream->buffer = NULL;
+    return -1;
+  }
+  stream->request = MPI_REQUEST_NULL;
+  stream->time = MPI_Wtime() - stream->time;
+
+  return 0;
+}
+
+/**
+ * Starts writing the rows of @p band to a file opened with
+ * imageStreamOpen(), with a nonblocking collective write, after the
+ * previous band has been written. The pixels are copied, so the band may
+ * be reused right away. All processes have to write the same number of
+ * bands; a process that is done writes a band of height 0.
+ *
+ * @param  stream  State of the file
+ * @param  band    Image holding the rows to write
+ */
+void imageStreamWrite(image_stream_t *stream, const image_t *band) {
+  double start_time = MPI_Wtime();
+  MPI_Offset size = (MPI_Offset)band->local_width * band->local_height *
+                    stream->pixel_size;
+  MPI_Datatype type;
+
+  MPI_Wait(&stream->request, MPI_STATUS_IGNORE);
+  stream->time += MPI_Wtime() - start_time;
+
+  if (stream->pixel_size == band->pixel_size)
+    memcpy(stream->buffer, band->data, size);
+  else
+    packRGB(band, stream->buffer);
+
+  // the file view starts at the first row of the process; an empty band
+  // is written as no bytes rather than as one empty datatype, which some
+  // MPI-IO implementations cannot handle
+  type = bytesType(size);
+  MPI_File_iwrite_at_all(stream->file,
+                         (MPI_Offset)(band->y_offset - stream->first) *
+                             band->global_width * stream->pixel_size,
+                         stream->buffer, size ? 1 : 0, type,
+                         &stream->request);
+  MPI_Type_free(&type);
+  stream->bands++;
+}
+
+/**
+ * Waits for the last band and closes a file opened with imageStreamOpen().
+ * Rank 0 prints the time the slowest process spent waiting for the file.
+ * Collective.
+ *
+ * @param  stream  State of the file
+ */
+void imageStreamClose(image_stream_t *stream) {
+  int rank;
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+  double start_time = MPI_Wtime();
+  double max_time;
+
+  MPI_Wait(&stream->request, MPI_STATUS_IGNORE);
+  MPI_File_close(&stream->file);
+  stream->time += MPI_Wtime() - start_time;
+  free(stream->buffer);
+  stream->buffer = NULL;
+
+  MPI_Reduce(&stream->time, &max_time, 1, MPI_DOUBLE, MPI_MAX, 0,
+             MPI_COMM_WORLD);
+  if (rank == 0) {
+    printf("Write time (%s): %2.6f seconds waiting for %d bands "
+           "(%.1f MB)\n",
+           stream->filename, max_time, stream->bands, stream->size / 1e6);
+  }
+}
+
+/**
+ * Writes the iteration counts of an ITER16, ITER32 or SMOOTH32 image to a
+ * count file, which can be colored later on (see the colorize program).
+ * The file starts with the text header "MANDEL\n<format> <width> <height>
+ * <maxiter>\n", followed by the counts row by row in the byte order of the
+ * host. Has to be called by all processes.
+ *
+ * @param  image     Image data structure
+ * @param  filename  Name of output file
+ * @param  maxiter   Maximum number of iterations (count of bounded pixels)
+ * @param  info      Hints for the MPI-IO implementation, or MPI_INFO_NULL
+ */
+void imageSaveCounts(image_t *image, const char *filename, int maxiter,
+                     MPI_Info info) {
+  const char *name = countFormatName(image->format);
+  char header[96];
+  int header_size;
+
+  if (!name) {
+    fprintf(stderr, "Image does not hold iteration counts!\n");
+    return;
+  }
+
+  header_size = snprintf(header, sizeof(header), "MANDEL\n%s %d %d %d\n",
+                         name, image->global_width, image->global_height,
+                         maxiter);
+  writeBlocks(image, filename, header, header_size, image->data,
+              image->pixel_size, info);
+}
+
+/**
+ * Reads a whole count file written by imageSaveCounts() on a single
+ * process.
+ *
+ * @param  filename  Name of the count file
+ * @param  maxiter   Output: maximum number of iterations of the file
+ *
+ * @return Image holding the counts if successful, NULL otherwise
+ */
+image_t *imageLoadCounts(const char *filename, int *maxiter) {
+  char name[16];
+  int width;
+  int height;
+  pixel_format_t format;
+  image_t *image;
+  FILE *fp;
+
+  fp = fopen(filename, "rb");
+  if (!fp) {
+    fprintf(stderr, "Could not open count file \"%s\"!\n", filename);
+    return NULL;
+  }
+
+  if (fscanf(fp, "MANDEL %15s %d %d %d", name, &width, &height, maxiter) !=
+          4 ||
+      fgetc(fp) != '\n' || width < 1 || height < 1 || *maxiter < 1) {
+    fprintf(stderr, "\"%s\" is not a count file!\n", filename);
+    fclose(fp);
+    return NULL;
+  }
+
+  for (format = PIXEL_ITER16; format <= PIXEL_SMOOTH32; ++format)
+    if (strcmp(name, countFormatName(format)) == 0)
+      break;
+  if (format > PIXEL_SMOOTH32) {
+    fprintf(stderr, "Unknown count format \"%s\"!\n", name);
+    fclose(fp);
+    return NULL;
+  }
+
+  image = imageCreate(width, height, width, height, 0, 0, format);
+  if (image && fread(image->data, image->stride, height, fp) !=
+                   (size_t)height) {
+    fprintf(stderr, "Count file \"%s\" is truncated!\n", filename);
+    imageFree(image);
+    image = NULL;
+  }
+
+  fclose(fp);
+  return image;
 }
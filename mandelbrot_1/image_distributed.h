@@ -1,6 +1,14 @@
 #ifndef _IMAGE_DISTRIBUTED_H
 #define _IMAGE_DISTRIBUTED_H
 
+#include <assert.h>
+#include <stdint.h>
+
+#include <mpi.h>
+
+/** Alignment of the pixel buffer in bytes (one cache line) */
+#define IMAGE_ALIGNMENT 64
+
 /*--- Type definitions -----------------------------------------------------*/
 
 /**
@@ -15,7 +23,20 @@ typedef struct {
 } color_t;
 
 /**
- * Data type for an RGB image of a specific size.
+ * Formats the pixels of an image are stored in.
+ */
+typedef enum {
+  PIXEL_RGB24,   /**< Packed red, green and blue bytes */
+  PIXEL_RGBA32,  /**< Red, green, blue and an unused byte */
+  PIXEL_ITER16,  /**< Iteration count as 16 bit unsigned integer */
+  PIXEL_ITER32,  /**< Iteration count as 32 bit unsigned integer */
+  PIXEL_SMOOTH32 /**< Continuous iteration count as float */
+} pixel_format_t;
+
+/**
+ * Data type for an RGB image of a specific size. Only the block
+ * [x_offset, x_offset + local_width) x [y_offset, y_offset + local_height)
+ * of the global image is stored locally, row by row in a single buffer.
  */
 typedef struct {
   int global_width;  /**< Image width in pixel */
@@ -24,15 +45,140 @@ typedef struct {
   int local_height;
   int x_offset;
   int y_offset;
-  color_t **data; /**< Image data (2D array of pixel values) */
+  pixel_format_t format; /**< Format of the pixels */
+  int pixel_size;        /**< Bytes per pixel */
+  size_t stride;         /**< Bytes per row */
+  unsigned char *data;   /**< Image data, aligned to IMAGE_ALIGNMENT */
+  MPI_Comm comm;         /**< Processes the image is distributed among */
+  MPI_Win win; /**< Shared window holding data, or MPI_WIN_NULL if own */
 } image_t;
 
+/**
+ * State of an image write in progress, see imageSaveBegin().
+ */
+typedef struct {
+  MPI_File file;         /**< File being written */
+  MPI_Request request;   /**< Request of the nonblocking write */
+  int close;             /**< Non-zero to close the file once written */
+  unsigned char *buffer; /**< Copy of the pixels being written */
+} image_write_t;
+
+/**
+ * State of an image written band by band, see imageStreamOpen().
+ */
+typedef struct {
+  MPI_File file;         /**< File being written */
+  MPI_Request request;   /**< Request of the band being written */
+  int first;             /**< First row of the calling process */
+  int pixel_size;        /**< Bytes per pixel in the file */
+  int bands;             /**< Number of bands written */
+  unsigned char *buffer; /**< Copy of the band being written */
+  MPI_Offset size;       /**< Size of the file in bytes */
+  double time;           /**< Seconds spent opening and waiting */
+  const char *filename;  /**< Name of the file */
+} image_stream_t;
+
 /*--- Function prototypes --------------------------------------------------*/
 
 image_t *imageCreate(int global_width, int global_height, int local_width,
-                     int local_height, int x_offset, int y_offset);
+                     int local_height, int x_offset, int y_offset,
+                     pixel_format_t format);
+image_t *imageCreateShared(int global_width, int global_height,
+                           int local_height, int y_offset,
+                           pixel_format_t format, MPI_Comm node);
 void imageFree(image_t *image);
-void imageSetPixel(image_t *image, int x, int y, color_t color);
-void imageSave(image_t *image, const char *filename);
+void imageSave(image_t *image, const char *filename, MPI_Info info);
+void imageSaveShared(image_t *image, const char *filename, MPI_Info info,
+                     MPI_Comm node, MPI_Comm leaders);
+int imageSaveBegin(const image_t *image, const char *filename, MPI_Info info,
+                   image_write_t *write);
+int imageOpenY4M(const image_t *image, const char *filename, int fps,
+                 MPI_Info info, MPI_File *file);
+void imageSaveY4MBegin(const image_t *image, MPI_File file, int frame,
+                       image_write_t *write);
+void imageWriteEnd(image_write_t *write);
+int imageStreamOpen(const image_t *band, int from, int to,
+                    const char *filename, int maxiter, MPI_Info info,
+                    image_stream_t *stream);
+void imageStreamWrite(image_stream_t *stream, const image_t *band);
+void imageStreamClose(image_stream_t *stream);
+void imageSaveCounts(image_t *image, const char *filename, int maxiter,
+                     MPI_Info info);
+image_t *imageLoadCounts(const char *filename, int *maxiter);
+
+/*--- Inline functions -----------------------------------------------------*/
+
+/**
+ * Returns the number of bytes a pixel of @p format takes in memory.
+ */
+static inline int imagePixelSize(pixel_format_t format) {
+  if (format == PIXEL_RGB24)
+    return 3;
+  if (format == PIXEL_ITER16)
+    return 2;
+  return 4;
+}
+
+/**
+ * Returns a pointer to the local pixel at global coordinates (@p x, @p y).
+ * The checks are only done in debug builds (without NDEBUG).
+ */
+static inline unsigned char *imagePixel(const image_t *image, int x, int y) {
+  // assert that acess is to a local px
+  assert(x - image->x_offset >= 0 && x - image->x_offset < image->local_width);
+  assert(y - image->y_offset >= 0 && y - image->y_offset < image->local_height);
+  return image->data + (size_t)(y - image->y_offset) * image->stride +
+         (size_t)(x - image->x_offset) * image->pixel_size;
+}
+
+/**
+ * Set the color of a single pixel of an RGB24 or RGBA32 image.
+ *
+ * @param  image  Image data structure
+ * @param  x      X coordinate
+ * @param  y      Y coordinate
+ * @param  color  Color value
+ */
+static inline void imageSetPixel(image_t *image, int x, int y,
+                                 color_t color) {
+  unsigned char *pixel = imagePixel(image, x, y);
+
+  assert(image->format == PIXEL_RGB24 || image->format == PIXEL_RGBA32);
+  pixel[0] = color.red;
+  pixel[1] = color.green;
+  pixel[2] = color.blue;
+  if (image->format == PIXEL_RGBA32)
+    pixel[3] = 255;
+}
+
+/**
+ * Set the iteration count of a single pixel of an ITER16, ITER32 or
+ * SMOOTH32 image. @p smooth is the continuous count, which is only used
+ * (and only needs to be valid) for SMOOTH32 images.
+ *
+ * @param  image   Image data structure
+ * @param  x       X coordinate
+ * @param  y       Y coordinate
+ * @param  iter    Iteration count
+ * @param  smooth  Continuous iteration count
+ */
+static inline void imageSetIter(image_t *image, int x, int y, uint32_t iter,
+                                float smooth) {
+  unsigned char *pixel = imagePixel(image, x, y);
+
+  switch (image->format) {
+  case PIXEL_ITER16:
+    assert(iter <= UINT16_MAX);
+    *(uint16_t *)pixel = (uint16_t)iter;
+    break;
+  case PIXEL_ITER32:
+    *(uint32_t *)pixel = iter;
+    break;
+  default:
+    assert(image->format == PIXEL_SMOOTH32);
+    *(float *)pixel = smooth;
+    break;
+  }
+}
 
 #endif /* !_IMAGE_DISTRIBUTED_H */
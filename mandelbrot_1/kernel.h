@@ -0,0 +1,17 @@
+#ifndef _KERNEL_H
+#define _KERNEL_H
+
+#include "mandelbrot.h"
+
+/*--- Function prototypes --------------------------------------------------*/
+
+const char *kernelInit(void);
+void kernelCenter(mandel_t *data);
+const char *kernelPrecision(mandel_t *data);
+void kernelRow(const mandel_t *data, int y, int from, int to, int *iters,
+               float *smooth, mandel_stats_t *stats);
+void kernelColumns(const mandel_t *data, int y, const int *columns,
+                   int count, int *iters, float *smooth,
+                   mandel_stats_t *stats);
+
+#endif /* !_KERNEL_H */
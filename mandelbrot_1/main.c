@@ -1,31 +1,592 @@
+#include <getopt.h>
+#include <limits.h>
+#include <omp.h>
 #include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include <mpi.h>
 
 #include "image_distributed.h"
+#include "antialias.h"
+#include "kernel.h"
 #include "mandelbrot.h"
+#include "mp.h"
+#include "palette.h"
+#include "partition.h"
+#include "progressive.h"
+#include "report.h"
+#include "sequence.h"
+#include "server.h"
+#include "stream.h"
 
-/** Width of output image in pixels */
+/** Width of output image in pixels (default) */
 #define IMG_WIDTH 4096
 
-/** Height of output image in pixels */
+/** Height of output image in pixels (default) */
 #define IMG_HEIGHT 4096
 
 /** Maximum number of iterations to perform */
 #define MAX_ITER 5000
 
+/**
+ * Prints the command line usage of the program.
+ *
+ * @param  program  Name of the executable
+ */
+static void usage(const char *program) {
+  fprintf(stderr,
+          "Usage: %s [options]\n"
+          "  -s, --schedule=KIND[,CHUNK]\n"
+          "      OpenMP schedule: static, dynamic or guided (default: "
+          "OMP_SCHEDULE)\n"
+          "  -t, --threads=N\n"
+          "      OpenMP threads per process (default: OMP_NUM_THREADS)\n"
+          "  -e, --engine=ENGINE\n"
+          "      pixel (every pixel on its own, default), rect "
+          "(Mariani-Silver) or\n"
+          "      perturb (deltas to a high-precision orbit, for deep views)\n"
+          "  -m, --maxiter=N\n"
+          "      Maximum number of iterations (default: 5000)\n"
+          "  -x, --center-re=DECIMAL\n"
+          "  -y, --center-im=DECIMAL\n"
+          "      Center of the view, with as many digits as needed\n"
+          "  -w, --width=WIDTH\n"
+          "      Width of the view in the complex plane\n"
+          "  -d, --dist=DIST\n"
+          "      Rows per process: block (even numbers of rows, default) or\n"
+          "      cost (even costs, estimated from a preview at 1/16\n"
+          "      resolution)\n"
+          "  -R, --progressive\n"
+          "      Compute the image in passes of rising resolution, from 1/8\n"
+          "      up, and write each but the last as a preview, e.g.\n"
+          "      output-8.ppm (pixel engine only)\n"
+          "  -A, --antialias=N[,VARIANCE]\n"
+          "      Refine the pixels whose counts vary by more than VARIANCE\n"
+          "      (default: 1) around them with NxN jittered samples\n"
+          "  -g, --size=WIDTHxHEIGHT\n"
+          "      Size of the image in pixels (default: 4096x4096)\n"
+          "  -M, --memory=MB\n"
+          "      Memory for the pixels of each process; the image is then\n"
+          "      computed and written in bands that fit (default: no limit)\n"
+          "  -n, --frames=N\n"
+          "      Render a zoom sequence of N frames from the view to the one\n"
+          "      given with --zoom-to\n"
+          "  -Z, --zoom-to=[RE,IM,]WIDTH\n"
+          "      End view of the sequence (default: same center)\n"
+          "  -r, --fps=N\n"
+          "      Frame rate of a Y4M sequence (default: 25)\n"
+          "  -O, --output=NAME\n"
+          "      Output image (default: output.ppm), compressed if the name\n"
+          "      ends in .png or .qoi; for sequences a pattern like\n"
+          "      frame%%04d.ppm (default) or a Y4M file like zoom.y4m\n"
+          "  -P, --no-periodicity\n"
+          "      Iterate cyclic orbits up to the maximum number of iterations\n"
+          "  -f, --pixel-format=FORMAT\n"
+          "      Format of the image in memory: rgb24 (default) or rgba32\n"
+          "  -c, --count-format=FORMAT\n"
+          "      Format of the iteration counts: iter16, iter32 (default) or\n"
+          "      smooth (continuous counts)\n"
+          "  -o, --save-counts=FILE\n"
+          "      Also save the iteration counts, to be colored by colorize\n"
+          "  -p, --palette=NAME\n"
+          "      Colors of the iteration counts: hsv (default) or gray\n"
+          "  -j, --report=FILE\n"
+          "      Append the timings of the run to FILE as a line of JSON\n"
+          "      (see bench.sh)\n"
+          "  -S, --serve=SOCKET\n"
+          "      Serve images to clients on the Unix socket SOCKET, or on a\n"
+          "      TCP port of localhost given as :PORT (see server.c)\n"
+          "  -N, --node-io\n"
+          "      Keep the image of the processes of a node in shared memory\n"
+          "      and write it from one process per node\n"
+          "  -H, --hint=KEY=VALUE\n"
+          "      MPI-IO hint for writing the image, e.g. cb_nodes=4 or\n"
+          "      cb_buffer_size=16777216 (may be given several times)\n"
+          "  -h, --help\n"
+          "      Print this help\n",
+          program);
+}
+
+/**
+ * Sets the OpenMP runtime schedule from a string of the form KIND[,CHUNK].
+ *
+ * @param  arg  Schedule description, e.g. "dynamic,4"
+ *
+ * @return 0 on success, -1 if @p arg is not a valid schedule
+ */
+static int parseSchedule(const char *arg) {
+  const char *comma = strchr(arg, ',');
+  size_t length = comma ? (size_t)(comma - arg) : strlen(arg);
+  omp_sched_t kind;
+  int chunk = 0;
+
+  if (length == 6 && strncmp(arg, "static", length) == 0)
+    kind = omp_sched_static;
+  else if (length == 7 && strncmp(arg, "dynamic", length) == 0)
+    kind = omp_sched_dynamic;
+  else if (length == 6 && strncmp(arg, "guided", length) == 0)
+    kind = omp_sched_guided;
+  else
+    return -1;
+
+  if (comma) {
+    chunk = atoi(comma + 1);
+    if (chunk < 1)
+      return -1;
+  }
+
+  omp_set_schedule(kind, chunk);
+  return 0;
+}
+
+/**
+ * Parses the command line options. All processes parse the same arguments,
+ * so they all come to the same result; only rank 0 reports errors.
+ *
+ * @param  argc      Number of arguments
+ * @param  argv      Argument vector
+ * @param  rank      Rank of the calling process
+ * @param  data      Mandelbrot parameters to set from the options
+ * @param  info      MPI-IO hints to add the --hint options to
+ * @param  sequence  Zoom sequence to set from the options
+ *
+ * @return 0 to continue, 1 if the program should exit successfully, -1 on
+ *         invalid options
+ */
+static int parseOptions(int argc, char *argv[], int rank, mandel_t *data,
+                        MPI_Info info, sequence_t *sequence) {
+  static const struct option options[] = {
+      {"schedule", required_argument, NULL, 's'},
+      {"threads", required_argument, NULL, 't'},
+      {"engine", required_argument, NULL, 'e'},
+      {"maxiter", required_argument, NULL, 'm'},
+      {"center-re", required_argument, NULL, 'x'},
+      {"center-im", required_argument, NULL, 'y'},
+      {"width", required_argument, NULL, 'w'},
+      {"dist", required_argument, NULL, 'd'},
+      {"progressive", no_argument, NULL, 'R'},
+      {"antialias", required_argument, NULL, 'A'},
+      {"size", required_argument, NULL, 'g'},
+      {"memory", required_argument, NULL, 'M'},
+      {"frames", required_argument, NULL, 'n'},
+      {"zoom-to", required_argument, NULL, 'Z'},
+      {"fps", required_argument, NULL, 'r'},
+      {"output", required_argument, NULL, 'O'},
+      {"no-periodicity", no_argument, NULL, 'P'},
+      {"pixel-format", required_argument, NULL, 'f'},
+      {"count-format", required_argument, NULL, 'c'},
+      {"save-counts", required_argument, NULL, 'o'},
+      {"palette", required_argument, NULL, 'p'},
+      {"report", required_argument, NULL, 'j'},
+      {"serve", required_argument, NULL, 'S'},
+      {"node-io", no_argument, NULL, 'N'},
+      {"hint", required_argument, NULL, 'H'},
+      {"help", no_argument, NULL, 'h'},
+      {NULL, 0, NULL, 0}};
+  int opt;
+
+  opterr = (rank == 0);
+  while ((opt = getopt_long(argc, argv,
+                            "s:t:e:m:x:y:w:d:RA:g:M:n:Z:r:O:Pf:c:o:p:j:S:NH:h",
+                            options, NULL)) != -1) {
+    switch (opt) {
+    case 's':
+      if (parseSchedule(optarg) != 0) {
+        if (rank == 0)
+          fprintf(stderr, "Invalid schedule \"%s\"!\n", optarg);
+        return -1;
+      }
+      break;
+    case 't':
+      if (atoi(optarg) < 1) {
+        if (rank == 0)
+          fprintf(stderr, "Invalid number of threads \"%s\"!\n", optarg);
+        return -1;
+      }
+      omp_set_num_threads(atoi(optarg));
+      break;
+    case 'e':
+      if (strcmp(optarg, "pixel") == 0) {
+        data->engine = ENGINE_PIXEL;
+      } else if (strcmp(optarg, "rect") == 0) {
+        data->engine = ENGINE_RECT;
+      } else if (strcmp(optarg, "perturb") == 0) {
+        data->engine = ENGINE_PERTURB;
+      } else {
+        if (rank == 0)
+          fprintf(stderr, "Invalid engine \"%s\"!\n", optarg);
+        return -1;
+      }
+      break;
+    case 'm':
+      if (atoi(optarg) < 1) {
+        if (rank == 0)
+          fprintf(stderr, "Invalid number of iterations \"%s\"!\n", optarg);
+        return -1;
+      }
+      data->maxiter = atoi(optarg);
+      break;
+    case 'x':
+    case 'y': {
+      mp_t value;
+
+      if (mpFromString(&value, optarg, 2) != 0) {
+        if (rank == 0)
+          fprintf(stderr, "Invalid center \"%s\"!\n", optarg);
+        return -1;
+      }
+      if (opt == 'x')
+        data->center_real = optarg;
+      else
+        data->center_imag = optarg;
+      break;
+    }
+    case 'w':
+      data->width = atof(optarg);
+      if (data->width <= 0.0) {
+        if (rank == 0)
+          fprintf(stderr, "Invalid width \"%s\"!\n", optarg);
+        return -1;
+      }
+      break;
+    case 'd':
+      if (strcmp(optarg, "block") == 0) {
+        data->dist = DIST_BLOCK;
+      } else if (strcmp(optarg, "cost") == 0) {
+        data->dist = DIST_COST;
+      } else {
+        if (rank == 0)
+          fprintf(stderr, "Invalid distribution \"%s\"!\n", optarg);
+        return -1;
+      }
+      break;
+    case 'R':
+      data->progressive = 1;
+      break;
+    case 'A': {
+      char *comma;
+      char *end;
+
+      data->antialias = (int)strtol(optarg, &comma, 10);
+      end = comma;
+      if (comma != optarg && *comma == ',')
+        data->variance = strtod(comma + 1, &end);
+      if (*end != '\0' || end == comma + 1 || data->antialias < 2 ||
+          data->antialias > ANTIALIAS_MAX || data->variance < 0.0) {
+        if (rank == 0)
+          fprintf(stderr, "Invalid anti-aliasing \"%s\"!\n", optarg);
+        return -1;
+      }
+      break;
+    }
+    case 'g': {
+      char end;
+
+      if (sscanf(optarg, "%dx%d%c", &data->columns, &data->rows, &end) !=
+              2 ||
+          data->columns < 1 || data->rows < 1) {
+        if (rank == 0)
+          fprintf(stderr, "Invalid image size \"%s\"!\n", optarg);
+        return -1;
+      }
+      break;
+    }
+    case 'M':
+      if (atoll(optarg) < 1) {
+        if (rank == 0)
+          fprintf(stderr, "Invalid memory size \"%s\"!\n", optarg);
+        return -1;
+      }
+      data->memory = (size_t)atoll(optarg) << 20;
+      break;
+    case 'n':
+      if (atoi(optarg) < 2) {
+        if (rank == 0)
+          fprintf(stderr, "Invalid number of frames \"%s\"!\n", optarg);
+        return -1;
+      }
+      sequence->frames = atoi(optarg);
+      break;
+    case 'Z': {
+      int fields = sscanf(optarg, "%lf,%lf,%lf", &sequence->end_real,
+                          &sequence->end_imag, &sequence->end_width);
+
+      if (fields == 1) {
+        sequence->end_width = sequence->end_real;
+        sequence->end_center = 0;
+      } else if (fields == 3) {
+        sequence->end_center = 1;
+      }
+      if ((fields != 1 && fields != 3) || sequence->end_width <= 0.0) {
+        if (rank == 0)
+          fprintf(stderr, "Invalid end view \"%s\"!\n", optarg);
+        return -1;
+      }
+      break;
+    }
+    case 'r':
+      if (atoi(optarg) < 1) {
+        if (rank == 0)
+          fprintf(stderr, "Invalid frame rate \"%s\"!\n", optarg);
+        return -1;
+      }
+      sequence->fps = atoi(optarg);
+      break;
+    case 'O':
+      data->output = optarg;
+      break;
+    case 'P':
+      data->periodicity = 0;
+      break;
+    case 'f':
+      if (strcmp(optarg, "rgb24") == 0) {
+        data->format = PIXEL_RGB24;
+      } else if (strcmp(optarg, "rgba32") == 0) {
+        data->format = PIXEL_RGBA32;
+      } else {
+        if (rank == 0)
+          fprintf(stderr, "Invalid pixel format \"%s\"!\n", optarg);
+        return -1;
+      }
+      break;
+    case 'c':
+      if (strcmp(optarg, "iter16") == 0) {
+        data->count_format = PIXEL_ITER16;
+      } else if (strcmp(optarg, "iter32") == 0) {
+        data->count_format = PIXEL_ITER32;
+      } else if (strcmp(optarg, "smooth") == 0) {
+        data->count_format = PIXEL_SMOOTH32;
+      } else {
+        if (rank == 0)
+          fprintf(stderr, "Invalid count format \"%s\"!\n", optarg);
+        return -1;
+      }
+      break;
+    case 'o':
+      data->counts_file = optarg;
+      break;
+    case 'j':
+      data->report = optarg;
+      break;
+    case 'S':
+      data->serve = optarg;
+      break;
+    case 'p':
+      if (paletteParse(optarg, &data->palette) != 0) {
+        if (rank == 0)
+          fprintf(stderr, "Invalid palette \"%s\"!\n", optarg);
+        return -1;
+      }
+      break;
+    case 'N':
+      data->node_io = 1;
+      break;
+    case 'H': {
+      char *value = strchr(optarg, '=');
+
+      if (value == NULL || value == optarg || value[1] == '\0') {
+        if (rank == 0)
+          fprintf(stderr, "Invalid hint \"%s\"!\n", optarg);
+        return -1;
+      }
+      *value = '\0';
+      MPI_Info_set(info, optarg, value + 1);
+      *value = '=';
+      break;
+    }
+    case 'h':
+      if (rank == 0)
+        usage(argv[0]);
+      return 1;
+    default:
+      if (rank == 0)
+        usage(argv[0]);
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
 /**
  * Main program.
  */
-int main() {
-  MPI_Init(NULL, NULL);
+int main(int argc, char *argv[]) {
+  // only the main thread of each process calls MPI
+  int provided;
+  MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &provided);
 
   int rank, numprocs;
   MPI_Comm_rank(MPI_COMM_WORLD, &rank);
   MPI_Comm_size(MPI_COMM_WORLD, &numprocs);
 
+  if (provided < MPI_THREAD_FUNNELED && rank == 0) {
+    fprintf(stderr, "Warning: MPI library does not support threads\n");
+  }
+
+  /* Allocate mandelbrot data structure */
+  mandel_t *data = (mandel_t *)malloc(sizeof(mandel_t));
+  if (!data) {
+    fprintf(stderr, "Memory allocation error!\n");
+    return EXIT_FAILURE;
+  }
+
+  /* Defaults of the options */
+  data->periodicity = 1;
+  data->engine = ENGINE_PIXEL;
+  data->maxiter = MAX_ITER;
+  data->center_real = NULL;
+  data->center_imag = NULL;
+  data->width = 0.0;
+  data->dist = DIST_BLOCK;
+  data->progressive = 0;
+  data->antialias = 0;
+  data->variance = ANTIALIAS_VARIANCE;
+  data->columns = IMG_WIDTH;
+  data->rows = IMG_HEIGHT;
+  data->memory = 0;
+  data->format = PIXEL_RGB24;
+  data->count_format = PIXEL_ITER32;
+  data->palette = PALETTE_HSV;
+  data->counts_file = NULL;
+  data->output = NULL;
+  data->report = NULL;
+  data->serve = NULL;
+  data->node_io = 0;
+  data->reuse = NULL;
+
+  sequence_t sequence;
+  sequence.frames = 0;
+  sequence.end_center = 0;
+  sequence.end_width = 0.0;
+  sequence.fps = 25;
+
+  MPI_Info info;
+  MPI_Info_create(&info);
+
+  int status = parseOptions(argc, argv, rank, data, info, &sequence);
+  if (status != 0) {
+    MPI_Info_free(&info);
+    free(data);
+    MPI_Finalize();
+    return status > 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+  if (data->count_format == PIXEL_ITER16 && data->maxiter > UINT16_MAX) {
+    if (rank == 0)
+      fprintf(stderr, "Too many iterations for 16 bit counts!\n");
+    MPI_Info_free(&info);
+    free(data);
+    MPI_Finalize();
+    return EXIT_FAILURE;
+  }
+  if (!data->output)
+    data->output = sequence.frames ? "frame%04d.ppm" : "output.ppm";
+  if (sequence.frames &&
+      (sequence.end_width <= 0.0 || sequenceCheckOutput(data->output) != 0 ||
+       data->counts_file || data->memory || data->report)) {
+    if (rank == 0)
+      fprintf(stderr, "A sequence needs --zoom-to and a frame pattern or "
+                      "Y4M file as output, and cannot save counts, be "
+                      "limited in memory or be reported!\n");
+    MPI_Info_free(&info);
+    free(data);
+    MPI_Finalize();
+    return EXIT_FAILURE;
+  }
+
+  if (data->dist == DIST_COST &&
+      (sequence.frames || data->engine == ENGINE_PERTURB)) {
+    if (rank == 0)
+      fprintf(stderr, "Partitioning by cost needs a single image and the "
+                      "pixel or rect engine!\n");
+    MPI_Info_free(&info);
+    free(data);
+    MPI_Finalize();
+    return EXIT_FAILURE;
+  }
+  if (data->progressive && (data->engine != ENGINE_PIXEL || sequence.frames ||
+                            data->memory || data->serve)) {
+    if (rank == 0)
+      fprintf(stderr, "Progressive rendering needs the pixel engine and a "
+                      "single image that is not limited in memory!\n");
+    MPI_Info_free(&info);
+    free(data);
+    MPI_Finalize();
+    return EXIT_FAILURE;
+  }
+  if (data->antialias &&
+      (data->engine == ENGINE_PERTURB || sequence.frames || data->memory ||
+       data->serve)) {
+    if (rank == 0)
+      fprintf(stderr, "Anti-aliasing needs the pixel or rect engine and a "
+                      "single image that is not limited in memory!\n");
+    MPI_Info_free(&info);
+    free(data);
+    MPI_Finalize();
+    return EXIT_FAILURE;
+  }
+  // the samples are pixels of a larger image, see antialias.c
+  if (data->antialias &&
+      ((long long)data->columns * data->antialias * ANTIALIAS_JITTER >
+           INT_MAX ||
+       (long long)data->rows * data->antialias * ANTIALIAS_JITTER > INT_MAX)) {
+    if (rank == 0)
+      fprintf(stderr, "Image too large for anti-aliasing!\n");
+    MPI_Info_free(&info);
+    free(data);
+    MPI_Finalize();
+    return EXIT_FAILURE;
+  }
+  if (data->node_io && (sequence.frames || data->memory || data->serve)) {
+    if (rank == 0)
+      fprintf(stderr, "Node I/O needs a single image that is not limited "
+                      "in memory!\n");
+    MPI_Info_free(&info);
+    free(data);
+    MPI_Finalize();
+    return EXIT_FAILURE;
+  }
+  if (data->report && data->memory) {
+    if (rank == 0)
+      fprintf(stderr, "Images computed in bands cannot be reported!\n");
+    MPI_Info_free(&info);
+    free(data);
+    MPI_Finalize();
+    return EXIT_FAILURE;
+  }
+
+  if (data->serve &&
+      (sequence.frames || data->memory || data->counts_file ||
+       data->report || data->dist == DIST_COST ||
+       data->engine == ENGINE_PERTURB)) {
+    if (rank == 0)
+      fprintf(stderr, "The server needs the pixel or rect engine, and "
+                      "cannot render sequences, be limited in memory, "
+                      "partition by cost, save counts or be reported!\n");
+    MPI_Info_free(&info);
+    free(data);
+    MPI_Finalize();
+    return EXIT_FAILURE;
+  }
+
+  /* Select the escape-time kernel for this CPU */
+  const char *kernel = kernelInit();
+  if (rank == 0) {
+    printf("Escape-time kernel: %s\n", kernel);
+    printf("OpenMP threads per process: %d\n", omp_get_max_threads());
+  }
+
+  if (data->serve) {
+    status = serverRun(data);
+    free(data);
+    MPI_Info_free(&info);
+
+    MPI_Finalize();
+    return status == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+
   /* Parameters */
 
   // teil der komplexen ebene, der betrachtet werden soll:  (globale werte)
@@ -34,52 +595,168 @@ int main() {
   double xmax = -1.172643;
   double ymax = -0.296321;
 
-  // use a row wise distribution of the img among processes
+  // a given center (and width) replaces the section above, keeping the
+  // aspect ratio of the image
+  if (data->center_real || data->center_imag || data->width > 0.0) {
+    double width = data->width > 0.0 ? data->width : xmax - xmin;
+    double height = width * data->rows / data->columns;
+    double center_real = data->center_real ? atof(data->center_real)
+                                           : (xmin + xmax) / 2;
+    double center_imag = data->center_imag ? atof(data->center_imag)
+                                           : (ymin + ymax) / 2;
 
-  int own_height = IMG_HEIGHT / numprocs;
-  int offset = own_height * rank;
-  if (rank == numprocs - 1) {
-    own_height = IMG_HEIGHT - offset;
-    // assign him all the remaining lines
+    xmin = center_real - width / 2;
+    xmax = center_real + width / 2;
+    ymin = center_imag - height / 2;
+    ymax = center_imag + height / 2;
   }
-  // printf for debug:
-  // printf("rank %d: %d lines starting with %d\n", rank, own_height, offset);
 
-  /* Create image data structure */
-  image_t *image =
-      imageCreate(IMG_WIDTH, IMG_HEIGHT, IMG_WIDTH, own_height, 0, offset);
-  if (!image) {
+  /* Initialize data */
+  data->xmin = xmin;
+  data->ymin = ymin;
+  data->xmax = xmax;
+  data->ymax = ymax;
+  kernelCenter(data);
+
+  /* Select the arithmetic for the depth of the view */
+  // (sequences select it per frame)
+  report_t report;
+  report.kernel = kernel;
+  report.precision = NULL;
+  if (!sequence.frames && data->engine != ENGINE_PERTURB) {
+    report.precision = kernelPrecision(data);
+    if (rank == 0)
+      printf("Precision: %s\n", report.precision);
+  }
+
+  // use a row wise distribution of the img among processes, with even
+  // numbers of rows or even costs estimated from a preview
+  int *bounds = (int *)malloc((numprocs + 1) * sizeof(int));
+  if (!bounds) {
     fprintf(stderr, "Memory allocation error!\n");
     return EXIT_FAILURE;
   }
+  if (data->dist == DIST_COST)
+    partitionCost(data, numprocs, bounds);
+  else
+    partitionBlock(data->rows, numprocs, bounds);
+  // with node I/O, the processes of a node share their image, so they get
+  // consecutive blocks
+  MPI_Comm node = MPI_COMM_NULL;
+  MPI_Comm leaders = MPI_COMM_NULL;
+  int slot = rank;
+  if (data->node_io) {
+    int local;
+    int nodes;
 
-  /* Allocate mandelbrot data structure */
-  mandel_t *data = (mandel_t *)malloc(sizeof(mandel_t));
-  if (!data) {
+    MPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, rank,
+                        MPI_INFO_NULL, &node);
+    MPI_Comm_rank(node, &local);
+    MPI_Comm_split(MPI_COMM_WORLD, local == 0 ? 0 : MPI_UNDEFINED, rank,
+                   &leaders);
+    slot = partitionSlot(node, leaders);
+    if (rank == 0) {
+      MPI_Comm_size(leaders, &nodes);
+      printf("Nodes writing the image: %d\n", nodes);
+    }
+  }
+  int offset = bounds[slot];
+  int own_height = bounds[slot + 1] - offset;
+  free(bounds);
+  // printf for debug:
+  // printf("rank %d: %d lines starting with %d\n", rank, own_height, offset);
+
+  /* Create image data structures: iteration counts and colors */
+  // when streaming, only bands of them are created (see streamRender())
+  image_t *counts = NULL;
+  image_t *image = NULL;
+  if (!data->memory) {
+    counts = imageCreate(data->columns, data->rows, data->columns,
+                         own_height, 0, offset, data->count_format);
+    if (data->node_io)
+      image = imageCreateShared(data->columns, data->rows, own_height, offset,
+                                data->format, node);
+    else
+      image = imageCreate(data->columns, data->rows, data->columns,
+                          own_height, 0, offset, data->format);
+  }
+  palette_t *palette = paletteCreate(data->palette, data->maxiter);
+  if ((!data->memory && (!counts || !image)) || !palette) {
     fprintf(stderr, "Memory allocation error!\n");
     return EXIT_FAILURE;
   }
 
-  /* Initialize data */
-  data->xmin = xmin;
-  data->ymin = ymin;
-  data->xmax = xmax;
-  data->ymax = ymax;
-  data->maxiter = MAX_ITER;
-  data->columns = IMG_WIDTH;
-  data->rows = IMG_HEIGHT;
   data->from = offset;
   data->to = offset + own_height;
-  data->image = image;
+  data->image = counts;
 
-  mandelbrot(data);
+  if (sequence.frames) {
+    sequenceRender(data, &sequence, palette, image, info);
+    free(data);
+    paletteFree(palette);
+    imageFree(counts);
+    imageFree(image);
+    MPI_Info_free(&info);
 
-  free(data);
+    MPI_Finalize();
+    return EXIT_SUCCESS;
+  }
+
+  if (data->memory) {
+    status = streamRender(data, palette, info);
+    free(data);
+    paletteFree(palette);
+    MPI_Info_free(&info);
+
+    MPI_Finalize();
+    return status == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+
+  // all processes start the clock of the report together
+  MPI_Barrier(MPI_COMM_WORLD);
+  double run_time = MPI_Wtime();
+  if (data->progressive)
+    progressiveRender(data, palette, info);
+  else
+    mandelbrot(data);
+  report.compute = MPI_Wtime() - run_time;
+  statsReport(&data->stats);
+
+  /* Coloring pass */
+  double start_time = MPI_Wtime();
+  paletteApply(palette, counts, image);
+  printf("Coloring time: %2.6f seconds\n", MPI_Wtime() - start_time);
+  report.compute += MPI_Wtime() - start_time;
+
+  /* Anti-aliasing pass */
+  if (data->antialias) {
+    start_time = MPI_Wtime();
+    antialiasRender(data, palette, image);
+    report.compute += MPI_Wtime() - start_time;
+  }
 
   /* Save the output image & free resources */
-  imageSave(image, "output.ppm");
+  start_time = MPI_Wtime();
+  if (data->node_io)
+    imageSaveShared(image, data->output, info, node, leaders);
+  else
+    imageSave(image, data->output, info);
+  if (data->counts_file)
+    imageSaveCounts(counts, data->counts_file, data->maxiter, info);
+  report.io = MPI_Wtime() - start_time;
+  report.total = MPI_Wtime() - run_time;
+  if (data->report)
+    status = reportWrite(data->report, data, &report);
+  free(data);
+  paletteFree(palette);
+  imageFree(counts);
   imageFree(image);
+  MPI_Info_free(&info);
+  if (node != MPI_COMM_NULL)
+    MPI_Comm_free(&node);
+  if (leaders != MPI_COMM_NULL)
+    MPI_Comm_free(&leaders);
 
   MPI_Finalize();
-  return EXIT_SUCCESS;
+  return status == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
 }
@@ -1,12 +1,198 @@
-#include <math.h>
+#include <omp.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
+#include <mpi.h>
+
+#include "engine.h"
+#include "kernel.h"
 #include "mandelbrot.h"
+#include "perturb.h"
 #include "utility.h"
 
+/** Edge length of the square tiles the threads work on */
+#define TILE_SIZE 64
+
 /*--- Implementation -------------------------------------------------------*/
 
+/**
+ * Returns non-zero if the tile [x0, x1) x [y0, y1) contains pixels of the
+ * previous frame.
+ */
+static int tileReuses(const mandel_t *data, int x0, int y0, int x1, int y1) {
+  int x;
+  int y;
+
+  for (y = y0; y < y1; ++y)
+    if (data->reuse->row[y - data->from] != -1)
+      break;
+  if (y == y1)
+    return 0;
+  for (x = x0; x < x1; ++x)
+    if (data->reuse->column[x] != -1)
+      return 1;
+  return 0;
+}
+
+/**
+ * Calculates the tile [x0, x1) x [y0, y1) of at most TILE_SIZE columns,
+ * taking the pixels that land on the sample grid of the previous frame from
+ * there (see reuse_t). The other pixels of each row are gathered and
+ * computed together by the escape-time kernels.
+ *
+ * @param  data    Mandelbrot parameters
+ * @param  iters   Iteration counts of a row, at least x1 - x0
+ * @param  smooth  Continuous counts of a row, or NULL if not needed
+ * @param  stats   Statistics to add the work to
+ */
+static void reuseTile(mandel_t *data, int x0, int y0, int x1, int y1,
+                      int *iters, float *smooth, mandel_stats_t *stats) {
+  const reuse_t *reuse = data->reuse;
+  int pixel_size = data->image->pixel_size;
+  int columns[TILE_SIZE];
+  int count;
+  int i;
+  int x;
+  int y;
+
+  for (y = y0; y < y1; ++y) {
+    int row = reuse->row[y - data->from];
+
+    count = 0;
+    for (x = x0; x < x1; ++x) {
+      if (row != -1 && reuse->column[x] != -1) {
+        memcpy(imagePixel(data->image, x, y),
+               imagePixel(reuse->counts, reuse->column[x], row), pixel_size);
+        stats->reused++;
+      } else {
+        columns[count++] = x;
+      }
+    }
+
+    kernelColumns(data, y, columns, count, iters, smooth, stats);
+    for (i = 0; i < count; ++i)
+      imageSetIter(data->image, columns[i], y, iters[i],
+                   smooth ? smooth[i] : 0.0f);
+  }
+}
+
+/**
+ * Calculates the rows from data->from to data->to. They are cut into tiles
+ * of TILE_SIZE x TILE_SIZE pixels, which are shared among the OpenMP
+ * threads of the calling process; all threads write to the same image. The
+ * loop uses the runtime schedule (see omp_set_schedule() and OMP_SCHEDULE).
+ * Each tile is computed by the engine selected in data->engine.
+ *
+ * @param  data  Mandelbrot parameters
+ */
+static void mandelbrotTiles(mandel_t *data) {
+  int tile;
+  int tiles_x;
+  int tiles_y;
+  int *iters;
+  float *smooth = NULL;
+
+  /* Iteration counts of the current tile, one buffer per thread */
+  iters = (int *)malloc(omp_get_max_threads() * TILE_SIZE * TILE_SIZE *
+                        sizeof(int));
+  if (!iters) {
+    fprintf(stderr, "Memory allocation error!\n");
+    return;
+  }
+  if (data->image->format == PIXEL_SMOOTH32) {
+    smooth = (float *)malloc(omp_get_max_threads() * TILE_SIZE * TILE_SIZE *
+                             sizeof(float));
+    if (!smooth) {
+      fprintf(stderr, "Memory allocation error!\n");
+      free(iters);
+      return;
+    }
+  }
+
+  /* Iterate over all tiles */
+  // meaning iterate over space for this process only, the tiles are shared
+  // among the threads of this process according to the runtime schedule
+  tiles_x = (data->columns + TILE_SIZE - 1) / TILE_SIZE;
+  tiles_y = (data->to - data->from + TILE_SIZE - 1) / TILE_SIZE;
+
+#pragma omp parallel
+  {
+    mandel_stats_t stats = {0, 0, 0, 0, 0, 0, 0};
+
+#pragma omp for schedule(runtime)
+    for (tile = 0; tile < tiles_x * tiles_y; ++tile) {
+      int x;
+      int y;
+      int x0 = (tile % tiles_x) * TILE_SIZE;
+      int y0 = data->from + (tile / tiles_x) * TILE_SIZE;
+      int x1 = x0 + TILE_SIZE < data->columns ? x0 + TILE_SIZE : data->columns;
+      int y1 = y0 + TILE_SIZE < data->to ? y0 + TILE_SIZE : data->to;
+      int offset = omp_get_thread_num() * TILE_SIZE * TILE_SIZE;
+      int *tile_iters = iters + offset;
+      float *tile_smooth = smooth ? smooth + offset : NULL;
+
+      if (data->reuse && tileReuses(data, x0, y0, x1, y1)) {
+        reuseTile(data, x0, y0, x1, y1, tile_iters, tile_smooth, &stats);
+        continue;
+      }
+
+      // The actual calculation
+      engineRect(data, x0, y0, x1, y1, tile_iters, tile_smooth, TILE_SIZE,
+                 &stats);
+
+      /* Iterate over all pixels of the tile */
+      for (y = y0; y < y1; ++y) {
+        for (x = x0; x < x1; ++x) {
+          int i = (y - y0) * TILE_SIZE + (x - x0);
+
+          imageSetIter(data->image, x, y, tile_iters[i],
+                       tile_smooth ? tile_smooth[i] : 0.0f);
+        }
+      }
+    }
+
+    /* Merge the statistics of all threads */
+#pragma omp atomic
+    data->stats.pixels += stats.pixels;
+#pragma omp atomic
+    data->stats.iterations += stats.iterations;
+#pragma omp atomic
+    data->stats.interior += stats.interior;
+#pragma omp atomic
+    data->stats.periodic += stats.periodic;
+#pragma omp atomic
+    data->stats.filled += stats.filled;
+#pragma omp atomic
+    data->stats.reused += stats.reused;
+  }
+
+  free(iters);
+  free(smooth);
+}
+
+/**
+ * Calculates the iteration counts of the rows data->from to data->to into
+ * data->image, like mandelbrot() but without printing anything. The
+ * statistics in data->stats are reset first.
+ *
+ * @param  data  Mandelbrot parameters
+ */
+void mandelbrotFrame(mandel_t *data) {
+  data->stats.pixels = 0;
+  data->stats.iterations = 0;
+  data->stats.interior = 0;
+  data->stats.periodic = 0;
+  data->stats.filled = 0;
+  data->stats.glitched = 0;
+  data->stats.reused = 0;
+
+  if (data->engine == ENGINE_PERTURB)
+    perturbRender(data);
+  else
+    mandelbrotTiles(data);
+}
+
 /**
  * Calculates an image of the mandelbrot set for the parameters given in
  * @p data (see description of mandel_t for details). This function takes
@@ -14,67 +200,24 @@
  * finishing the calculation. Also, this function prints the wall-clock
  * time required to do the calculations.
  *
+ * The rows from data->from to data->to are computed in tiles (see
+ * mandelbrotTiles()), or by the perturbation engine for deep views (see
+ * perturbRender()). The image only receives the iteration counts (in its
+ * ITER16, ITER32 or SMOOTH32 format); coloring is a separate pass (see
+ * paletteApply()).
+ *
  * @param  data  Mandelbrot parameters
  *
  * @return Always NULL
  */
 void *mandelbrot(mandel_t *data) {
-  int x;
-  int y;
-  double dx;
-  double dy;
   double start_time;
   double end_time;
 
   /* Time measurement */
   start_time = get_wtime();
 
-  /* Initialization */
-  dx = (data->xmax - data->xmin) / data->columns;
-  dy = (data->ymax - data->ymin) / data->rows;
-
-  /* Iterate over all rows */
-  // meaning iterate over space for this process only
-  for (y = data->from; y < data->to; ++y) {
-    double c_imag = data->ymin + (y * dy);
-
-    /* Iterate over all columns */
-    for (x = 0; x < data->columns; ++x) {
-      color_t color;
-      double c_real = data->xmin + (x * dx);
-      int iter = 0;
-      double z_real = 0.0;
-      double z_imag = 0.0;
-      double z_norm = 0.0;
-
-      /* Check whether recursive Mandelbrot equation remains bounded */
-      // The actual calculation
-      while (z_norm < 4.0 && iter < data->maxiter) {
-        double z2_real = (z_real * z_real) - (z_imag * z_imag);
-        double z2_imag = (z_real * z_imag) + (z_imag * z_real);
-
-        z_real = z2_real + c_real;
-        z_imag = z2_imag + c_imag;
-        z_norm = (z_real * z_real) + (z_imag * z_imag);
-
-        ++iter;
-      }
-
-      /* Bounded => black */
-      if (iter == data->maxiter) {
-        color.red = 0;
-        color.green = 0;
-        color.blue = 0;
-        color.pad = 0;
-      }
-      /* Unbounded => compute nice color */
-      else {
-        color = HSVtoRGB(sqrt((double)iter / data->maxiter), 0.8, 0.8);
-      }
-
-      imageSetPixel(data->image, x, y, color);
-    }
-  }
+  mandelbrotFrame(data);
 
   /* Time measurement */
   end_time = get_wtime();
@@ -82,3 +225,58 @@ void *mandelbrot(mandel_t *data) {
 
   return NULL;
 }
+
+/**
+ * Adds the statistics @p stats of one calculation to @p total.
+ */
+void statsAdd(mandel_stats_t *total, const mandel_stats_t *stats) {
+  total->pixels += stats->pixels;
+  total->iterations += stats->iterations;
+  total->interior += stats->interior;
+  total->periodic += stats->periodic;
+  total->filled += stats->filled;
+  total->glitched += stats->glitched;
+  total->reused += stats->reused;
+}
+
+/**
+ * Sums up the statistics of all processes and prints them on rank 0.
+ * Has to be called by all processes.
+ *
+ * @param  stats  Statistics of the calling process
+ */
+void statsReport(const mandel_stats_t *stats) {
+  long long local[7];
+  long long total[7];
+  int rank;
+
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+  local[0] = stats->pixels;
+  local[1] = stats->iterations;
+  local[2] = stats->interior;
+  local[3] = stats->periodic;
+  local[4] = stats->filled;
+  local[5] = stats->glitched;
+  local[6] = stats->reused;
+  MPI_Reduce(local, total, 7, MPI_LONG_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+
+  if (rank == 0) {
+    printf("Pixels computed: %lld, iterations: %lld (%.1f per pixel)\n",
+           total[0], total[1], total[0] ? (double)total[1] / total[0] : 0.0);
+    if (total[4] > 0) {
+      printf("Pixels filled by rectangle subdivision: %lld\n", total[4]);
+    }
+    if (total[6] > 0) {
+      printf("Pixels reused from previous frames: %lld\n", total[6]);
+    }
+    if (total[5] > 0) {
+      printf("Glitched pixels recomputed with other references: %lld\n",
+             total[5]);
+    }
+    printf("Cardioid/bulb interior pixels skipped: %lld (%.1f%%)\n", total[2],
+           total[0] ? 100.0 * total[2] / total[0] : 0.0);
+    printf("Periodic orbits stopped early: %lld (%.1f%%)\n", total[3],
+           total[0] ? 100.0 * total[3] / total[0] : 0.0);
+  }
+}
@@ -2,9 +2,60 @@
 #define _MANDELBROT_H
 
 #include "image_distributed.h"
+#include "palette.h"
 
 /*--- Type definitions -----------------------------------------------------*/
 
+/**
+ * Engines computing the iteration counts of a region of the image.
+ */
+typedef enum {
+  ENGINE_PIXEL,  /**< Every pixel on its own */
+  ENGINE_RECT,   /**< Mariani-Silver rectangle subdivision */
+  ENGINE_PERTURB /**< Perturbation of a high-precision reference orbit */
+} engine_t;
+
+/**
+ * Arithmetic the escape-time kernels iterate in.
+ */
+typedef enum {
+  PRECISION_FLOAT,  /**< Single precision, for overviews */
+  PRECISION_DOUBLE, /**< Double precision */
+  PRECISION_DD      /**< Double-double, about 106 bits of mantissa */
+} precision_t;
+
+/**
+ * Ways of distributing the rows of the image among the processes.
+ */
+typedef enum {
+  DIST_BLOCK, /**< Blocks of even numbers of rows */
+  DIST_COST   /**< Blocks of even costs, estimated from a preview */
+} dist_t;
+
+/**
+ * Statistics of the calculation, used to report the work done per run.
+ */
+typedef struct {
+  long long pixels;     /**< Number of pixels computed */
+  long long iterations; /**< Number of iterations performed */
+  long long interior;   /**< Pixels found inside the cardioid or bulb */
+  long long periodic;   /**< Pixels stopped early by the periodicity check */
+  long long filled;     /**< Pixels filled in by rectangle subdivision */
+  long long glitched;   /**< Pixels recomputed with another reference */
+  long long reused;     /**< Pixels taken from the previous frame */
+} mandel_stats_t;
+
+/**
+ * Pixels of the previous frame of a zoom sequence that land on the sample
+ * grid of the current one (see sequence.c). A pixel (x, y) is taken from
+ * (column[x], row[y - from]) of the previous frame if both are not -1.
+ */
+typedef struct {
+  const image_t *counts; /**< Iteration counts of the previous frame */
+  const int *column;     /**< Column in the previous frame, per column */
+  const int *row;        /**< Row in the previous frame, per local row */
+} reuse_t;
+
 /**
  * This structure is used to pass the set of required parameters to the
  * mandelbrot() call.
@@ -16,21 +67,57 @@ typedef struct {
   double xmax; /**< Upper bound in complex plane (real part) */
   double ymax; /**< Upper bound in complex plane (imag. part) */
   int maxiter; /**< Maximum number of iterations */
+  int periodicity; /**< Non-zero to stop iterating cyclic orbits early */
+  engine_t engine; /**< Engine to compute the pixels with */
+  precision_t precision; /**< Arithmetic of the escape-time kernels */
+  int progressive; /**< Non-zero to compute in passes of rising resolution */
+  int antialias;   /**< Samples per side of refined pixels, 0 for none */
+  double variance; /**< Count variance above which pixels are refined */
+
+  /* Input: deep views, for the perturbation engine */
+  const char *center_real; /**< Center (decimal), NULL for the middle */
+  const char *center_imag; /**< Center (decimal), NULL for the middle */
+  double width;            /**< Width of the view, xmax - xmin if <= 0 */
+  double view_real;        /**< Center (real part), see kernelCenter() */
+  double view_real_lo;     /**< Low part of view_real, for double-double */
+  double view_imag;        /**< Center (imag. part), see kernelCenter() */
+  double view_imag_lo;     /**< Low part of view_imag, for double-double */
 
   /* Input: image size & offsets */
   int columns; /**< Number of pixels to draw in x direction */
   int rows;    /**< Number of pixels to draw in y direction */
+  pixel_format_t format;       /**< Format of the colored image */
+  pixel_format_t count_format; /**< Format of the iteration counts */
+  size_t memory;               /**< Bytes for pixels, 0 for no limit */
+  dist_t dist;                 /**< How the rows are distributed */
+
+  /* Input: zoom sequences */
+  const reuse_t *reuse; /**< Pixels to take from the previous frame, or NULL */
+
+  /* Input: output */
+  palette_kind_t palette;  /**< Colors of the iteration counts */
+  const char *counts_file; /**< File to save the counts to, or NULL */
+  const char *output;      /**< Name of the image, or pattern of frames */
+  const char *report;      /**< File to append the timings to, or NULL */
+  const char *serve;       /**< Socket to serve images on, or NULL */
+  int node_io; /**< Non-zero to share the image and write it per node */
 
   // assigned to this process:
   int from; // inclusive
   int to;   // exclusive
 
   /* Output: image */
-  image_t *image; /**< Pointer to image data structure */
+  image_t *image; /**< Iteration counts (ITER16, ITER32 or SMOOTH32) */
+
+  /* Output: statistics */
+  mandel_stats_t stats; /**< Work done by this process */
 } mandel_t;
 
 /*--- Function prototypes --------------------------------------------------*/
 
 void *mandelbrot(mandel_t *data);
+void mandelbrotFrame(mandel_t *data);
+void statsAdd(mandel_stats_t *total, const mandel_stats_t *stats);
+void statsReport(const mandel_stats_t *stats);
 
 #endif /* !_MANDELBROT_H */
@@ -0,0 +1,178 @@
+#include <ctype.h>
+#include <math.h>
+
+#include "mp.h"
+
+/*--- Implementation -------------------------------------------------------*/
+
+/**
+ * Returns non-zero if @p a is negative.
+ */
+static inline int mpNegative(const mp_t *a) { return (a->limb[0] >> 31) != 0; }
+
+/**
+ * Negates @p a in place.
+ */
+static void mpNegate(mp_t *a, int n) {
+  uint64_t carry = 1;
+  int i;
+
+  for (i = n - 1; i >= 0; --i) {
+    carry += (uint32_t)~a->limb[i];
+    a->limb[i] = (uint32_t)carry;
+    carry >>= 32;
+  }
+}
+
+/**
+ * Sets @p r to @p value. Doubles have 53 bits, so three limbs are exact.
+ */
+void mpFromDouble(mp_t *r, double value, int n) {
+  double magnitude = fabs(value);
+  double whole = floor(magnitude);
+  int i;
+
+  r->limb[0] = (uint32_t)whole;
+  magnitude -= whole;
+  for (i = 1; i < n; ++i) {
+    magnitude *= 4294967296.0;
+    whole = floor(magnitude);
+    r->limb[i] = (uint32_t)whole;
+    magnitude -= whole;
+  }
+  if (value < 0.0)
+    mpNegate(r, n);
+}
+
+/**
+ * Sets @p r to the decimal number in @p text, e.g. "-1.7499999999999999".
+ *
+ * @return 0 on success, -1 if @p text is not a decimal number
+ */
+int mpFromString(mp_t *r, const char *text, int n) {
+  const char *digits;
+  const char *end;
+  uint32_t whole = 0;
+  int negative = 0;
+  int i;
+
+  if (*text == '-' || *text == '+')
+    negative = *text++ == '-';
+  if (!isdigit((unsigned char)*text) && *text != '.')
+    return -1;
+
+  /* Integer part */
+  for (; isdigit((unsigned char)*text); ++text) {
+    whole = whole * 10 + (*text - '0');
+    if (whole >= 0x80000000u)
+      return -1;
+  }
+
+  /* Fraction: divide by 10 from the last digit to the first one */
+  for (i = 0; i < n; ++i)
+    r->limb[i] = 0;
+  if (*text == '.') {
+    digits = ++text;
+    while (isdigit((unsigned char)*text))
+      ++text;
+    for (end = text; end > digits; --end) {
+      uint64_t remainder;
+
+      r->limb[0] = end[-1] - '0';
+      remainder = 0;
+      for (i = 0; i < n; ++i) {
+        uint64_t value = (remainder << 32) | r->limb[i];
+
+        r->limb[i] = (uint32_t)(value / 10);
+        remainder = value % 10;
+      }
+    }
+  }
+  if (*text != '\0')
+    return -1;
+
+  r->limb[0] = whole;
+  if (negative)
+    mpNegate(r, n);
+  return 0;
+}
+
+/**
+ * Returns @p a rounded to double precision.
+ */
+double mpToDouble(const mp_t *a, int n) {
+  mp_t magnitude = *a;
+  double value = 0.0;
+  int i;
+
+  if (mpNegative(a))
+    mpNegate(&magnitude, n);
+  for (i = n - 1; i >= 0; --i)
+    value = value / 4294967296.0 + magnitude.limb[i];
+
+  return mpNegative(a) ? -value : value;
+}
+
+/**
+ * Sets @p r to @p a + @p b.
+ */
+void mpAdd(mp_t *r, const mp_t *a, const mp_t *b, int n) {
+  uint64_t carry = 0;
+  int i;
+
+  for (i = n - 1; i >= 0; --i) {
+    carry += (uint64_t)a->limb[i] + b->limb[i];
+    r->limb[i] = (uint32_t)carry;
+    carry >>= 32;
+  }
+}
+
+/**
+ * Sets @p r to @p a - @p b.
+ */
+void mpSub(mp_t *r, const mp_t *a, const mp_t *b, int n) {
+  mp_t negative = *b;
+
+  mpNegate(&negative, n);
+  mpAdd(r, a, &negative, n);
+}
+
+/**
+ * Sets @p r to @p a * @p b, truncating the bits beyond the precision. @p r
+ * may be the same as @p a or @p b.
+ */
+void mpMul(mp_t *r, const mp_t *a, const mp_t *b, int n) {
+  /* product[k] collects the limbs a[i] * b[j] with i + j == k */
+  uint32_t product[2 * MP_LIMBS];
+  mp_t x = *a;
+  mp_t y = *b;
+  int negative = mpNegative(a) != mpNegative(b);
+  int i;
+  int j;
+
+  if (mpNegative(&x))
+    mpNegate(&x, n);
+  if (mpNegative(&y))
+    mpNegate(&y, n);
+
+  for (i = 0; i < 2 * n; ++i)
+    product[i] = 0;
+
+  /* Schoolbook multiplication from the least significant limbs */
+  for (i = n - 1; i >= 0; --i) {
+    uint64_t carry = 0;
+
+    for (j = n - 1; j >= 0; --j) {
+      carry += (uint64_t)x.limb[i] * y.limb[j] + product[i + j + 1];
+      product[i + j + 1] = (uint32_t)carry;
+      carry >>= 32;
+    }
+    product[i] = (uint32_t)carry;
+  }
+
+  /* product[1] is the integer part */
+  for (i = 0; i < n; ++i)
+    r->limb[i] = product[i + 1];
+  if (negative)
+    mpNegate(r, n);
+}
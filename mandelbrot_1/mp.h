@@ -0,0 +1,31 @@
+#ifndef _MP_H
+#define _MP_H
+
+#include <stdint.h>
+
+/** Maximum number of 32 bit limbs of a number, i.e. 31 * 32 fraction bits */
+#define MP_LIMBS 32
+
+/*--- Type definitions -----------------------------------------------------*/
+
+/**
+ * Fixed-point number of arbitrary (but fixed) precision in two's
+ * complement. limb[0] is the integer part, limb[i] holds the bits 2^-32i
+ * to 2^-32(i-1)-1 of the fraction. All functions take the number of limbs
+ * @p n in use, 2 <= n <= MP_LIMBS; the integer part has to stay within
+ * [-2^31, 2^31).
+ */
+typedef struct {
+  uint32_t limb[MP_LIMBS];
+} mp_t;
+
+/*--- Function prototypes --------------------------------------------------*/
+
+void mpFromDouble(mp_t *r, double value, int n);
+int mpFromString(mp_t *r, const char *text, int n);
+double mpToDouble(const mp_t *a, int n);
+void mpAdd(mp_t *r, const mp_t *a, const mp_t *b, int n);
+void mpSub(mp_t *r, const mp_t *a, const mp_t *b, int n);
+void mpMul(mp_t *r, const mp_t *a, const mp_t *b, int n);
+
+#endif /* !_MP_H */
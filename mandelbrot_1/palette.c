@@ -0,0 +1,148 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "palette.h"
+#include "utility.h"
+
+/*--- Implementation -------------------------------------------------------*/
+
+/**
+ * Looks up a color scheme by its name ("hsv" or "gray").
+ *
+ * @param  name  Name of the color scheme
+ * @param  kind  Output: color scheme
+ *
+ * @return 0 on success, -1 if @p name is unknown
+ */
+int paletteParse(const char *name, palette_kind_t *kind) {
+  if (strcmp(name, "hsv") == 0)
+    *kind = PALETTE_HSV;
+  else if (strcmp(name, "gray") == 0)
+    *kind = PALETTE_GRAY;
+  else
+    return -1;
+  return 0;
+}
+
+/**
+ * Computes the colors of all iteration counts from 0 to @p maxiter once, so
+ * that coloring a pixel is a table lookup.
+ *
+ * @param  kind     Color scheme
+ * @param  maxiter  Maximum number of iterations
+ *
+ * @return Pointer to the palette if successful, NULL otherwise
+ */
+palette_t *paletteCreate(palette_kind_t kind, int maxiter) {
+  palette_t *palette;
+  int iter;
+
+  palette = (palette_t *)malloc(sizeof(palette_t));
+  if (!palette) {
+    fprintf(stderr, "Memory allocation error!\n");
+    return NULL;
+  }
+  palette->colors = (color_t *)malloc((maxiter + 1) * sizeof(color_t));
+  if (!palette->colors) {
+    fprintf(stderr, "Memory allocation error!\n");
+    free(palette);
+    return NULL;
+  }
+  palette->maxiter = maxiter;
+
+  for (iter = 0; iter < maxiter; ++iter) {
+    double level = sqrt((double)iter / maxiter);
+    color_t color;
+
+    if (kind == PALETTE_GRAY) {
+      color.red = color.green = color.blue = (unsigned char)(255.0 * level);
+      color.pad = 0;
+    } else {
+      color = HSVtoRGB(level, 0.8, 0.8);
+    }
+    palette->colors[iter] = color;
+  }
+
+  /* Bounded => black */
+  palette->colors[maxiter].red = 0;
+  palette->colors[maxiter].green = 0;
+  palette->colors[maxiter].blue = 0;
+  palette->colors[maxiter].pad = 0;
+
+  return palette;
+}
+
+/**
+ * Releases all resources occupied by the given palette.
+ *
+ * @param  palette  Palette to be freed
+ */
+void paletteFree(palette_t *palette) {
+  free(palette->colors);
+  free(palette);
+}
+
+/**
+ * Stores a color as pixel @p x of an RGB24 (@p size 3) or RGBA32 (@p size 4)
+ * image row.
+ */
+static inline void storeColor(unsigned char *row, int size, int x,
+                              color_t color) {
+  row[size * x] = color.red;
+  row[size * x + 1] = color.green;
+  row[size * x + 2] = color.blue;
+  if (size == 4)
+    row[size * x + 3] = 255;
+}
+
+/**
+ * Colors the iteration counts of @p counts (ITER16, ITER32 or SMOOTH32)
+ * into @p image (RGB24 or RGBA32), which has to cover the same block. The
+ * rows are shared among the OpenMP threads; within a row, each pixel is a
+ * table lookup (or an interpolation of two entries for SMOOTH32).
+ *
+ * @param  palette  Palette with the same maxiter as the counts
+ * @param  counts   Image holding the iteration counts
+ * @param  image    Output: colored image
+ */
+void paletteApply(const palette_t *palette, const image_t *counts,
+                  image_t *image) {
+  const unsigned int maxiter = palette->maxiter;
+  int y;
+
+#pragma omp parallel for schedule(static)
+  for (y = 0; y < counts->local_height; ++y) {
+    const unsigned char *in = counts->data + y * counts->stride;
+    unsigned char *out = image->data + y * image->stride;
+    int size = image->pixel_size;
+    int x;
+
+    switch (counts->format) {
+    case PIXEL_ITER16: {
+      const uint16_t *iters = (const uint16_t *)in;
+
+      for (x = 0; x < counts->local_width; ++x)
+        storeColor(out, size, x,
+                   palette->colors[iters[x] < maxiter ? iters[x] : maxiter]);
+      break;
+    }
+    case PIXEL_ITER32: {
+      const uint32_t *iters = (const uint32_t *)in;
+
+      for (x = 0; x < counts->local_width; ++x)
+        storeColor(out, size, x,
+                   palette->colors[iters[x] < maxiter ? iters[x] : maxiter]);
+      break;
+    }
+    default: {
+      const float *smooth = (const float *)in;
+
+      for (x = 0; x < counts->local_width; ++x)
+        storeColor(out, size, x, paletteSmooth(palette, smooth[x]));
+      break;
+    }
+    }
+  }
+}
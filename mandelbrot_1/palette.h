@@ -0,0 +1,64 @@
+#ifndef _PALETTE_H
+#define _PALETTE_H
+
+#include "image_distributed.h"
+
+/*--- Type definitions -----------------------------------------------------*/
+
+/**
+ * Color schemes of a palette.
+ */
+typedef enum {
+  PALETTE_HSV, /**< Hue and saturation over the square root of the count */
+  PALETTE_GRAY /**< Gray levels over the square root of the count */
+} palette_kind_t;
+
+/**
+ * Lookup table mapping iteration counts to colors.
+ */
+typedef struct {
+  int maxiter;     /**< Maximum number of iterations */
+  color_t *colors; /**< Color per count, colors[maxiter] is black */
+} palette_t;
+
+/*--- Function prototypes --------------------------------------------------*/
+
+int paletteParse(const char *name, palette_kind_t *kind);
+palette_t *paletteCreate(palette_kind_t kind, int maxiter);
+void paletteFree(palette_t *palette);
+void paletteApply(const palette_t *palette, const image_t *counts,
+                  image_t *image);
+
+/*--- Inline functions -----------------------------------------------------*/
+
+/**
+ * Returns the color of a continuous iteration count, interpolated between
+ * the two neighbouring entries of the palette. Counts of maxiter and above
+ * are black.
+ */
+static inline color_t paletteSmooth(const palette_t *palette, float count) {
+  color_t color;
+  const color_t *lower;
+  const color_t *upper;
+  float f;
+  int i;
+
+  if (count >= palette->maxiter)
+    return palette->colors[palette->maxiter];
+  if (count < 0.0f)
+    count = 0.0f;
+
+  i = (int)count;
+  f = count - i;
+  lower = &palette->colors[i];
+  upper = &palette->colors[i + 1 < palette->maxiter ? i + 1 : i];
+
+  color.red = (unsigned char)(lower->red + f * (upper->red - lower->red));
+  color.green =
+      (unsigned char)(lower->green + f * (upper->green - lower->green));
+  color.blue = (unsigned char)(lower->blue + f * (upper->blue - lower->blue));
+  color.pad = 0;
+  return color;
+}
+
+#endif /* !_PALETTE_H */
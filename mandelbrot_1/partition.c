@@ -0,0 +1,198 @@
+#include <omp.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <mpi.h>
+
+#include "kernel.h"
+#include "partition.h"
+
+/**
+ * Cost of a pixel besides its iterations, in iterations: coloring and
+ * writing it. Keeps the cheap rows of an image from all going to one rank.
+ */
+#define PREVIEW_PIXEL_COST 16
+
+/*--- Implementation -------------------------------------------------------*/
+
+/**
+ * Splits the @p rows rows of the image evenly among @p numprocs processes;
+ * the last one also gets the remainder. Process r gets the rows from
+ * bounds[r] (inclusive) to bounds[r + 1] (exclusive).
+ *
+ * @param  rows      Number of rows of the image
+ * @param  numprocs  Number of processes
+ * @param  bounds    Output: numprocs + 1 row boundaries
+ */
+void partitionBlock(int rows, int numprocs, int *bounds) {
+  int own_height = rows / numprocs;
+  int rank;
+
+  for (rank = 0; rank < numprocs; ++rank)
+    bounds[rank] = own_height * rank;
+  bounds[numprocs] = rows;
+}
+
+/**
+ * Returns the largest estimated cost of the shares in @p bounds over the
+ * mean one, given the cost per sample row of the preview.
+ */
+static double imbalance(const double *cost, const int *bounds,
+                        int numprocs) {
+  double total = 0.0;
+  double max = 0.0;
+  int rank;
+
+  for (rank = 0; rank < numprocs; ++rank) {
+    double share = 0.0;
+    int y;
+
+    for (y = bounds[rank]; y < bounds[rank + 1]; ++y)
+      share += cost[y / PREVIEW_STEP];
+    total += share;
+    if (share > max)
+      max = share;
+  }
+
+  return total > 0.0 ? max * numprocs / total : 1.0;
+}
+
+/**
+ * Splits the rows of the image among @p numprocs processes so that each
+ * gets about the same estimated cost rather than the same number of rows.
+ *
+ * The cost is estimated from a preview of every PREVIEW_STEP-th pixel in
+ * both directions, so at 1/PREVIEW_STEP of the resolution. The sample rows
+ * are computed in turns by the processes and their threads; the iterations
+ * of each (plus PREVIEW_PIXEL_COST per pixel) are summed up on all
+ * processes with MPI_Allreduce(). Every sample row stands for the
+ * PREVIEW_STEP rows around it. All processes then cut the rows at the same
+ * fractions of the total cost, without any further communication, but at
+ * least one row per process. Has to be called by all processes, with the
+ * view and the precision of the kernels set in @p data; prints the time of
+ * the preview and the estimated imbalance on rank 0.
+ *
+ * @param  data      Mandelbrot parameters
+ * @param  numprocs  Number of processes
+ * @param  bounds    Output: numprocs + 1 row boundaries, as in
+ *                   partitionBlock()
+ */
+void partitionCost(mandel_t *data, int numprocs, int *bounds) {
+  int samples_x = (data->columns + PREVIEW_STEP - 1) / PREVIEW_STEP;
+  int samples_y = (data->rows + PREVIEW_STEP - 1) / PREVIEW_STEP;
+  int *columns = (int *)malloc(samples_x * sizeof(int));
+  int *iters =
+      (int *)malloc(omp_get_max_threads() * samples_x * sizeof(int));
+  double *cost = (double *)calloc(samples_y, sizeof(double));
+  double start_time = MPI_Wtime();
+  double total = 0.0;
+  double sum = 0.0;
+  int rank;
+  int y;
+  int k;
+
+  if (!columns || !iters || !cost) {
+    fprintf(stderr, "Memory allocation error!\n");
+    MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+  }
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+  /* Sample the middle of each square of PREVIEW_STEP x PREVIEW_STEP */
+  for (k = 0; k < samples_x; ++k) {
+    columns[k] = k * PREVIEW_STEP + PREVIEW_STEP / 2;
+    if (columns[k] >= data->columns)
+      columns[k] = data->columns - 1;
+  }
+
+#pragma omp parallel for schedule(dynamic)
+  for (k = rank; k < samples_y; k += numprocs) {
+    mandel_stats_t stats = {0, 0, 0, 0, 0, 0, 0};
+    int row = k * PREVIEW_STEP + PREVIEW_STEP / 2;
+
+    if (row >= data->rows)
+      row = data->rows - 1;
+    kernelColumns(data, row, columns, samples_x,
+                  iters + omp_get_thread_num() * samples_x, NULL, &stats);
+    cost[k] = stats.iterations + (double)PREVIEW_PIXEL_COST * samples_x;
+  }
+  MPI_Allreduce(MPI_IN_PLACE, cost, samples_y, MPI_DOUBLE, MPI_SUM,
+                MPI_COMM_WORLD);
+
+  /* Cut at equal fractions of the total cost */
+  for (y = 0; y < data->rows; ++y)
+    total += cost[y / PREVIEW_STEP];
+  bounds[0] = 0;
+  y = 0;
+  for (k = 1; k < numprocs; ++k) {
+    double target = total * k / numprocs;
+
+    // a row goes to the share that holds the larger part of its cost
+    while (y < data->rows && sum + cost[y / PREVIEW_STEP] / 2 < target)
+      sum += cost[y++ / PREVIEW_STEP];
+    bounds[k] = y;
+  }
+  bounds[numprocs] = data->rows;
+
+  /* At least one row per process, if there are enough */
+  if (data->rows >= numprocs) {
+    for (k = 1; k < numprocs; ++k)
+      if (bounds[k] <= bounds[k - 1])
+        bounds[k] = bounds[k - 1] + 1;
+    for (k = numprocs - 1; k > 0; --k)
+      if (bounds[k] > data->rows - (numprocs - k))
+        bounds[k] = data->rows - (numprocs - k);
+  }
+
+  if (rank == 0) {
+    int *even = (int *)malloc((numprocs + 1) * sizeof(int));
+
+    printf("Preview time: %2.6f seconds (1/%d resolution)\n",
+           MPI_Wtime() - start_time, PREVIEW_STEP);
+    if (even) {
+      partitionBlock(data->rows, numprocs, even);
+      printf("Estimated imbalance: %.2f (%.2f with even rows)\n",
+             imbalance(cost, bounds, numprocs),
+             imbalance(cost, even, numprocs));
+      free(even);
+    }
+  }
+
+  free(columns);
+  free(iters);
+  free(cost);
+}
+
+/**
+ * Returns the share of the bounds of partitionBlock() or partitionCost()
+ * that goes to the calling process when the processes are ordered node by
+ * node: the processes of the first node of @p leaders get the first
+ * shares, in the order of their rank in @p node, then those of the second
+ * node, and so on. The shares of a node are then consecutive rows, no
+ * matter how the ranks are placed on the nodes. Has to be called by all
+ * processes.
+ *
+ * @param  node     Processes of the node of the calling process
+ * @param  leaders  First processes of all nodes, MPI_COMM_NULL on the
+ *                  other processes
+ *
+ * @return Index of the share of the calling process
+ */
+int partitionSlot(MPI_Comm node, MPI_Comm leaders) {
+  int local;
+  int size;
+  int first = 0;
+
+  MPI_Comm_rank(node, &local);
+  MPI_Comm_size(node, &size);
+  if (leaders != MPI_COMM_NULL) {
+    int rank;
+
+    MPI_Comm_rank(leaders, &rank);
+    MPI_Exscan(&size, &first, 1, MPI_INT, MPI_SUM, leaders);
+    if (rank == 0)
+      first = 0; // MPI_Exscan() leaves it undefined
+  }
+  MPI_Bcast(&first, 1, MPI_INT, 0, node);
+
+  return first + local;
+}
@@ -0,0 +1,17 @@
+#ifndef _PARTITION_H
+#define _PARTITION_H
+
+#include <mpi.h>
+
+#include "mandelbrot.h"
+
+/** Sample distance of the preview in pixels, in both directions */
+#define PREVIEW_STEP 16
+
+/*--- Function prototypes --------------------------------------------------*/
+
+void partitionBlock(int rows, int numprocs, int *bounds);
+void partitionCost(mandel_t *data, int numprocs, int *bounds);
+int partitionSlot(MPI_Comm node, MPI_Comm leaders);
+
+#endif /* !_PARTITION_H */
@@ -0,0 +1,454 @@
+#include <math.h>
+#include <omp.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <mpi.h>
+
+#include "mp.h"
+#include "perturb.h"
+
+/**
+ * A pixel is glitched if |z|^2 drops below this fraction of |Z|^2 of the
+ * reference orbit: its orbit has lost all significant digits of the delta.
+ */
+#define GLITCH_TOLERANCE 1e-6
+
+/**
+ * The series approximation may skip iterations as long as its third order
+ * term stays below this fraction of the second order one.
+ */
+#define SERIES_TOLERANCE 1e-6
+
+/** Maximum number of reference orbits used to fix glitched pixels */
+#define MAX_REFERENCES 16
+
+/*--- Type definitions -----------------------------------------------------*/
+
+/**
+ * Reference orbit Z_0 = 0, Z_n+1 = Z_n^2 + C of a point C, computed in high
+ * precision and stored rounded to double. The other pixels c = C + dc are
+ * computed as deltas z_n = Z_n + d_n with
+ * d_n+1 = 2 Z_n d_n + d_n^2 + dc, which only needs double precision.
+ */
+typedef struct {
+  int length;       /**< Number of orbit points Z_0 .. Z_length-1 */
+  double *z_real;   /**< Real parts of the orbit points */
+  double *z_imag;   /**< Imaginary parts of the orbit points */
+  double *glitch;   /**< GLITCH_TOLERANCE * |Z_n|^2 */
+  double ref_real;  /**< dc of the reference point itself */
+  double ref_imag;
+  int skip;         /**< Iterations covered by the series approximation */
+  double series[6]; /**< Coefficients A, B, C of the series at skip */
+} reference_t;
+
+/**
+ * View of the complex plane: center in high precision, pixel spacing in
+ * double. The pixel (x, y) is at center + dc with
+ * dc = ((x - columns / 2) * dx, (y - rows / 2) * dy).
+ */
+typedef struct {
+  mp_t center_real;
+  mp_t center_imag;
+  int limbs; /**< Limbs of the high-precision numbers */
+  double dx;
+  double dy;
+} view_t;
+
+/*--- Implementation -------------------------------------------------------*/
+
+/**
+ * Allocates the orbit arrays of a reference for up to maxiter + 1 points.
+ */
+static int referenceAlloc(reference_t *ref, int maxiter) {
+  ref->z_real = (double *)malloc((maxiter + 1) * sizeof(double));
+  ref->z_imag = (double *)malloc((maxiter + 1) * sizeof(double));
+  ref->glitch = (double *)malloc((maxiter + 1) * sizeof(double));
+  if (!ref->z_real || !ref->z_imag || !ref->glitch) {
+    fprintf(stderr, "Memory allocation error!\n");
+    return -1;
+  }
+  ref->skip = 0;
+  return 0;
+}
+
+/**
+ * Releases the orbit arrays of a reference.
+ */
+static void referenceFree(reference_t *ref) {
+  free(ref->z_real);
+  free(ref->z_imag);
+  free(ref->glitch);
+}
+
+/**
+ * Computes the orbit of the point center + (@p dc_real, @p dc_imag) in
+ * high precision, until it escapes or for maxiter iterations.
+ */
+static void referenceOrbit(reference_t *ref, const view_t *view,
+                           double dc_real, double dc_imag, int maxiter) {
+  int n = view->limbs;
+  mp_t c_real;
+  mp_t c_imag;
+  mp_t z_real;
+  mp_t z_imag;
+  mp_t real2;
+  mp_t imag2;
+  mp_t cross;
+  int iter;
+
+  mpFromDouble(&c_real, dc_real, n);
+  mpFromDouble(&c_imag, dc_imag, n);
+  mpAdd(&c_real, &c_real, &view->center_real, n);
+  mpAdd(&c_imag, &c_imag, &view->center_imag, n);
+  mpFromDouble(&z_real, 0.0, n);
+  mpFromDouble(&z_imag, 0.0, n);
+
+  ref->ref_real = dc_real;
+  ref->ref_imag = dc_imag;
+  for (iter = 0; iter <= maxiter; ++iter) {
+    double zr = mpToDouble(&z_real, n);
+    double zi = mpToDouble(&z_imag, n);
+
+    ref->z_real[iter] = zr;
+    ref->z_imag[iter] = zi;
+    if ((zr * zr) + (zi * zi) >= 4.0) {
+      ++iter;
+      break;
+    }
+
+    /* Z = Z^2 + C */
+    mpMul(&real2, &z_real, &z_real, n);
+    mpMul(&imag2, &z_imag, &z_imag, n);
+    mpMul(&cross, &z_real, &z_imag, n);
+    mpSub(&z_real, &real2, &imag2, n);
+    mpAdd(&z_real, &z_real, &c_real, n);
+    mpAdd(&z_imag, &cross, &cross, n);
+    mpAdd(&z_imag, &z_imag, &c_imag, n);
+  }
+  ref->length = iter;
+}
+
+/**
+ * Sets the glitch thresholds of the orbit points of a reference.
+ */
+static void referenceThresholds(reference_t *ref) {
+  int iter;
+
+  for (iter = 0; iter < ref->length; ++iter)
+    ref->glitch[iter] =
+        GLITCH_TOLERANCE * ((ref->z_real[iter] * ref->z_real[iter]) +
+                            (ref->z_imag[iter] * ref->z_imag[iter]));
+}
+
+/**
+ * Series approximation: d_n = A_n dc + B_n dc^2 + C_n dc^3 with
+ *   A_n+1 = 2 Z_n A_n + 1
+ *   B_n+1 = 2 Z_n B_n + A_n^2
+ *   C_n+1 = 2 Z_n C_n + 2 A_n B_n
+ * Finds the last iteration at which the series is still accurate for all
+ * |dc| <= @p radius and no pixel can have escaped yet, and stores its
+ * coefficients in the reference.
+ */
+static void referenceSeries(reference_t *ref, double radius) {
+  double a_real = 0.0, a_imag = 0.0;
+  double b_real = 0.0, b_imag = 0.0;
+  double c_real = 0.0, c_imag = 0.0;
+  int iter;
+
+  ref->skip = 0;
+  for (iter = 0; iter + 1 < ref->length; ++iter) {
+    double zr = ref->z_real[iter];
+    double zi = ref->z_imag[iter];
+    double na_real = 2.0 * ((zr * a_real) - (zi * a_imag)) + 1.0;
+    double na_imag = 2.0 * ((zr * a_imag) + (zi * a_real));
+    double nb_real = 2.0 * ((zr * b_real) - (zi * b_imag)) +
+                     ((a_real * a_real) - (a_imag * a_imag));
+    double nb_imag = 2.0 * ((zr * b_imag) + (zi * b_real)) +
+                     2.0 * (a_real * a_imag);
+    double nc_real = 2.0 * ((zr * c_real) - (zi * c_imag)) +
+                     2.0 * ((a_real * b_real) - (a_imag * b_imag));
+    double nc_imag = 2.0 * ((zr * c_imag) + (zi * c_real)) +
+                     2.0 * ((a_real * b_imag) + (a_imag * b_real));
+    double a = hypot(na_real, na_imag) * radius;
+    double b = hypot(nb_real, nb_imag) * radius * radius;
+    double c = hypot(nc_real, nc_imag) * radius * radius * radius;
+    double z = hypot(ref->z_real[iter + 1], ref->z_imag[iter + 1]);
+
+    /* Third order term too large, or pixels may escape */
+    if (c > SERIES_TOLERANCE * b || z + a + b + c >= 2.0)
+      break;
+
+    a_real = na_real;
+    a_imag = na_imag;
+    b_real = nb_real;
+    b_imag = nb_imag;
+    c_real = nc_real;
+    c_imag = nc_imag;
+    ref->skip = iter + 1;
+  }
+
+  ref->series[0] = a_real;
+  ref->series[1] = a_imag;
+  ref->series[2] = b_real;
+  ref->series[3] = b_imag;
+  ref->series[4] = c_real;
+  ref->series[5] = c_imag;
+}
+
+/**
+ * Iterates a pixel as delta to a reference orbit.
+ *
+ * @param  ref         Reference orbit
+ * @param  maxiter     Maximum number of iterations
+ * @param  dc_real     Real part of dc relative to the view center
+ * @param  dc_imag     Imaginary part of dc relative to the view center
+ * @param  norm        Output: |z|^2 after the last iteration
+ * @param  iterations  Iterations performed are added to this
+ *
+ * @return Number of iterations until the orbit escaped, maxiter if it did
+ *         not, or -1 - n if the pixel glitched at iteration n
+ */
+static int perturbPixel(const reference_t *ref, int maxiter, double dc_real,
+                        double dc_imag, double *norm,
+                        long long *iterations) {
+  double d_real = 0.0;
+  double d_imag = 0.0;
+  int iter = 0;
+  int start;
+
+  dc_real -= ref->ref_real;
+  dc_imag -= ref->ref_imag;
+
+  if (ref->skip > 0) {
+    const double *s = ref->series;
+    double dc2_real = (dc_real * dc_real) - (dc_imag * dc_imag);
+    double dc2_imag = 2.0 * (dc_real * dc_imag);
+    double dc3_real = (dc2_real * dc_real) - (dc2_imag * dc_imag);
+    double dc3_imag = (dc2_real * dc_imag) + (dc2_imag * dc_real);
+
+    d_real = ((s[0] * dc_real) - (s[1] * dc_imag)) +
+             ((s[2] * dc2_real) - (s[3] * dc2_imag)) +
+             ((s[4] * dc3_real) - (s[5] * dc3_imag));
+    d_imag = ((s[0] * dc_imag) + (s[1] * dc_real)) +
+             ((s[2] * dc2_imag) + (s[3] * dc2_real)) +
+             ((s[4] * dc3_imag) + (s[5] * dc3_real));
+    iter = ref->skip;
+  }
+  start = iter;
+
+  for (;;) {
+    double zr;
+    double zi;
+    double next_real;
+    double next_imag;
+
+    if (iter >= ref->length) {
+      /* The reference escaped before this pixel */
+      *iterations += iter - start;
+      return -1 - iter;
+    }
+
+    zr = ref->z_real[iter] + d_real;
+    zi = ref->z_imag[iter] + d_imag;
+    *norm = (zr * zr) + (zi * zi);
+    if (*norm >= 4.0 || iter == maxiter)
+      break;
+    if (*norm < ref->glitch[iter]) {
+      *iterations += iter - start;
+      return -1 - iter;
+    }
+
+    /* d = 2 Z d + d^2 + dc */
+    zr = ref->z_real[iter];
+    zi = ref->z_imag[iter];
+    next_real = 2.0 * ((zr * d_real) - (zi * d_imag)) +
+                ((d_real * d_real) - (d_imag * d_imag)) + dc_real;
+    next_imag = 2.0 * ((zr * d_imag) + (zi * d_real)) +
+                2.0 * (d_real * d_imag) + dc_imag;
+    d_real = next_real;
+    d_imag = next_imag;
+    ++iter;
+  }
+
+  *iterations += iter - start;
+  return iter;
+}
+
+/**
+ * Continuous iteration count, see smoothCount() in kernel.c.
+ */
+static inline float perturbSmooth(int iter, int maxiter, double norm) {
+  if (iter == maxiter)
+    return (float)maxiter;
+  return (float)(iter + 1 - log2(0.5 * log2(norm)));
+}
+
+/**
+ * Iterates the pixels with the indices @p pixels[0 .. count - 1] (relative
+ * to the local block) as deltas to @p ref. Finished pixels are stored in the
+ * image, @p result receives the return values of perturbPixel().
+ */
+static void perturbPixels(mandel_t *data, const view_t *view,
+                          const reference_t *ref, const int *pixels,
+                          int count, int *result) {
+  int i;
+
+#pragma omp parallel
+  {
+    mandel_stats_t stats = {0, 0, 0, 0, 0, 0, 0};
+
+#pragma omp for schedule(runtime)
+    for (i = 0; i < count; ++i) {
+      int x = pixels[i] % data->columns;
+      int y = data->from + pixels[i] / data->columns;
+      double norm = 0.0;
+      int iter = perturbPixel(ref, data->maxiter,
+                              (x - data->columns / 2.0) * view->dx,
+                              (y - data->rows / 2.0) * view->dy, &norm,
+                              &stats.iterations);
+
+      result[pixels[i]] = iter;
+      if (iter >= 0)
+        imageSetIter(data->image, x, y, iter,
+                     perturbSmooth(iter, data->maxiter, norm));
+    }
+
+#pragma omp atomic
+    data->stats.iterations += stats.iterations;
+  }
+}
+
+/**
+ * Perturbation engine: calculates the rows data->from to data->to for views
+ * too deep for double precision. The view is centered at
+ * data->center_real/center_imag (decimal strings, the middle of the section
+ * if NULL) and data->width wide (xmax - xmin if not positive).
+ *
+ * Rank 0 computes a reference orbit of the center with as many bits as the
+ * pixel spacing needs and broadcasts it, so all processes iterate their
+ * pixels as cheap double-precision deltas to it. The first iterations are
+ * skipped using a series approximation of the deltas. Pixels detected as
+ * glitched are recomputed with another reference orbit, taken at one of
+ * them, until none are left (at most MAX_REFERENCES orbits). As glitches
+ * are local, these references are computed by each process on its own.
+ * Has to be called by all processes.
+ *
+ * @param  data  Mandelbrot parameters
+ */
+void perturbRender(mandel_t *data) {
+  view_t view;
+  reference_t ref;
+  double spacing;
+  int rank;
+  int pixels = data->columns * (data->to - data->from);
+  int count;
+  int references = 1;
+  int *result;
+  int *glitched;
+  int i;
+
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+  /* View and precision: enough bits to resolve a pixel, plus headroom */
+  if (data->width > 0.0) {
+    view.dx = data->width / data->columns;
+    view.dy = view.dx;
+  } else {
+    view.dx = (data->xmax - data->xmin) / data->columns;
+    view.dy = (data->ymax - data->ymin) / data->rows;
+  }
+  spacing = view.dx < view.dy ? view.dx : view.dy;
+  view.limbs = 2 + (int)ceil((-log2(spacing) + 64) / 32);
+  if (view.limbs > MP_LIMBS) {
+    if (rank == 0)
+      fprintf(stderr, "Warning: view too deep, limiting precision to %d bits\n",
+              32 * (MP_LIMBS - 1));
+    view.limbs = MP_LIMBS;
+  }
+  // a coordinate that was given keeps all its digits, the other one is
+  // the midpoint of the view
+  if ((data->center_real &&
+       mpFromString(&view.center_real, data->center_real, view.limbs) != 0) ||
+      (data->center_imag &&
+       mpFromString(&view.center_imag, data->center_imag, view.limbs) != 0)) {
+    if (rank == 0)
+      fprintf(stderr, "Invalid center!\n");
+    MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+  }
+  if (!data->center_real)
+    mpFromDouble(&view.center_real, (data->xmin + data->xmax) / 2, view.limbs);
+  if (!data->center_imag)
+    mpFromDouble(&view.center_imag, (data->ymin + data->ymax) / 2, view.limbs);
+
+  // a process without rows still takes part in the broadcasts below
+  result = (int *)malloc((pixels ? pixels : 1) * sizeof(int));
+  glitched = (int *)malloc((pixels ? pixels : 1) * sizeof(int));
+  if (!result || !glitched || referenceAlloc(&ref, data->maxiter) != 0) {
+    fprintf(stderr, "Memory allocation error!\n");
+    MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+  }
+
+  /* Main reference: computed once, used by everybody */
+  if (rank == 0) {
+    referenceOrbit(&ref, &view, 0.0, 0.0, data->maxiter);
+    referenceSeries(&ref, hypot(data->columns / 2.0 * view.dx,
+                                data->rows / 2.0 * view.dy));
+  }
+  MPI_Bcast(&ref.length, 1, MPI_INT, 0, MPI_COMM_WORLD);
+  MPI_Bcast(&ref.skip, 1, MPI_INT, 0, MPI_COMM_WORLD);
+  MPI_Bcast(ref.series, 6, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+  MPI_Bcast(ref.z_real, ref.length, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+  MPI_Bcast(ref.z_imag, ref.length, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+  ref.ref_real = 0.0;
+  ref.ref_imag = 0.0;
+  referenceThresholds(&ref);
+  if (rank == 0) {
+    printf("Reference orbit: %d iterations at %d bits, series skips %d\n",
+           ref.length - 1, 32 * (view.limbs - 1), ref.skip);
+  }
+
+  for (i = 0; i < pixels; ++i)
+    glitched[i] = i;
+  perturbPixels(data, &view, &ref, glitched, pixels, result);
+  data->stats.pixels += pixels;
+
+  /* Fix glitched pixels with references taken among them */
+  ref.skip = 0;
+  for (;;) {
+    for (count = 0, i = 0; i < pixels; ++i)
+      if (result[i] < 0)
+        glitched[count++] = i;
+    if (references == 1)
+      data->stats.glitched += count;
+    if (count == 0 || references == MAX_REFERENCES)
+      break;
+
+    i = glitched[count / 2];
+    referenceOrbit(&ref, &view,
+                   (i % data->columns - data->columns / 2.0) * view.dx,
+                   (data->from + i / data->columns - data->rows / 2.0) *
+                       view.dy,
+                   data->maxiter);
+    referenceThresholds(&ref);
+    perturbPixels(data, &view, &ref, glitched, count, result);
+    references++;
+  }
+
+  /* Whatever is left keeps the iteration it glitched at */
+  for (i = 0; i < count; ++i) {
+    int x = glitched[i] % data->columns;
+    int y = data->from + glitched[i] / data->columns;
+    int iter = -1 - result[glitched[i]];
+
+    imageSetIter(data->image, x, y, iter, (float)iter);
+  }
+  if (count > 0) {
+    fprintf(stderr, "Warning: %d pixels still glitched after %d references\n",
+            count, references);
+  }
+
+  referenceFree(&ref);
+  free(glitched);
+  free(result);
+}
@@ -0,0 +1,10 @@
+#ifndef _PERTURB_H
+#define _PERTURB_H
+
+#include "mandelbrot.h"
+
+/*--- Function prototypes --------------------------------------------------*/
+
+void perturbRender(mandel_t *data);
+
+#endif /* !_PERTURB_H */
@@ -0,0 +1,180 @@
+#include <omp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <mpi.h>
+
+#include "kernel.h"
+#include "progressive.h"
+#include "utility.h"
+
+/** Longest name of a preview file */
+#define PREVIEW_NAME 4096
+
+/*--- Implementation -------------------------------------------------------*/
+
+/**
+ * Calculates the pixels of the pass with samples every @p step pixels in
+ * the rows data->from to data->to: the pixels (x, y) with x and y multiples
+ * of @p step that were not computed by the pass before, as x and y are
+ * multiples of 2 * @p step there. The sample rows are shared among the
+ * OpenMP threads according to the runtime schedule; the pixels of a row go
+ * to the escape-time kernels together.
+ *
+ * @param  data  Mandelbrot parameters, data->image receives the counts
+ * @param  step  Distance of the samples in pixels
+ */
+static void computePass(mandel_t *data, int step) {
+  int first = (data->from + step - 1) / step;
+  int last = (data->to + step - 1) / step;
+  int threads = omp_get_max_threads();
+  int *columns = (int *)malloc(threads * data->columns * sizeof(int));
+  int *iters = (int *)malloc(threads * data->columns * sizeof(int));
+  float *smooth = NULL;
+  int row;
+
+  if (data->image->format == PIXEL_SMOOTH32)
+    smooth = (float *)malloc(threads * data->columns * sizeof(float));
+  if (!columns || !iters ||
+      (data->image->format == PIXEL_SMOOTH32 && !smooth)) {
+    fprintf(stderr, "Memory allocation error!\n");
+    MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+  }
+
+#pragma omp parallel
+  {
+    mandel_stats_t stats = {0, 0, 0, 0, 0, 0, 0};
+    int offset = omp_get_thread_num() * data->columns;
+
+#pragma omp for schedule(runtime)
+    for (row = first; row < last; ++row) {
+      int y = row * step;
+      // rows of the last pass only have every other sample left
+      int stride =
+          step < PROGRESSIVE_FIRST && y % (2 * step) == 0 ? 2 * step : step;
+      int count = 0;
+      int x;
+      int i;
+
+      for (x = stride == step ? 0 : step; x < data->columns; x += stride)
+        columns[offset + count++] = x;
+
+      kernelColumns(data, y, columns + offset, count, iters + offset,
+                    smooth ? smooth + offset : NULL, &stats);
+      for (i = 0; i < count; ++i)
+        imageSetIter(data->image, columns[offset + i], y, iters[offset + i],
+                     smooth ? smooth[offset + i] : 0.0f);
+    }
+
+    /* Merge the statistics of all threads */
+#pragma omp atomic
+    data->stats.pixels += stats.pixels;
+#pragma omp atomic
+    data->stats.iterations += stats.iterations;
+#pragma omp atomic
+    data->stats.interior += stats.interior;
+#pragma omp atomic
+    data->stats.periodic += stats.periodic;
+  }
+
+  free(columns);
+  free(iters);
+  free(smooth);
+}
+
+/**
+ * Starts writing the samples of the pass with samples every @p step pixels
+ * as an image of 1/@p step of the resolution, with a nonblocking write
+ * (see imageSaveBegin()). Has to be called by all processes.
+ *
+ * @return 0 on success, -1 if the file could not be created
+ */
+static int savePreview(const mandel_t *data, const palette_t *palette,
+                       int step, const char *filename, MPI_Info info,
+                       image_write_t *write) {
+  int width = (data->columns + step - 1) / step;
+  int height = (data->rows + step - 1) / step;
+  int first = (data->from + step - 1) / step;
+  int last = (data->to + step - 1) / step;
+  image_t *counts = imageCreate(width, height, width, last - first, 0, first,
+                                data->count_format);
+  image_t *image = imageCreate(width, height, width, last - first, 0, first,
+                               data->format);
+  int status;
+  int x;
+  int y;
+
+  if (!counts || !image) {
+    fprintf(stderr, "Memory allocation error!\n");
+    MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+  }
+
+  for (y = first; y < last; ++y)
+    for (x = 0; x < width; ++x)
+      memcpy(imagePixel(counts, x, y),
+             imagePixel(data->image, x * step, y * step), counts->pixel_size);
+  paletteApply(palette, counts, image);
+  status = imageSaveBegin(image, filename, info, write);
+
+  imageFree(counts);
+  imageFree(image);
+  return status;
+}
+
+/**
+ * Calculates the rows data->from to data->to like mandelbrot(), but in
+ * passes of rising resolution, so that a first image is there long before
+ * the whole one: samples every PROGRESSIVE_FIRST pixels first, then every
+ * half as many pixels, down to every pixel. Each pass only computes the
+ * pixels that are new to it, which are three quarters of its samples, so
+ * all passes together compute every pixel once, like mandelbrot().
+ *
+ * All processes finish a pass before any of them starts the next, and the
+ * samples of every pass but the last are written as a preview image of
+ * their resolution, named after data->output (see passFileName()). The
+ * previews are written with nonblocking writes while the next pass is
+ * computed. Rank 0 prints the time from the start to each preview. Needs
+ * the pixel engine; has to be called by all processes.
+ *
+ * @param  data     Mandelbrot parameters
+ * @param  palette  Colors of the iteration counts
+ * @param  info     Hints for the MPI-IO implementation, or MPI_INFO_NULL
+ */
+void progressiveRender(mandel_t *data, const palette_t *palette,
+                       MPI_Info info) {
+  char filename[PREVIEW_NAME];
+  image_write_t write;
+  int pending = 0;
+  int rank;
+  int step;
+  double start_time = MPI_Wtime();
+
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+  data->stats.pixels = 0;
+  data->stats.iterations = 0;
+  data->stats.interior = 0;
+  data->stats.periodic = 0;
+  data->stats.filled = 0;
+  data->stats.glitched = 0;
+  data->stats.reused = 0;
+
+  for (step = PROGRESSIVE_FIRST; step > 1; step /= 2) {
+    computePass(data, step);
+
+    // the previous preview has to be written before the next one starts
+    if (pending)
+      imageWriteEnd(&write);
+    passFileName(data->output, step, filename, sizeof(filename));
+    pending = savePreview(data, palette, step, filename, info, &write) == 0;
+    if (rank == 0)
+      printf("Pass 1/%d: %2.6f seconds, preview %s\n", step,
+             MPI_Wtime() - start_time, filename);
+  }
+
+  computePass(data, 1);
+  if (pending)
+    imageWriteEnd(&write);
+  printf("Calculation time: %2.6f seconds\n", MPI_Wtime() - start_time);
+}
@@ -0,0 +1,17 @@
+#ifndef _PROGRESSIVE_H
+#define _PROGRESSIVE_H
+
+#include <mpi.h>
+
+#include "mandelbrot.h"
+#include "palette.h"
+
+/** Distance of the samples of the first, coarsest pass in pixels */
+#define PROGRESSIVE_FIRST 8
+
+/*--- Function prototypes --------------------------------------------------*/
+
+void progressiveRender(mandel_t *data, const palette_t *palette,
+                       MPI_Info info);
+
+#endif /* !_PROGRESSIVE_H */
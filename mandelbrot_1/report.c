@@ -0,0 +1,157 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <mpi.h>
+#include <omp.h>
+
+#include "report.h"
+
+/** Number of doubles each process contributes to the report */
+#define REPORT_VALUES 3
+
+/*--- Implementation -------------------------------------------------------*/
+
+/**
+ * Compares two doubles, for qsort().
+ */
+static int compareDoubles(const void *a, const void *b) {
+  double value_a = *(const double *)a;
+  double value_b = *(const double *)b;
+
+  return (value_a > value_b) - (value_a < value_b);
+}
+
+/**
+ * Sorts the @p count values of @p values and writes their minimum, median
+ * and maximum as a JSON object.
+ */
+static void writeSpread(FILE *fp, const char *name, double *values,
+                        int count) {
+  double median;
+
+  qsort(values, count, sizeof(double), compareDoubles);
+  median = count % 2 ? values[count / 2]
+                     : (values[count / 2 - 1] + values[count / 2]) / 2;
+  fprintf(fp, ", \"%s\": {\"min\": %.6f, \"median\": %.6f, \"max\": %.6f}",
+          name, values[0], median, values[count - 1]);
+}
+
+/**
+ * Appends the summary of a run as one line of JSON to @p filename, so the
+ * runs of a benchmark (see bench.sh) can be compared between versions.
+ *
+ * The line holds the view, the image size, the numbers of processes and
+ * threads, the kernel, and for each of the times in @p report its minimum,
+ * median and maximum over the processes. The throughput is given for the
+ * slowest process: pixels of the image per second of the total time, and
+ * iterations per second of the compute time. The load imbalance is the
+ * largest compute time over the mean one, 1 for a perfectly even split.
+ * Has to be called by all processes; rank 0 writes the file.
+ *
+ * @param  filename  File to append to
+ * @param  data      Mandelbrot parameters, with the statistics of the run
+ * @param  report    Configuration and timings of the calling process
+ *
+ * @return 0 on success, -1 if the file could not be written (on rank 0)
+ */
+int reportWrite(const char *filename, const mandel_t *data,
+                const report_t *report) {
+  static const char *engines[] = {"pixel", "rect", "perturb"};
+  static const char *dists[] = {"block", "cost"};
+  double local[REPORT_VALUES] = {report->compute, report->io, report->total};
+  long long work[2] = {data->stats.pixels, data->stats.iterations};
+  long long total_work[2];
+  double *all = NULL;
+  double *values = NULL;
+  int rank;
+  int numprocs;
+  int status = 0;
+
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  MPI_Comm_size(MPI_COMM_WORLD, &numprocs);
+
+  if (rank == 0) {
+    all = (double *)malloc(REPORT_VALUES * numprocs * sizeof(double));
+    values = (double *)malloc(numprocs * sizeof(double));
+    if (!all || !values) {
+      fprintf(stderr, "Memory allocation error!\n");
+      MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+    }
+  }
+  MPI_Gather(local, REPORT_VALUES, MPI_DOUBLE, all, REPORT_VALUES,
+             MPI_DOUBLE, 0, MPI_COMM_WORLD);
+  MPI_Reduce(work, total_work, 2, MPI_LONG_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+
+  if (rank == 0) {
+    FILE *fp = fopen(filename, "a");
+    double max_compute = 0.0;
+    double sum_compute = 0.0;
+    double max_total = 0.0;
+    double pixels = (double)data->columns * data->rows;
+    int i;
+
+    if (!fp) {
+      fprintf(stderr, "Could not open report file \"%s\"!\n", filename);
+      free(all);
+      free(values);
+      return -1;
+    }
+
+    for (i = 0; i < numprocs; ++i) {
+      double compute = all[REPORT_VALUES * i];
+      double total = all[REPORT_VALUES * i + 2];
+
+      sum_compute += compute;
+      if (compute > max_compute)
+        max_compute = compute;
+      if (total > max_total)
+        max_total = total;
+    }
+
+    fprintf(fp, "{\"variant\": 1, \"dist\": \"%s\", \"engine\": \"%s\"",
+            dists[data->dist], engines[data->engine]);
+    fprintf(fp, ", \"kernel\": \"%s\"", report->kernel);
+    if (report->precision)
+      fprintf(fp, ", \"precision\": \"%s\"", report->precision);
+    if (data->center_real)
+      fprintf(fp, ", \"re\": \"%s\"", data->center_real);
+    else
+      fprintf(fp, ", \"re\": \"%.17g\"", (data->xmin + data->xmax) / 2);
+    if (data->center_imag)
+      fprintf(fp, ", \"im\": \"%s\"", data->center_imag);
+    else
+      fprintf(fp, ", \"im\": \"%.17g\"", (data->ymin + data->ymax) / 2);
+    fprintf(fp, ", \"width\": %.17g, \"maxiter\": %d",
+            data->width > 0.0 ? data->width : data->xmax - data->xmin,
+            data->maxiter);
+    fprintf(fp, ", \"columns\": %d, \"rows\": %d", data->columns, data->rows);
+    fprintf(fp, ", \"ranks\": %d, \"threads\": %d", numprocs,
+            omp_get_max_threads());
+    fprintf(fp, ", \"pixels\": %lld, \"iterations\": %lld", total_work[0],
+            total_work[1]);
+
+    for (i = 0; i < REPORT_VALUES; ++i) {
+      static const char *names[REPORT_VALUES] = {"compute", "io", "total"};
+      int j;
+
+      for (j = 0; j < numprocs; ++j)
+        values[j] = all[REPORT_VALUES * j + i];
+      writeSpread(fp, names[i], values, numprocs);
+    }
+
+    fprintf(fp, ", \"mpixel_per_s\": %.3f, \"giter_per_s\": %.3f",
+            max_total > 0.0 ? pixels / max_total / 1e6 : 0.0,
+            max_compute > 0.0 ? total_work[1] / max_compute / 1e9 : 0.0);
+    fprintf(fp, ", \"imbalance\": %.3f}\n",
+            sum_compute > 0.0 ? max_compute * numprocs / sum_compute : 1.0);
+
+    if (fclose(fp) != 0) {
+      fprintf(stderr, "Could not write report file \"%s\"!\n", filename);
+      status = -1;
+    }
+    free(all);
+    free(values);
+  }
+
+  return status;
+}
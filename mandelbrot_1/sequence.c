@@ -0,0 +1,270 @@
+#include <ctype.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <mpi.h>
+
+#include "kernel.h"
+#include "sequence.h"
+#include "utility.h"
+
+/**
+ * Largest distance, in pixels of the previous frame, at which a pixel still
+ * lands on the sample grid of the previous frame. The positions of the
+ * pixels are rounded anyway, so this is far below what an image can show.
+ */
+#define REUSE_TOLERANCE 1e-3
+
+/*--- Implementation -------------------------------------------------------*/
+
+/**
+ * Returns non-zero if the frames go to a single Y4M file (a name ending in
+ * ".y4m") rather than to numbered PPM files.
+ */
+static int isY4M(const char *output) {
+  size_t length = strlen(output);
+
+  return length >= 4 && strcmp(output + length - 4, ".y4m") == 0;
+}
+
+/**
+ * Checks the name given for the frames of a sequence: either a Y4M file, or
+ * a pattern for the PPM files with exactly one conversion like "%d" or
+ * "%04d" for the frame number, e.g. "frame%04d.ppm".
+ *
+ * @return 0 if @p output is valid, -1 otherwise
+ */
+int sequenceCheckOutput(const char *output) {
+  int conversions = 0;
+
+  if (isY4M(output))
+    return 0;
+
+  for (; *output; ++output) {
+    if (*output != '%')
+      continue;
+    if (output[1] == '%') {
+      ++output;
+      continue;
+    }
+    ++output;
+    while (isdigit((unsigned char)*output))
+      ++output;
+    if (*output != 'd')
+      return -1;
+    ++conversions;
+  }
+
+  return conversions == 1 ? 0 : -1;
+}
+
+/**
+ * Sets the view of frame number @p frame in @p data. The width changes by
+ * the same factor from frame to frame; the center moves in proportion to
+ * the width, so that all frames share a fixed point.
+ *
+ * @param  data      Mandelbrot parameters
+ * @param  sequence  Zoom sequence
+ * @param  start     Center (real and imag. part), width and height of the
+ *                   first frame
+ * @param  frame     Number of the frame
+ */
+static void frameView(mandel_t *data, const sequence_t *sequence,
+                      const double start[4], int frame) {
+  double t = (double)frame / (sequence->frames - 1);
+  double width = start[2] * pow(sequence->end_width / start[2], t);
+  double height = width * start[3] / start[2];
+  double center_real = start[0];
+  double center_imag = start[1];
+
+  if (sequence->end_center) {
+    double s = start[2] != sequence->end_width
+                   ? (start[2] - width) / (start[2] - sequence->end_width)
+                   : t;
+
+    center_real += s * (sequence->end_real - start[0]);
+    center_imag += s * (sequence->end_imag - start[1]);
+  }
+
+  data->xmin = center_real - width / 2;
+  data->xmax = center_real + width / 2;
+  data->ymin = center_imag - height / 2;
+  data->ymax = center_imag + height / 2;
+  data->width = width;
+  kernelCenter(data);
+}
+
+/**
+ * Finds the pixels of the current view in @p data that land on the sample
+ * grid of the previous frame with the view @p previous (xmin, ymin, xmax,
+ * ymax), see reuse_t. Only the local rows of the previous frame count.
+ */
+static void frameReuse(const mandel_t *data, const double previous[4],
+                       int *column, int *row) {
+  double dx = (data->xmax - data->xmin) / data->columns;
+  double dy = (data->ymax - data->ymin) / data->rows;
+  double previous_dx = (previous[2] - previous[0]) / data->columns;
+  double previous_dy = (previous[3] - previous[1]) / data->rows;
+  int x;
+  int y;
+
+  for (x = 0; x < data->columns; ++x) {
+    double at = ((data->xmin - previous[0]) + (x * dx)) / previous_dx;
+    double nearest = floor(at + 0.5);
+
+    column[x] = fabs(at - nearest) < REUSE_TOLERANCE && nearest >= 0 &&
+                        nearest < data->columns
+                    ? (int)nearest
+                    : -1;
+  }
+
+  for (y = data->from; y < data->to; ++y) {
+    double at = ((data->ymin - previous[1]) + (y * dy)) / previous_dy;
+    double nearest = floor(at + 0.5);
+
+    row[y - data->from] = fabs(at - nearest) < REUSE_TOLERANCE &&
+                                  nearest >= data->from && nearest < data->to
+                              ? (int)nearest
+                              : -1;
+  }
+}
+
+/**
+ * Renders a zoom sequence of sequence->frames frames, from the view in
+ * @p data to the end view of @p sequence, and writes them to data->output:
+ * a Y4M file or numbered PPM files (see sequenceCheckOutput()). Has to be
+ * called by all processes.
+ *
+ * The processes stay with their rows for the whole sequence. Each frame is
+ * written with a nonblocking collective write that is only completed after
+ * the next frame has been computed, so MPI libraries with asynchronous
+ * progress can write in the background. Pixels that land on the sample
+ * grid of the previous frame, which happens if the zoom factor between
+ * frames is the inverse of an integer, are copied from there instead of
+ * being computed again (not with the perturbation engine). Rank 0
+ * prints the time per frame, and the statistics of the whole sequence at
+ * the end.
+ *
+ * @param  data      Mandelbrot parameters, with the view of the first frame
+ *                   and data->image holding the counts of the local rows
+ * @param  sequence  Zoom sequence
+ * @param  palette   Colors of the iteration counts
+ * @param  image     Colored image of the local rows
+ * @param  info      Hints for the MPI-IO implementation, or MPI_INFO_NULL
+ */
+void sequenceRender(mandel_t *data, const sequence_t *sequence,
+                    const palette_t *palette, image_t *image, MPI_Info info) {
+  int rank;
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+  double start[4];
+  double previous[4] = {0.0, 0.0, 0.0, 0.0};
+  image_t *counts[2];
+  int *column;
+  int *row;
+  reuse_t reuse;
+  mandel_stats_t total = {0, 0, 0, 0, 0, 0, 0};
+  image_write_t write;
+  int writing = 0;
+  MPI_File video;
+  int y4m = isY4M(data->output);
+  precision_t precision = PRECISION_DOUBLE;
+  char filename[4096];
+  double start_time = get_wtime();
+  int frame;
+
+  if (y4m &&
+      imageOpenY4M(image, data->output, sequence->fps, info, &video) != 0)
+    return;
+
+  start[0] = (data->xmin + data->xmax) / 2;
+  start[1] = (data->ymin + data->ymax) / 2;
+  start[2] = data->xmax - data->xmin;
+  start[3] = data->ymax - data->ymin;
+
+  /* Counts of the current and the previous frame take turns */
+  counts[0] = data->image;
+  counts[1] = imageCreate(counts[0]->global_width, counts[0]->global_height,
+                          counts[0]->local_width, counts[0]->local_height,
+                          counts[0]->x_offset, counts[0]->y_offset,
+                          counts[0]->format);
+  column = (int *)malloc(data->columns * sizeof(int));
+  row = (int *)malloc((data->to - data->from + 1) * sizeof(int));
+  if (!counts[1] || !column || !row) {
+    fprintf(stderr, "Memory allocation error!\n");
+    MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+  }
+  // with a moving center, the frames have no exact center any more
+  if (sequence->end_center) {
+    data->center_real = NULL;
+    data->center_imag = NULL;
+  }
+
+  for (frame = 0; frame < sequence->frames; ++frame) {
+    double frame_time = get_wtime();
+    const char *name;
+
+    frameView(data, sequence, start, frame);
+    if (data->engine != ENGINE_PERTURB) {
+      name = kernelPrecision(data);
+      if (rank == 0 && (frame == 0 || data->precision != precision))
+        printf("Frame %d: %s precision\n", frame + 1, name);
+      precision = data->precision;
+    }
+
+    data->image = counts[frame % 2];
+    data->reuse = NULL;
+    if (frame > 0 && data->engine != ENGINE_PERTURB) {
+      frameReuse(data, previous, column, row);
+      reuse.counts = counts[(frame + 1) % 2];
+      reuse.column = column;
+      reuse.row = row;
+      data->reuse = &reuse;
+    }
+
+    mandelbrotFrame(data);
+    statsAdd(&total, &data->stats);
+    paletteApply(palette, data->image, image);
+
+    /* Complete the write of the previous frame */
+    if (writing)
+      imageWriteEnd(&write);
+    if (y4m) {
+      imageSaveY4MBegin(image, video, frame, &write);
+      writing = 1;
+    } else {
+      snprintf(filename, sizeof(filename), data->output, frame);
+      writing = imageSaveBegin(image, filename, info, &write) == 0;
+    }
+
+    previous[0] = data->xmin;
+    previous[1] = data->ymin;
+    previous[2] = data->xmax;
+    previous[3] = data->ymax;
+    if (rank == 0) {
+      printf("Frame %d/%d: width %.6e, %2.6f seconds\n", frame + 1,
+             sequence->frames, data->width, get_wtime() - frame_time);
+    }
+  }
+
+  if (writing)
+    imageWriteEnd(&write);
+  if (y4m)
+    MPI_File_close(&video);
+
+  statsReport(&total);
+  if (rank == 0) {
+    double elapsed = get_wtime() - start_time;
+
+    printf("Sequence time: %2.6f seconds (%.2f frames per second)\n",
+           elapsed, sequence->frames / elapsed);
+  }
+
+  data->image = counts[0];
+  data->reuse = NULL;
+  imageFree(counts[1]);
+  free(column);
+  free(row);
+}
@@ -0,0 +1,31 @@
+#ifndef _SEQUENCE_H
+#define _SEQUENCE_H
+
+#include <mpi.h>
+
+#include "mandelbrot.h"
+#include "palette.h"
+
+/*--- Type definitions -----------------------------------------------------*/
+
+/**
+ * Zoom sequence from the view in mandel_t to an end view. The frames zoom
+ * geometrically about the one point of the plane that keeps its position
+ * in the image; without an end center, this is the center of the view.
+ */
+typedef struct {
+  int frames;       /**< Number of frames, 0 for a single image */
+  int end_center;   /**< Non-zero if the end view has its own center */
+  double end_real;  /**< Center of the end view (real part) */
+  double end_imag;  /**< Center of the end view (imag. part) */
+  double end_width; /**< Width of the end view */
+  int fps;          /**< Frame rate of Y4M output */
+} sequence_t;
+
+/*--- Function prototypes --------------------------------------------------*/
+
+int sequenceCheckOutput(const char *output);
+void sequenceRender(mandel_t *data, const sequence_t *sequence,
+                    const palette_t *palette, image_t *image, MPI_Info info);
+
+#endif /* !_SEQUENCE_H */
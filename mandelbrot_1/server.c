@@ -0,0 +1,630 @@
+#include <errno.h>
+#include <math.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <mpi.h>
+
+#include "cache.h"
+#include "compress.h"
+#include "kernel.h"
+#include "server.h"
+#include "utility.h"
+
+/** Edge length of the tiles the images are put together from */
+#define SERVER_TILE 256
+
+/** Memory of the tile cache on rank 0, in MB */
+#define SERVER_CACHE_MB 256
+
+/** Largest width and height of a requested image, in pixels */
+#define SERVER_MAX_SIZE 8192
+
+/** Longest request line, including the newline */
+#define SERVER_LINE 256
+
+/** Microseconds an idle process sleeps between looking for work */
+#define SERVER_POLL 1000
+
+/*--- Type definitions -----------------------------------------------------*/
+
+/**
+ * Tiles rank 0 hands to all processes. The column and row of each tile
+ * follow in a second broadcast.
+ */
+typedef struct {
+  int stop;      /**< Non-zero to shut the server down */
+  int maxiter;   /**< Maximum number of iterations */
+  int precision; /**< Arithmetic of the kernels (precision_t) */
+  int count;     /**< Number of tiles */
+  double scale;  /**< Width of a pixel in the complex plane */
+} job_t;
+
+/**
+ * Image requested by a client.
+ */
+typedef struct {
+  double center_real; /**< Center of the view (real part) */
+  double center_imag; /**< Center of the view (imag. part) */
+  double width;       /**< Width of the view */
+  int columns;        /**< Width of the image in pixels */
+  int rows;           /**< Height of the image in pixels */
+  int maxiter;        /**< Maximum number of iterations */
+  codec_t codec;      /**< Format of the image */
+} request_t;
+
+/*--- Implementation -------------------------------------------------------*/
+
+/**
+ * Divides @p a by @p b > 0, rounding towards minus infinity.
+ */
+static long long floorDiv(long long a, long long b) {
+  return a >= 0 ? a / b : -((-a + b - 1) / b);
+}
+
+/**
+ * Opens the socket the server listens on: a Unix socket at the path
+ * @p address, or a TCP socket on the loopback interface for an address of
+ * the form ":PORT". A socket left at the path by an earlier server is
+ * replaced.
+ *
+ * @return File descriptor of the socket, -1 on errors
+ */
+static int serverListen(const char *address) {
+  struct sockaddr_un local;
+  struct sockaddr_in inet;
+  struct sockaddr *addr;
+  socklen_t length;
+  struct stat st;
+  int on = 1;
+  int fd;
+
+  if (address[0] == ':') {
+    int port = atoi(address + 1);
+
+    if (port < 1 || port > 65535) {
+      fprintf(stderr, "Invalid port \"%s\"!\n", address + 1);
+      return -1;
+    }
+    memset(&inet, 0, sizeof(inet));
+    inet.sin_family = AF_INET;
+    inet.sin_port = htons(port);
+    inet.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr = (struct sockaddr *)&inet;
+    length = sizeof(inet);
+  } else {
+    if (strlen(address) >= sizeof(local.sun_path)) {
+      fprintf(stderr, "Socket path \"%s\" too long!\n", address);
+      return -1;
+    }
+    memset(&local, 0, sizeof(local));
+    local.sun_family = AF_UNIX;
+    strcpy(local.sun_path, address);
+    if (stat(address, &st) == 0 && S_ISSOCK(st.st_mode))
+      unlink(address);
+    addr = (struct sockaddr *)&local;
+    length = sizeof(local);
+  }
+
+  fd = socket(addr->sa_family, SOCK_STREAM, 0);
+  if (fd < 0 ||
+      setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) != 0 ||
+      bind(fd, addr, length) != 0 || listen(fd, SOMAXCONN) != 0) {
+    fprintf(stderr, "Could not listen on \"%s\": %s!\n", address,
+            strerror(errno));
+    if (fd >= 0)
+      close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+/**
+ * Sends all @p size bytes of @p buffer to the client @p fd.
+ *
+ * @return 0 on success, -1 if the client is gone
+ */
+static int sendAll(int fd, const void *buffer, size_t size) {
+  const char *next = (const char *)buffer;
+
+  while (size > 0) {
+    // a client closing the connection must not kill the server by SIGPIPE
+    ssize_t sent = send(fd, next, size, MSG_NOSIGNAL);
+
+    if (sent < 0) {
+      if (errno == EINTR)
+        continue;
+      return -1;
+    }
+    next += sent;
+    size -= sent;
+  }
+  return 0;
+}
+
+/**
+ * Parses a request line of the form
+ * "render RE IM WIDTH COLUMNSxROWS MAXITER FORMAT", FORMAT being ppm, png
+ * or qoi.
+ *
+ * @return NULL on success, otherwise what is wrong with the request
+ */
+static const char *parseRequest(const char *line, const mandel_t *data,
+                                request_t *request) {
+  char format[8];
+  char end;
+
+  if (sscanf(line, "render %lf %lf %lf %dx%d %d %7s %c",
+             &request->center_real, &request->center_imag, &request->width,
+             &request->columns, &request->rows, &request->maxiter, format,
+             &end) != 7)
+    return "expected \"render RE IM WIDTH COLUMNSxROWS MAXITER FORMAT\"";
+  if (!(request->width > 0.0) || !isfinite(request->width) ||
+      !isfinite(request->center_real) || !isfinite(request->center_imag))
+    return "invalid view";
+  if (request->columns < 1 || request->columns > SERVER_MAX_SIZE ||
+      request->rows < 1 || request->rows > SERVER_MAX_SIZE)
+    return "invalid image size";
+  if (request->maxiter < 1 ||
+      (data->count_format == PIXEL_ITER16 && request->maxiter > UINT16_MAX))
+    return "invalid number of iterations";
+  // the pixels are numbered in doubles, which have to stay exact
+  if (fabs(request->center_real) / request->width * request->columns >
+          1e15 ||
+      fabs(request->center_imag) / request->width * request->columns > 1e15)
+    return "view too deep";
+
+  if (strcmp(format, "ppm") == 0)
+    request->codec = CODEC_PPM;
+  else if (strcmp(format, "png") == 0)
+    request->codec = CODEC_PNG;
+  else if (strcmp(format, "qoi") == 0)
+    request->codec = CODEC_QOI;
+  else
+    return "invalid format, expected ppm, png or qoi";
+  return NULL;
+}
+
+/**
+ * Waits for the next job from rank 0, sleeping in between, so idle
+ * processes leave their cores to others instead of spinning in MPI.
+ */
+static void waitJob(job_t *job) {
+  MPI_Request request;
+  int done = 0;
+
+  MPI_Ibcast(job, sizeof(job_t), MPI_BYTE, 0, MPI_COMM_WORLD, &request);
+  for (;;) {
+    MPI_Test(&request, &done, MPI_STATUS_IGNORE);
+    if (done)
+      break;
+    usleep(SERVER_POLL);
+  }
+}
+
+/**
+ * Computes and colors the job->count tiles at @p coords (column and row of
+ * each) and collects them on rank 0. Every tile is computed as a view of
+ * its own, by the engine and the OpenMP threads of mandelbrotFrame(), so a
+ * tile comes out the same in every image it is part of. The processes get
+ * even blocks of the tiles, like partitionBlock() gives them rows, but
+ * with the remainder spread, as there are often fewer tiles than
+ * processes. Has to be called by all processes.
+ *
+ * @param  data    Mandelbrot parameters: engine, palette and count format
+ * @param  job     Tiles to compute
+ * @param  coords  Column and row of each tile
+ * @param  pixels  Output on rank 0: packed RGB of the tiles, one after the
+ *                 other
+ */
+static void renderJob(const mandel_t *data, const job_t *job,
+                      const long long *coords, unsigned char *pixels) {
+  int tile_size = SERVER_TILE * SERVER_TILE * 3;
+  int rank;
+  int numprocs;
+  int *counts;
+  int *displs;
+  int first;
+  int own;
+  int k;
+  unsigned char *local;
+  image_t *tile_counts;
+  image_t *tile_colors;
+  palette_t *palette;
+
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  MPI_Comm_size(MPI_COMM_WORLD, &numprocs);
+
+  first = (int)((long long)job->count * rank / numprocs);
+  own = (int)((long long)job->count * (rank + 1) / numprocs) - first;
+  counts = (int *)malloc(numprocs * sizeof(int));
+  displs = (int *)malloc(numprocs * sizeof(int));
+  local = rank == 0 ? pixels : (unsigned char *)malloc(own * tile_size + 1);
+  tile_counts = imageCreate(SERVER_TILE, SERVER_TILE, SERVER_TILE,
+                            SERVER_TILE, 0, 0, data->count_format);
+  tile_colors = imageCreate(SERVER_TILE, SERVER_TILE, SERVER_TILE,
+                            SERVER_TILE, 0, 0, PIXEL_RGB24);
+  palette = paletteCreate(data->palette, job->maxiter);
+  if (!counts || !displs || !local || !tile_counts || !tile_colors ||
+      !palette) {
+    fprintf(stderr, "Memory allocation error!\n");
+    MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+  }
+
+  for (k = 0; k < own; ++k) {
+    const long long *tile = coords + 2 * (first + k);
+    mandel_t view = *data;
+
+    view.xmin = tile[0] * SERVER_TILE * job->scale;
+    view.xmax = (tile[0] + 1) * SERVER_TILE * job->scale;
+    view.ymin = tile[1] * SERVER_TILE * job->scale;
+    view.ymax = (tile[1] + 1) * SERVER_TILE * job->scale;
+    kernelCenter(&view);
+    view.maxiter = job->maxiter;
+    view.precision = (precision_t)job->precision;
+    view.columns = SERVER_TILE;
+    view.rows = SERVER_TILE;
+    view.from = 0;
+    view.to = SERVER_TILE;
+    view.reuse = NULL;
+    view.image = tile_counts;
+
+    mandelbrotFrame(&view);
+    paletteApply(palette, tile_counts, tile_colors);
+    memcpy(local + (size_t)k * tile_size, tile_colors->data, tile_size);
+  }
+
+  for (k = 0; k < numprocs; ++k) {
+    displs[k] = (int)((long long)job->count * k / numprocs) * tile_size;
+    counts[k] = (int)((long long)job->count * (k + 1) / numprocs) * tile_size -
+                displs[k];
+  }
+  MPI_Gatherv(rank == 0 ? MPI_IN_PLACE : local, own * tile_size, MPI_BYTE,
+              pixels, counts, displs, MPI_BYTE, 0, MPI_COMM_WORLD);
+
+  if (rank != 0)
+    free(local);
+  free(counts);
+  free(displs);
+  imageFree(tile_counts);
+  imageFree(tile_colors);
+  paletteFree(palette);
+}
+
+/**
+ * Sends an image of packed RGB pixels to the client, as a line "OK SIZE"
+ * followed by SIZE bytes of the file in the requested format.
+ *
+ * @return 0 on success, -1 if the client is gone
+ */
+static int sendImage(int client, const unsigned char *pixels,
+                     const request_t *request) {
+  unsigned char header[CODEC_MAX_HEADER];
+  unsigned char trailer[CODEC_MAX_HEADER];
+  char line[32];
+  const unsigned char *body = pixels;
+  size_t body_size = (size_t)request->columns * request->rows * 3;
+  int header_size;
+  int trailer_size;
+  segment_t segment;
+  int status;
+
+  segmentInit(&segment);
+  if (request->codec != CODEC_PPM) {
+    if (compressRows(request->codec, pixels, (size_t)request->columns * 3, 3,
+                     request->columns, request->rows, &segment) != 0) {
+      fprintf(stderr, "Memory allocation error!\n");
+      MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+    }
+    body = segment.data;
+    body_size = segment.size;
+  }
+  header_size =
+      codecHeader(request->codec, request->columns, request->rows, header);
+  trailer_size = codecTrailer(request->codec, segment.adler, trailer);
+
+  snprintf(line, sizeof(line), "OK %zu\n",
+           header_size + body_size + trailer_size);
+  status = sendAll(client, line, strlen(line)) != 0 ||
+                   sendAll(client, header, header_size) != 0 ||
+                   sendAll(client, body, body_size) != 0 ||
+                   sendAll(client, trailer, trailer_size) != 0
+               ? -1
+               : 0;
+  free(segment.data);
+  return status;
+}
+
+/**
+ * Answers a request on rank 0. The pixels of all images of the same scale
+ * (width of a pixel) lie on one lattice of the complex plane, the points
+ * (i * scale, j * scale), so the view is moved by up to half a pixel to
+ * the nearest lattice point. The lattice is cut into tiles of
+ * SERVER_TILE x SERVER_TILE pixels; the tiles of the image are taken from
+ * the cache where possible, and the others are computed by all processes
+ * (see renderJob()) and then cached. Panning or repeating a view thus only
+ * computes the tiles not seen before.
+ *
+ * @return 0 on success, -1 if the client is gone
+ */
+static int serveRequest(const mandel_t *data, cache_t *cache, int client,
+                        const request_t *request) {
+  double start_time = get_wtime();
+  double scale = request->width / request->columns;
+  size_t tile_size = (size_t)SERVER_TILE * SERVER_TILE * 3;
+  mandel_t view = *data;
+  tile_key_t key;
+  job_t job;
+  long long x0;
+  long long y0;
+  long long tile_x0;
+  long long tile_y0;
+  int tiles_x;
+  int tiles_y;
+  int missing = 0;
+  int status;
+  int i;
+  int x;
+  int y;
+  const unsigned char **sources;
+  long long *coords;
+  unsigned char *computed = NULL;
+  unsigned char *image;
+
+  /* Pixels of the image on the lattice, and the tiles they are in */
+  x0 = llround(request->center_real / scale - request->columns / 2.0);
+  y0 = llround(request->center_imag / scale - request->rows / 2.0);
+  tile_x0 = floorDiv(x0, SERVER_TILE);
+  tile_y0 = floorDiv(y0, SERVER_TILE);
+  tiles_x = (int)(floorDiv(x0 + request->columns - 1, SERVER_TILE) -
+                  tile_x0 + 1);
+  tiles_y =
+      (int)(floorDiv(y0 + request->rows - 1, SERVER_TILE) - tile_y0 + 1);
+
+  /* The whole image decides on the arithmetic, so all tiles match */
+  view.xmin = x0 * scale;
+  view.xmax = (x0 + request->columns) * scale;
+  view.ymin = y0 * scale;
+  view.ymax = (y0 + request->rows) * scale;
+  view.columns = request->columns;
+  view.rows = request->rows;
+  kernelCenter(&view);
+  kernelPrecision(&view);
+
+  sources = (const unsigned char **)malloc(tiles_x * tiles_y *
+                                           sizeof(unsigned char *));
+  coords = (long long *)malloc(2 * tiles_x * tiles_y * sizeof(long long));
+  image = (unsigned char *)malloc((size_t)request->columns * request->rows *
+                                  3);
+  if (!sources || !coords || !image) {
+    fprintf(stderr, "Memory allocation error!\n");
+    MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+  }
+
+  key.scale = scale;
+  key.maxiter = request->maxiter;
+  key.precision = view.precision;
+  for (i = 0; i < tiles_x * tiles_y; ++i) {
+    key.x = tile_x0 + i % tiles_x;
+    key.y = tile_y0 + i / tiles_x;
+    sources[i] = cacheFind(cache, &key);
+    if (!sources[i]) {
+      coords[2 * missing] = key.x;
+      coords[2 * missing + 1] = key.y;
+      missing++;
+    }
+  }
+
+  if (missing > 0) {
+    MPI_Request bcast;
+
+    computed = (unsigned char *)malloc(missing * tile_size);
+    if (!computed) {
+      fprintf(stderr, "Memory allocation error!\n");
+      MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+    }
+    job.stop = 0;
+    job.maxiter = request->maxiter;
+    job.precision = view.precision;
+    job.count = missing;
+    job.scale = scale;
+    MPI_Ibcast(&job, sizeof(job_t), MPI_BYTE, 0, MPI_COMM_WORLD, &bcast);
+    MPI_Wait(&bcast, MPI_STATUS_IGNORE);
+    MPI_Bcast(coords, 2 * missing, MPI_LONG_LONG, 0, MPI_COMM_WORLD);
+    renderJob(data, &job, coords, computed);
+
+    missing = 0;
+    for (i = 0; i < tiles_x * tiles_y; ++i)
+      if (!sources[i])
+        sources[i] = computed + missing++ * tile_size;
+  }
+
+  /* Put the image together from the rows of the tiles */
+  for (y = 0; y < request->rows; ++y) {
+    long long row = y0 + y;
+    long long tile_y = floorDiv(row, SERVER_TILE);
+    int in_y = (int)(row - tile_y * SERVER_TILE);
+
+    for (x = 0; x < request->columns;) {
+      long long column = x0 + x;
+      long long tile_x = floorDiv(column, SERVER_TILE);
+      int in_x = (int)(column - tile_x * SERVER_TILE);
+      int count = SERVER_TILE - in_x < request->columns - x
+                      ? SERVER_TILE - in_x
+                      : request->columns - x;
+      const unsigned char *tile =
+          sources[(tile_y - tile_y0) * tiles_x + (tile_x - tile_x0)];
+
+      memcpy(image + ((size_t)y * request->columns + x) * 3,
+             tile + ((size_t)in_y * SERVER_TILE + in_x) * 3, count * 3);
+      x += count;
+    }
+  }
+  status = sendImage(client, image, request);
+
+  for (i = 0; i < missing; ++i) {
+    key.x = coords[2 * i];
+    key.y = coords[2 * i + 1];
+    if (cacheInsert(cache, &key, computed + i * tile_size) != 0)
+      break;
+  }
+
+  printf("Image %dx%d: %d of %d tiles cached, %2.6f seconds\n",
+         request->columns, request->rows, tiles_x * tiles_y - missing,
+         tiles_x * tiles_y, get_wtime() - start_time);
+  fflush(stdout);
+
+  free(sources);
+  free(coords);
+  free(computed);
+  free(image);
+  return status;
+}
+
+/**
+ * Accepts clients on rank 0, one at a time, and answers their requests
+ * until one sends "shutdown"; then tells the other processes to stop.
+ */
+static void serveClients(const mandel_t *data, int listener,
+                         cache_t *cache) {
+  char line[SERVER_LINE];
+  job_t stop = {1, 0, 0, 0, 0.0};
+  MPI_Request bcast;
+  int running = 1;
+
+  while (running) {
+    int client = accept(listener, NULL, NULL);
+    FILE *in;
+
+    if (client < 0) {
+      if (errno == EINTR)
+        continue;
+      fprintf(stderr, "Could not accept a client: %s!\n", strerror(errno));
+      break;
+    }
+    in = fdopen(client, "r");
+    if (!in) {
+      close(client);
+      continue;
+    }
+
+    while (fgets(line, sizeof(line), in)) {
+      char command[16];
+      request_t request;
+      const char *error;
+      char reply[SERVER_LINE];
+
+      if (sscanf(line, "%15s", command) != 1)
+        continue;
+      if (strcmp(command, "shutdown") == 0) {
+        sendAll(client, "OK 0\n", 5);
+        running = 0;
+        break;
+      }
+      error = strcmp(command, "render") == 0
+                  ? parseRequest(line, data, &request)
+                  : "unknown command, expected render or shutdown";
+      if (error) {
+        snprintf(reply, sizeof(reply), "ERROR %s\n", error);
+        if (sendAll(client, reply, strlen(reply)) != 0)
+          break;
+        continue;
+      }
+      if (serveRequest(data, cache, client, &request) != 0)
+        break;
+    }
+    fclose(in);
+  }
+
+  MPI_Ibcast(&stop, sizeof(job_t), MPI_BYTE, 0, MPI_COMM_WORLD, &bcast);
+  MPI_Wait(&bcast, MPI_STATUS_IGNORE);
+  printf("Tiles found in the cache: %lld of %lld\n", cache->hits,
+         cache->hits + cache->misses);
+}
+
+/**
+ * Runs as a render server instead of rendering a single image, so that
+ * clients like interactive viewers are spared starting the processes for
+ * every image. Rank 0 listens on data->serve (see serverListen()) and reads
+ * requests, one per line:
+ *
+ *   render RE IM WIDTH COLUMNSxROWS MAXITER FORMAT
+ *     answered by "OK SIZE" and SIZE bytes of a PPM, PNG or QOI file, or
+ *     by "ERROR MESSAGE"
+ *   shutdown
+ *     stops the server
+ *
+ * The images are put together from tiles that rank 0 keeps in a cache of
+ * SERVER_CACHE_MB, see serveRequest(); all processes compute the missing
+ * tiles together. Engine, palette, periodicity check and count format are
+ * taken from @p data. Has to be called by all processes.
+ *
+ * @param  data  Mandelbrot parameters
+ *
+ * @return 0 after a shutdown, -1 if the server could not be started
+ */
+int serverRun(mandel_t *data) {
+  const char *address = data->serve;
+  size_t tile_size = (size_t)SERVER_TILE * SERVER_TILE * 3;
+  cache_t *cache = NULL;
+  int listener = -1;
+  int status = 0;
+  int rank;
+
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  // the requests set the views, not the command line
+  data->center_real = NULL;
+  data->center_imag = NULL;
+  data->width = 0.0;
+
+  if (rank == 0) {
+    listener = serverListen(address);
+    if (listener >= 0)
+      cache = cacheCreate(((size_t)SERVER_CACHE_MB << 20) / tile_size,
+                          tile_size);
+    if (!cache)
+      status = -1;
+  }
+  MPI_Bcast(&status, 1, MPI_INT, 0, MPI_COMM_WORLD);
+  if (status != 0) {
+    if (listener >= 0)
+      close(listener);
+    return -1;
+  }
+
+  if (rank == 0) {
+    printf("Serving images on %s\n", address);
+    fflush(stdout);
+    serveClients(data, listener, cache);
+    close(listener);
+    if (address[0] != ':')
+      unlink(address);
+    cacheFree(cache);
+  } else {
+    job_t job;
+
+    for (;;) {
+      long long *coords;
+
+      waitJob(&job);
+      if (job.stop)
+        break;
+      coords = (long long *)malloc(2 * job.count * sizeof(long long));
+      if (!coords) {
+        fprintf(stderr, "Memory allocation error!\n");
+        MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+      }
+      MPI_Bcast(coords, 2 * job.count, MPI_LONG_LONG, 0, MPI_COMM_WORLD);
+      renderJob(data, &job, coords, NULL);
+      free(coords);
+    }
+  }
+
+  return 0;
+}
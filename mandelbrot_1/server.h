@@ -0,0 +1,10 @@
+#ifndef _SERVER_H
+#define _SERVER_H
+
+#include "mandelbrot.h"
+
+/*--- Function prototypes --------------------------------------------------*/
+
+int serverRun(mandel_t *data);
+
+#endif /* !_SERVER_H */
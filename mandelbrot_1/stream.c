@@ -0,0 +1,140 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <mpi.h>
+
+#include "compress.h"
+#include "stream.h"
+#include "utility.h"
+
+/*--- Implementation -------------------------------------------------------*/
+
+/**
+ * Renders the rows data->from to data->to in bands that fit into
+ * data->memory bytes, for images too large to be held in memory. Each band
+ * is computed, colored and handed to a nonblocking collective write (see
+ * imageStreamWrite()) before the next one is computed, so at any time a
+ * process only holds the counts and colors of one band, plus a copy of the
+ * band being written. The image goes to data->output, and the counts to
+ * data->counts_file if given. Has to be called by all processes.
+ *
+ * As the writes are collective, all processes go through the same number
+ * of bands; those with fewer rows write empty bands at the end. Rank 0
+ * prints the time per band and the statistics of the whole image.
+ *
+ * @param  data     Mandelbrot parameters, data->image is not used
+ * @param  palette  Colors of the iteration counts
+ * @param  info     Hints for the MPI-IO implementation, or MPI_INFO_NULL
+ *
+ * @return 0 on success, -1 if not even one row fits into data->memory, the
+ *         output is not a PPM image or could not be created
+ */
+int streamRender(mandel_t *data, const palette_t *palette, MPI_Info info) {
+  int rank;
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+  int from = data->from;
+  int to = data->to;
+  int count_size = imagePixelSize(data->count_format);
+  // counts, colors and the copy of the colors being written (packed RGB)
+  size_t row = (size_t)data->columns *
+               (count_size + imagePixelSize(data->format) + 3 +
+                (data->counts_file ? count_size : 0));
+  size_t rows = data->memory / row;
+  int bands;
+  int band;
+  image_t *counts;
+  image_t *image;
+  image_stream_t stream;
+  image_stream_t counts_stream;
+  mandel_stats_t total = {0, 0, 0, 0, 0, 0, 0};
+  double start_time = get_wtime();
+
+  if (codecFromName(data->output) != CODEC_PPM) {
+    if (rank == 0)
+      fprintf(stderr, "Streamed images can only be written as PPM!\n");
+    return -1;
+  }
+  if (rows < 1) {
+    if (rank == 0)
+      fprintf(stderr, "Not enough memory for a single row (%zu bytes)!\n",
+              row);
+    return -1;
+  }
+  if (rows > (size_t)(to - from))
+    rows = to - from > 0 ? to - from : 1;
+
+  bands = (int)((to - from + rows - 1) / rows);
+  MPI_Allreduce(MPI_IN_PLACE, &bands, 1, MPI_INT, MPI_MAX, MPI_COMM_WORLD);
+  if (rank == 0) {
+    printf("Streaming in %d bands of %zu rows (%.1f MB per process)\n",
+           bands, rows, rows * row / 1e6);
+  }
+
+  counts = imageCreate(data->columns, data->rows, data->columns, (int)rows,
+                       0, from, data->count_format);
+  image = imageCreate(data->columns, data->rows, data->columns, (int)rows, 0,
+                      from, data->format);
+  if (!counts || !image) {
+    fprintf(stderr, "Memory allocation error!\n");
+    MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+  }
+
+  if (imageStreamOpen(image, from, to, data->output, data->maxiter, info,
+                      &stream) != 0) {
+    imageFree(counts);
+    imageFree(image);
+    return -1;
+  }
+  if (data->counts_file &&
+      imageStreamOpen(counts, from, to, data->counts_file, data->maxiter,
+                      info, &counts_stream) != 0) {
+    imageStreamClose(&stream);
+    imageFree(counts);
+    imageFree(image);
+    return -1;
+  }
+
+  data->image = counts;
+  for (band = 0; band < bands; ++band) {
+    double band_time = get_wtime();
+    int y = from + band * (int)rows;
+    int height = y < to ? (y + (int)rows < to ? (int)rows : to - y) : 0;
+
+    // both images move down to the rows of the band
+    if (height == 0)
+      y = to;
+    counts->y_offset = image->y_offset = y;
+    counts->local_height = image->local_height = height;
+    data->from = y;
+    data->to = y + height;
+
+    mandelbrotFrame(data);
+    statsAdd(&total, &data->stats);
+    paletteApply(palette, counts, image);
+
+    imageStreamWrite(&stream, image);
+    if (data->counts_file)
+      imageStreamWrite(&counts_stream, counts);
+
+    if (rank == 0) {
+      printf("Band %d/%d: %2.6f seconds\n", band + 1, bands,
+             get_wtime() - band_time);
+    }
+  }
+
+  imageStreamClose(&stream);
+  if (data->counts_file)
+    imageStreamClose(&counts_stream);
+
+  statsReport(&total);
+  if (rank == 0)
+    printf("Streaming time: %2.6f seconds\n", get_wtime() - start_time);
+
+  data->from = from;
+  data->to = to;
+  data->image = NULL;
+  imageFree(counts);
+  imageFree(image);
+  return 0;
+}
@@ -0,0 +1,13 @@
+#ifndef _STREAM_H
+#define _STREAM_H
+
+#include <mpi.h>
+
+#include "mandelbrot.h"
+#include "palette.h"
+
+/*--- Function prototypes --------------------------------------------------*/
+
+int streamRender(mandel_t *data, const palette_t *palette, MPI_Info info);
+
+#endif /* !_STREAM_H */
@@ -1,11 +1,14 @@
 #ifndef _UTILITY_H
 #define _UTILITY_H
 
+#include <stddef.h>
+
 #include "image_distributed.h"
 
 /*--- Function prototypes --------------------------------------------------*/
 
 double get_wtime();
+void passFileName(const char *output, int step, char *name, size_t size);
 color_t HSVtoRGB(double hue, double sat, double val);
 
 #endif /* !_UTILITY_H */
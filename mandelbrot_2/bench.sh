@@ -0,0 +1,66 @@
+#!/bin/sh
+#
+# Benchmark of a fixed catalogue of views, to compare versions of the
+# program ("make bench"). Every view is rendered with the distributions of
+# the work in DISTS, for all numbers of processes in RANKS and of threads in
+# THREADS, once with a fixed image of SIZE x SIZE pixels (strong scaling)
+# and once with SIZE x SIZE pixels per process (weak scaling). The
+# summaries of the runs (see reportWrite()) are printed as one JSON
+# document.
+#
+# Settings from the environment (defaults in brackets):
+#   MPIRUN   command starting the processes [mpirun]
+#   DISTS    distributions of the work, see --dist [master steal]
+#   RANKS    numbers of processes [1 2 4]
+#   THREADS  numbers of OpenMP threads per process [1 2]
+#   SIZE     edge length of the image, in pixels [1024]
+
+MPIRUN=${MPIRUN:-mpirun}
+DISTS=${DISTS:-"master steal"}
+RANKS=${RANKS:-"1 2 4"}
+THREADS=${THREADS:-"1 2"}
+SIZE=${SIZE:-1024}
+
+# name, center (real and imaginary part), width, maximum number of iterations
+VIEWS="overview -0.75 0 3 1000
+seahorse -0.7453 0.1127 0.0065 2000
+deep -1.17265 -0.296328 1.4e-5 5000
+interior -0.25 0 0.8 5000"
+
+cd "$(dirname "$0")" || exit 1
+dir=$(mktemp -d) || exit 1
+trap 'rm -rf "$dir"' EXIT
+
+echo "$VIEWS" | while read -r name re im width maxiter; do
+  for dist in $DISTS; do
+    for ranks in $RANKS; do
+      for threads in $THREADS; do
+        for scaling in strong weak; do
+          # weak scaling keeps the view and the pixels per process
+          edge=$SIZE
+          if [ "$scaling" = weak ]; then
+            edge=$(awk "BEGIN { printf \"%d\", $SIZE * sqrt($ranks) }")
+          fi
+
+          echo "$name, $dist: $ranks x $threads, ${edge}x$edge ($scaling)" >&2
+          rm -f "$dir/run.json"
+          if ! $MPIRUN -np "$ranks" ./mandel -d "$dist" -t "$threads" \
+                 -s dynamic -x "$re" -y "$im" -w "$width" -m "$maxiter" \
+                 -g "${edge}x$edge" -O "$dir/image.ppm" -j "$dir/run.json" \
+                 </dev/null >"$dir/log" 2>&1; then
+            cat "$dir/log" >&2
+            exit 1
+          fi
+          sed "s/^{/{\"view\": \"$name\", \"scaling\": \"$scaling\", /" \
+              "$dir/run.json" >>"$dir/runs.json"
+        done
+      done
+    done
+  done
+done || exit 1
+
+echo "{\"host\": \"$(uname -n)\","
+echo " \"version\": \"$(git describe --always --dirty 2>/dev/null)\","
+echo " \"runs\": ["
+sed '$!s/$/,/' "$dir/runs.json"
+echo "]}"
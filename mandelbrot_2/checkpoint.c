@@ -0,0 +1,192 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "checkpoint.h"
+#include "schedule.h"
+
+/** Longest name of a completion map */
+#define CHECKPOINT_NAME 4096
+
+/*--- Implementation -------------------------------------------------------*/
+
+/**
+ * Builds the header of the completion map of the image described by
+ * @p data: the cells and the parameters that the pixels depend on, i.e.
+ * the view, iterations, engine and colors, so that a run is only resumed
+ * with the image it was started with.
+ */
+static void mapHeader(const mandel_t *data, const schedule_t *schedule,
+                      char *header) {
+  static const char *engines[] = {"pixel", "rect"};
+  static const char *palettes[] = {"hsv", "gray"};
+
+  memset(header, 0, CHECKPOINT_HEADER);
+  snprintf(header, CHECKPOINT_HEADER,
+           "mandelbrot completion map\n%d %d %d %d\n%d %d %d\n%s %s\n"
+           "%.17g %.17g %.17g %.17g\n",
+           schedule->columns, schedule->rows, schedule->cell_w,
+           schedule->cell_h, data->maxiter, data->smooth, data->periodicity,
+           engines[data->engine], palettes[data->palette->kind], data->xmin,
+           data->xmax, data->ymin, data->ymax);
+}
+
+/**
+ * Creates or, when resuming, reads the completion map of the output
+ * image: the file data->output with ".done" appended, which holds a header
+ * and a byte per cell (see schedule_t) that is non-zero once the pixels of
+ * the cell are in the image. A new map has no finished cells. A map is
+ * only resumed if its header matches the image, i.e. with the same size,
+ * cells, view, iterations, engine and palette, and the image it belongs to
+ * exists.
+ *
+ * Sets data->done to the map and opens data->done_file for
+ * checkpointMark(). Has to be called by all processes; only rank 0 reports
+ * errors.
+ *
+ * @param  data  Mandelbrot parameters, data->resume to read the map
+ *
+ * @return 0 on success, -1 if the map could not be created or resumed
+ */
+int checkpointOpen(mandel_t *data) {
+  char name[CHECKPOINT_NAME];
+  char header[CHECKPOINT_HEADER];
+  char found[CHECKPOINT_HEADER];
+  schedule_t schedule;
+  int status = 0;
+  int finished = 0;
+  int rank;
+  int i;
+
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  snprintf(name, sizeof(name), "%s.done", data->output);
+  scheduleInit(&schedule, data, 1);
+  mapHeader(data, &schedule, header);
+
+  data->done = (unsigned char *)calloc(schedule.cells, 1);
+  data->marked = (int *)malloc(2 * CHECKPOINT_SYNC * sizeof(int));
+  data->mark_count = 0;
+  if (!data->done || !data->marked) {
+    fprintf(stderr, "Memory allocation error!\n");
+    MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+  }
+
+  if (rank == 0) { // only rank 0 touches the map outside of MPI-IO
+    FILE *fp = fopen(name, data->resume ? "r" : "w");
+    FILE *image = data->resume ? fopen(data->output, "r") : NULL;
+
+    if (!fp || (data->resume && !image)) {
+      fprintf(stderr, "Could not %s \"%s\"!\n",
+              data->resume ? "resume from" : "create",
+              fp ? data->output : name);
+      status = -1;
+    } else if (data->resume) {
+      if (fread(found, 1, CHECKPOINT_HEADER, fp) != CHECKPOINT_HEADER ||
+          memcmp(found, header, CHECKPOINT_HEADER) != 0 ||
+          fread(data->done, 1, schedule.cells, fp) != (size_t)schedule.cells) {
+        fprintf(stderr, "\"%s\" is not the completion map of this image!\n",
+                name);
+        status = -1;
+      }
+    } else if (fwrite(header, 1, CHECKPOINT_HEADER, fp) != CHECKPOINT_HEADER ||
+               fwrite(data->done, 1, schedule.cells, fp) !=
+                   (size_t)schedule.cells) {
+      fprintf(stderr, "Could not write \"%s\"!\n", name);
+      status = -1;
+    }
+    if (fp)
+      fclose(fp);
+    if (image)
+      fclose(image);
+  }
+
+  MPI_Bcast(&status, 1, MPI_INT, 0, MPI_COMM_WORLD);
+  if (status != 0) {
+    free(data->done);
+    free(data->marked);
+    data->done = NULL;
+    return -1;
+  }
+  if (data->resume) {
+    MPI_Bcast(data->done, schedule.cells, MPI_BYTE, 0, MPI_COMM_WORLD);
+    for (i = 0; i < schedule.cells; ++i)
+      finished += data->done[i] != 0;
+    if (rank == 0)
+      printf("Resuming: %d of %d cells already done\n", finished,
+             schedule.cells);
+  }
+
+  MPI_File_open(MPI_COMM_WORLD, name, MPI_MODE_WRONLY, MPI_INFO_NULL,
+                &data->done_file);
+  return 0;
+}
+
+/**
+ * Marks the cells of a work item as finished, in memory at once and in the
+ * completion map with the next checkpointFlush(), which happens every
+ * CHECKPOINT_SYNC items. Must only be called once the pixels of the item
+ * have been written, so the map never claims more than the image holds.
+ *
+ * @param  data  Mandelbrot parameters
+ * @param  item  Work item of whole cells
+ */
+void checkpointMark(mandel_t *data, const item_t *item) {
+  schedule_t schedule;
+  int *cells = data->marked + 2 * data->mark_count;
+
+  scheduleInit(&schedule, data, 1);
+  scheduleCells(&schedule, item, &cells[0], &cells[1]);
+  memset(data->done + cells[0], 1, cells[1] - cells[0]);
+
+  if (++data->mark_count == CHECKPOINT_SYNC)
+    checkpointFlush(data);
+}
+
+/**
+ * Writes the cells marked since the last call to the completion map. The
+ * image is synced to storage first (the file is opened by each process on
+ * its own for that, see renderImage()), so that even after a crash of the
+ * node the map never claims pixels that only made it to a cache. The cells
+ * of an item are consecutive (see scheduleNext()), so they take a single
+ * write.
+ *
+ * @param  data  Mandelbrot parameters
+ */
+void checkpointFlush(mandel_t *data) {
+  int i;
+
+  if (data->mark_count == 0)
+    return;
+  MPI_File_sync(data->file);
+  for (i = 0; i < data->mark_count; ++i) {
+    int first = data->marked[2 * i];
+    int end = data->marked[2 * i + 1];
+
+    MPI_File_write_at(data->done_file, CHECKPOINT_HEADER + first,
+                      data->done + first, end - first, MPI_BYTE,
+                      MPI_STATUS_IGNORE);
+  }
+  data->mark_count = 0;
+}
+
+/**
+ * Closes the completion map after the whole image has been written and
+ * deletes it, as there is nothing left to resume. Has to be called by all
+ * processes.
+ *
+ * @param  data  Mandelbrot parameters
+ */
+void checkpointClose(mandel_t *data) {
+  char name[CHECKPOINT_NAME];
+  int rank;
+
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  MPI_File_close(&data->done_file);
+  if (rank == 0) {
+    snprintf(name, sizeof(name), "%s.done", data->output);
+    MPI_File_delete(name, MPI_INFO_NULL);
+  }
+  free(data->done);
+  free(data->marked);
+  data->done = NULL;
+}
@@ -0,0 +1,19 @@
+#ifndef _CHECKPOINT_H
+#define _CHECKPOINT_H
+
+#include "mandelbrot.h"
+
+/** Bytes of the header of a completion map, before the cells */
+#define CHECKPOINT_HEADER 256
+
+/** Finished items a process collects before it syncs them to the map */
+#define CHECKPOINT_SYNC 16
+
+/*--- Function prototypes --------------------------------------------------*/
+
+int checkpointOpen(mandel_t *data);
+void checkpointMark(mandel_t *data, const item_t *item);
+void checkpointFlush(mandel_t *data);
+void checkpointClose(mandel_t *data);
+
+#endif /* !_CHECKPOINT_H */
@@ -0,0 +1,44 @@
+#ifndef _COMPRESS_H
+#define _COMPRESS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/** Largest number of bytes codecHeader() and codecTrailer() write */
+#define CODEC_MAX_HEADER 64
+
+/*--- Type definitions -----------------------------------------------------*/
+
+/**
+ * Formats an RGB image can be written in.
+ */
+typedef enum {
+  CODEC_PPM, /**< Binary PPM, uncompressed */
+  CODEC_PNG, /**< PNG, deflate of rows with the Sub filter */
+  CODEC_QOI  /**< QOI ("Quite OK Image"), fast lossless */
+} codec_t;
+
+/**
+ * Compressed run of consecutive full rows of an image. Segments of the
+ * rows of an image, joined in order and framed by codecHeader() and
+ * codecTrailer(), make up a valid file, no matter where the image was cut
+ * into segments.
+ */
+typedef struct {
+  unsigned char *data; /**< Compressed bytes */
+  size_t size;         /**< Number of compressed bytes */
+  uint32_t adler;      /**< Adler-32 of the data deflated for PNG */
+  size_t length;       /**< Number of bytes deflated for PNG */
+} segment_t;
+
+/*--- Function prototypes --------------------------------------------------*/
+
+codec_t codecFromName(const char *filename);
+int codecHeader(codec_t codec, int width, int height, unsigned char *header);
+int codecTrailer(codec_t codec, uint32_t adler, unsigned char *trailer);
+void segmentInit(segment_t *segment);
+int segmentAppend(segment_t *segment, const segment_t *next);
+int compressRows(codec_t codec, const unsigned char *pixels, size_t stride,
+                 int pixel_size, int width, int rows, segment_t *segment);
+
+#endif /* !_COMPRESS_H */
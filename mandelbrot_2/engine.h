@@ -0,0 +1,12 @@
+#ifndef _ENGINE_H
+#define _ENGINE_H
+
+#include "mandelbrot.h"
+
+/*--- Function prototypes --------------------------------------------------*/
+
+void engineRect(const mandel_t *data, int x0, int y0, int x1, int y1,
+                int *iters, float *smooth, int stride,
+                mandel_stats_t *stats);
+
+#endif /* !_ENGINE_H */
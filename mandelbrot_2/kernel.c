@@ -0,0 +1,1173 @@
+#include <float.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define KERNEL_X86
+#include <immintrin.h>
+#endif
+
+#include "kernel.h"
+
+/** Distance below which an orbit is considered to have returned */
+#define PERIODICITY_EPS 1e-13
+/** Same for the float kernels, a similar number of ulps */
+#define PERIODICITY_EPS_FLOAT 1e-5f
+/** Same for the double-double kernel */
+#define PERIODICITY_EPS_DD 1e-28
+
+/**
+ * Factor by which the pixel spacing has to exceed the rounding error of an
+ * arithmetic type for kernelPrecision() to consider the type safe; the
+ * iteration amplifies the rounding errors of the points.
+ */
+#define PRECISION_MARGIN 1024.0
+
+/**
+ * Significant digits of a decimal read by ddFromString(), a few more than
+ * double-double holds; the rest only count for the exponent.
+ */
+#define DD_DIGITS 34
+
+/*--- Type definitions -----------------------------------------------------*/
+
+/**
+ * Parameters of the image row a kernel works on.
+ */
+typedef struct {
+  double xmin;        /**< Real part of column 0 */
+  double dx;          /**< Pixel spacing in x direction */
+  double c_real;      /**< Real part of the view center, for double-double */
+  double c_real_lo;   /**< Low part of c_real */
+  double half;        /**< Column of the view center */
+  double c_imag;      /**< Imaginary part of the row */
+  double c_imag_lo;   /**< Low part of c_imag, for double-double */
+  const int *columns; /**< Column of pixel x, or NULL if that is x */
+  int maxiter;        /**< Maximum number of iterations */
+  int periodicity;    /**< Non-zero to stop iterating cyclic orbits */
+} row_t;
+
+/**
+ * Signature shared by all escape-time kernels. A kernel computes the
+ * iteration counts of the pixels @p from (inclusive) to @p to (exclusive)
+ * of a single image row and stores them at @p iters[0 .. to - from - 1].
+ * If row->columns is set, pixel x is in column row->columns[x] instead.
+ * Points inside the main cardioid or the period-2 bulb are not iterated,
+ * and orbits found to be cyclic stop early; both are set to maxiter. If
+ * @p smooth is not NULL, the continuous iteration counts (see smoothCount())
+ * are stored there as well. The work done is added to @p stats.
+ */
+typedef void (*kernel_fn_t)(const row_t *row, int from, int to, int *iters,
+                            float *smooth, mandel_stats_t *stats);
+
+/**
+ * Double-double number: the unevaluated sum hi + lo with |lo| <= ulp(hi)/2.
+ */
+typedef struct {
+  double hi;
+  double lo;
+} dd_t;
+
+/*--- Implementation -------------------------------------------------------*/
+
+/**
+ * Exact sum of two doubles (Knuth's two-sum).
+ */
+static inline dd_t ddTwoSum(double a, double b) {
+  dd_t r;
+  double v;
+
+  r.hi = a + b;
+  v = r.hi - a;
+  r.lo = (a - (r.hi - v)) + (b - v);
+  return r;
+}
+
+/**
+ * Exact sum of two doubles with |a| >= |b|.
+ */
+static inline dd_t ddQuickTwoSum(double a, double b) {
+  dd_t r;
+
+  r.hi = a + b;
+  r.lo = b - (r.hi - a);
+  return r;
+}
+
+/**
+ * Exact product of two doubles (Dekker's two-product). Relies on the
+ * Makefile disabling FMA contraction.
+ */
+static inline dd_t ddTwoProd(double a, double b) {
+  const double split = 134217729.0; // 2^27 + 1
+  double t = split * a;
+  double a_hi = t - (t - a);
+  double a_lo = a - a_hi;
+  double b_hi;
+  double b_lo;
+  dd_t r;
+
+  t = split * b;
+  b_hi = t - (t - b);
+  b_lo = b - b_hi;
+  r.hi = a * b;
+  r.lo = (((a_hi * b_hi) - r.hi) + (a_hi * b_lo) + (a_lo * b_hi)) +
+         (a_lo * b_lo);
+  return r;
+}
+
+/**
+ * Sum of two double-doubles.
+ */
+static inline dd_t ddAdd(dd_t a, dd_t b) {
+  dd_t s = ddTwoSum(a.hi, b.hi);
+  dd_t t = ddTwoSum(a.lo, b.lo);
+
+  s = ddQuickTwoSum(s.hi, s.lo + t.hi);
+  return ddQuickTwoSum(s.hi, s.lo + t.lo);
+}
+
+/**
+ * Difference of two double-doubles.
+ */
+static inline dd_t ddSub(dd_t a, dd_t b) {
+  b.hi = -b.hi;
+  b.lo = -b.lo;
+  return ddAdd(a, b);
+}
+
+/**
+ * Product of two double-doubles, dropping the lo * lo term.
+ */
+static inline dd_t ddMul(dd_t a, dd_t b) {
+  dd_t p = ddTwoProd(a.hi, b.hi);
+
+  return ddQuickTwoSum(p.hi, p.lo + ((a.hi * b.lo) + (a.lo * b.hi)));
+}
+
+/**
+ * Quotient of two double-doubles, by long division with three partial
+ * quotients.
+ */
+static inline dd_t ddDiv(dd_t a, dd_t b) {
+  dd_t q = {a.hi / b.hi, 0.0};
+  dd_t r = ddSub(a, ddMul(b, q));
+  dd_t q2 = {r.hi / b.hi, 0.0};
+  dd_t q3;
+
+  r = ddSub(r, ddMul(b, q2));
+  q3.hi = r.hi / b.hi;
+  q3.lo = 0.0;
+  q = ddQuickTwoSum(q.hi, q2.hi);
+  return ddAdd(q, q3);
+}
+
+/**
+ * Reads the decimal @p text (sign, digits with an optional point and an
+ * optional exponent) into a double-double. Anything else that strtod()
+ * accepts is read by strtod(), in double precision.
+ */
+static dd_t ddFromString(const char *text) {
+  const dd_t ten = {10.0, 0.0};
+  const char *s = text;
+  dd_t r = {0.0, 0.0};
+  dd_t power = {1.0, 0.0};
+  int negative = 0;
+  int point = 0;
+  int any = 0;
+  int digits = 0;
+  long exponent = 0;
+  long i;
+
+  if (*s == '+' || *s == '-')
+    negative = *s++ == '-';
+  for (; (*s >= '0' && *s <= '9') || (*s == '.' && !point); ++s) {
+    if (*s == '.') {
+      point = 1;
+    } else if (digits < DD_DIGITS) {
+      dd_t digit = {*s - '0', 0.0};
+
+      r = ddAdd(ddMul(r, ten), digit);
+      digits += r.hi != 0.0;
+      exponent -= point;
+      any = 1;
+    } else {
+      exponent += !point;
+    }
+  }
+  if (any && (*s == 'e' || *s == 'E')) {
+    char *end;
+    long e = strtol(s + 1, &end, 10);
+
+    if (end != s + 1 && labs(e) <= DBL_MAX_10_EXP) {
+      exponent += e;
+      s = end;
+    }
+  }
+  if (!any || *s != '\0' || labs(exponent) > DBL_MAX_10_EXP) {
+    r.hi = strtod(text, NULL);
+    r.lo = 0.0;
+    return r;
+  }
+
+  for (i = 0; i < labs(exponent); ++i)
+    power = ddMul(power, ten);
+  r = exponent < 0 ? ddDiv(r, power) : ddMul(r, power);
+  if (negative) {
+    r.hi = -r.hi;
+    r.lo = -r.lo;
+  }
+  return r;
+}
+
+/**
+ * Checks analytically whether a point lies inside the main cardioid or the
+ * period-2 bulb, both of which are part of the Mandelbrot set.
+ *
+ * @param  c_real  Real part of the point
+ * @param  c_imag  Imaginary part of the point
+ *
+ * @return Non-zero if the point is inside the cardioid or the bulb
+ */
+static inline int isInterior(double c_real, double c_imag) {
+  double x = c_real - 0.25;
+  double y2 = c_imag * c_imag;
+  double q = (x * x) + y2;
+
+  /* Main cardioid */
+  if (q * (q + x) <= 0.25 * y2)
+    return 1;
+
+  /* Period-2 bulb: disc of radius 1/4 around -1 */
+  x = c_real + 1.0;
+  return (x * x) + y2 <= 0.0625;
+}
+
+/**
+ * isInterior() in single precision, for the float kernels.
+ */
+static inline int isInteriorFloat(float c_real, float c_imag) {
+  float x = c_real - 0.25f;
+  float y2 = c_imag * c_imag;
+  float q = (x * x) + y2;
+
+  if (q * (q + x) <= 0.25f * y2)
+    return 1;
+
+  x = c_real + 1.0f;
+  return (x * x) + y2 <= 0.0625f;
+}
+
+/**
+ * Returns the continuous iteration count of a pixel, which removes the
+ * bands of the integer counts: iter + 1 - log2(log2(|z|)) for an orbit that
+ * escaped after @p iter iterations with |z|^2 = @p norm, maxiter for
+ * bounded pixels.
+ */
+static inline float smoothCount(const row_t *row, int iter, double norm) {
+  if (iter == row->maxiter)
+    return (float)row->maxiter;
+  return (float)(iter + 1 - log2(0.5 * log2(norm)));
+}
+
+/**
+ * Iterates the Mandelbrot equation for a single point of the complex plane.
+ *
+ * With periodicity checking enabled, the orbit is compared against a
+ * checkpoint that is moved to the current point whenever the iteration
+ * count reaches a power of two (Brent's cycle detection). Once the orbit
+ * returns to within PERIODICITY_EPS of the checkpoint, it is cyclic and
+ * therefore bounded, so the iteration stops.
+ *
+ * @param  c_real  Real part of the point
+ * @param  c_imag  Imaginary part of the point
+ * @param  row     Row parameters
+ * @param  norm    Output: |z|^2 after the last iteration
+ * @param  stats   Statistics to add the iterations to
+ *
+ * @return Number of iterations until the orbit escaped, or maxiter
+ */
+static inline int escapeScalar(double c_real, double c_imag,
+                               const row_t *row, double *norm,
+                               mandel_stats_t *stats) {
+  int iter = 0;
+  int check_at = 1;
+  double z_real = 0.0;
+  double z_imag = 0.0;
+  double z_norm = 0.0;
+  double check_real = 0.0;
+  double check_imag = 0.0;
+
+  /* Check whether recursive Mandelbrot equation remains bounded */
+  while (z_norm < 4.0 && iter < row->maxiter) {
+    double z2_real = (z_real * z_real) - (z_imag * z_imag);
+    double z2_imag = (z_real * z_imag) + (z_imag * z_real);
+
+    z_real = z2_real + c_real;
+    z_imag = z2_imag + c_imag;
+    z_norm = (z_real * z_real) + (z_imag * z_imag);
+
+    ++iter;
+
+    if (row->periodicity && z_norm < 4.0) {
+      if (fabs(z_real - check_real) < PERIODICITY_EPS &&
+          fabs(z_imag - check_imag) < PERIODICITY_EPS) {
+        stats->iterations += iter;
+        stats->periodic++;
+        return row->maxiter;
+      }
+      if (iter == check_at) {
+        check_real = z_real;
+        check_imag = z_imag;
+        check_at <<= 1;
+      }
+    }
+  }
+
+  stats->iterations += iter;
+  *norm = z_norm;
+  return iter;
+}
+
+/**
+ * Portable kernel, one pixel at a time.
+ */
+static void kernelRowScalar(const row_t *row, int from, int to, int *iters,
+                            float *smooth, mandel_stats_t *stats) {
+  int x;
+
+  for (x = from; x < to; ++x) {
+    int column = row->columns ? row->columns[x] : x;
+    double c_real = row->xmin + (column * row->dx);
+    double norm = 0.0;
+
+    if (isInterior(c_real, row->c_imag)) {
+      iters[x - from] = row->maxiter;
+      stats->interior++;
+    } else {
+      iters[x - from] = escapeScalar(c_real, row->c_imag, row, &norm, stats);
+    }
+    if (smooth)
+      smooth[x - from] = smoothCount(row, iters[x - from], norm);
+  }
+}
+
+/**
+ * escapeScalar() in single precision.
+ */
+static inline int escapeFloat(float c_real, float c_imag, const row_t *row,
+                              float *norm, mandel_stats_t *stats) {
+  int iter = 0;
+  int check_at = 1;
+  float z_real = 0.0f;
+  float z_imag = 0.0f;
+  float z_norm = 0.0f;
+  float check_real = 0.0f;
+  float check_imag = 0.0f;
+
+  while (z_norm < 4.0f && iter < row->maxiter) {
+    float z2_real = (z_real * z_real) - (z_imag * z_imag);
+    float z2_imag = (z_real * z_imag) + (z_imag * z_real);
+
+    z_real = z2_real + c_real;
+    z_imag = z2_imag + c_imag;
+    z_norm = (z_real * z_real) + (z_imag * z_imag);
+
+    ++iter;
+
+    if (row->periodicity && z_norm < 4.0f) {
+      if (fabsf(z_real - check_real) < PERIODICITY_EPS_FLOAT &&
+          fabsf(z_imag - check_imag) < PERIODICITY_EPS_FLOAT) {
+        stats->iterations += iter;
+        stats->periodic++;
+        return row->maxiter;
+      }
+      if (iter == check_at) {
+        check_real = z_real;
+        check_imag = z_imag;
+        check_at <<= 1;
+      }
+    }
+  }
+
+  stats->iterations += iter;
+  *norm = z_norm;
+  return iter;
+}
+
+/**
+ * Portable single-precision kernel, one pixel at a time.
+ */
+static void kernelRowFloat(const row_t *row, int from, int to, int *iters,
+                           float *smooth, mandel_stats_t *stats) {
+  const float xmin = (float)row->xmin;
+  const float dx = (float)row->dx;
+  const float c_imag = (float)row->c_imag;
+  int x;
+
+  for (x = from; x < to; ++x) {
+    int column = row->columns ? row->columns[x] : x;
+    float c_real = xmin + ((float)column * dx);
+    float norm = 0.0f;
+
+    if (isInteriorFloat(c_real, c_imag)) {
+      iters[x - from] = row->maxiter;
+      stats->interior++;
+    } else {
+      iters[x - from] = escapeFloat(c_real, c_imag, row, &norm, stats);
+    }
+    if (smooth)
+      smooth[x - from] = smoothCount(row, iters[x - from], norm);
+  }
+}
+
+/**
+ * Iterates a point given in double-double precision, see escapeScalar().
+ * Only the escape test uses the high parts alone.
+ */
+static int escapeDD(dd_t c_real, dd_t c_imag, const row_t *row,
+                    double *norm, mandel_stats_t *stats) {
+  int iter = 0;
+  int check_at = 1;
+  dd_t z_real = {0.0, 0.0};
+  dd_t z_imag = {0.0, 0.0};
+  dd_t check_real = {0.0, 0.0};
+  dd_t check_imag = {0.0, 0.0};
+  double z_norm = 0.0;
+
+  while (z_norm < 4.0 && iter < row->maxiter) {
+    dd_t z2_real = ddSub(ddMul(z_real, z_real), ddMul(z_imag, z_imag));
+    dd_t z2_imag = ddMul(z_real, z_imag);
+
+    z2_imag.hi *= 2.0;
+    z2_imag.lo *= 2.0;
+    z_real = ddAdd(z2_real, c_real);
+    z_imag = ddAdd(z2_imag, c_imag);
+    z_norm = (z_real.hi * z_real.hi) + (z_imag.hi * z_imag.hi);
+
+    ++iter;
+
+    if (row->periodicity && z_norm < 4.0) {
+      if (fabs(ddSub(z_real, check_real).hi) < PERIODICITY_EPS_DD &&
+          fabs(ddSub(z_imag, check_imag).hi) < PERIODICITY_EPS_DD) {
+        stats->iterations += iter;
+        stats->periodic++;
+        return row->maxiter;
+      }
+      if (iter == check_at) {
+        check_real = z_real;
+        check_imag = z_imag;
+        check_at <<= 1;
+      }
+    }
+  }
+
+  stats->iterations += iter;
+  *norm = z_norm;
+  return iter;
+}
+
+/**
+ * Double-double kernel, one pixel at a time. The points are the view center
+ * plus (x - half) * dx in double-double, so the pixels stay apart even when
+ * dx is far below the resolution of double at the center, and lie where the
+ * decimal center puts them. The cardioid and bulb test is left out, as
+ * in double it would misjudge the points close to their border; cyclic
+ * orbits still stop early.
+ */
+static void kernelRowDD(const row_t *row, int from, int to, int *iters,
+                        float *smooth, mandel_stats_t *stats) {
+  const dd_t center = {row->c_real, row->c_real_lo};
+  const dd_t c_imag = {row->c_imag, row->c_imag_lo};
+  int x;
+
+  for (x = from; x < to; ++x) {
+    int column = row->columns ? row->columns[x] : x;
+    dd_t c_real = ddAdd(center, ddTwoProd(column - row->half, row->dx));
+    double norm = 0.0;
+
+    iters[x - from] = escapeDD(c_real, c_imag, row, &norm, stats);
+    if (smooth)
+      smooth[x - from] = smoothCount(row, iters[x - from], norm);
+  }
+}
+
+#ifdef KERNEL_X86
+
+/**
+ * AVX2 kernel, iterating 4 adjacent columns in lock step. Lanes that have
+ * escaped are masked out of the iteration count but keep being iterated
+ * until all 4 lanes are done. The arithmetic is the very same sequence of
+ * operations as in escapeScalar() (the Makefile disables FMA contraction),
+ * so the results are bit-identical to the scalar kernel. All lanes start
+ * together, so they share the checkpoint schedule of the periodicity check.
+ */
+__attribute__((target("avx2"))) static void
+kernelRowAVX2(const row_t *row, int from, int to, int *iters, float *smooth,
+              mandel_stats_t *stats) {
+  const __m256d four = _mm256_set1_pd(4.0);
+  const __m256d eps = _mm256_set1_pd(PERIODICITY_EPS);
+  const __m256d sign = _mm256_set1_pd(-0.0);
+  const __m256d all = _mm256_castsi256_pd(_mm256_set1_epi64x(-1));
+  const __m256d ci = _mm256_set1_pd(row->c_imag);
+  const __m256d y2 = _mm256_set1_pd(row->c_imag * row->c_imag);
+  const __m128i lane = _mm_setr_epi32(0, 1, 2, 3);
+  int x;
+
+  for (x = from; x + 4 <= to; x += 4) {
+    __m128i column =
+        row->columns ? _mm_loadu_si128((const __m128i *)(row->columns + x))
+                     : _mm_add_epi32(_mm_set1_epi32(x), lane);
+    __m256d cr =
+        _mm256_add_pd(_mm256_set1_pd(row->xmin),
+                      _mm256_mul_pd(_mm256_cvtepi32_pd(column),
+                                    _mm256_set1_pd(row->dx)));
+    __m256d z_real = _mm256_setzero_pd();
+    __m256d z_imag = _mm256_setzero_pd();
+    __m256d check_real = _mm256_setzero_pd();
+    __m256d check_imag = _mm256_setzero_pd();
+    __m256d escape_norm = _mm256_setzero_pd();
+    __m256d active;
+    __m256d bounded;
+    __m256i count = _mm256_setzero_si256();
+    long long lanes[4];
+    double norms[4];
+    int check_at = 1;
+    int iter;
+    int i;
+
+    /* Cardioid and bulb test, see isInterior() */
+    {
+      __m256d shifted = _mm256_sub_pd(cr, _mm256_set1_pd(0.25));
+      __m256d q = _mm256_add_pd(_mm256_mul_pd(shifted, shifted), y2);
+      __m256d cardioid =
+          _mm256_cmp_pd(_mm256_mul_pd(q, _mm256_add_pd(q, shifted)),
+                        _mm256_mul_pd(_mm256_set1_pd(0.25), y2), _CMP_LE_OQ);
+      __m256d bulb;
+
+      shifted = _mm256_add_pd(cr, _mm256_set1_pd(1.0));
+      bulb = _mm256_cmp_pd(
+          _mm256_add_pd(_mm256_mul_pd(shifted, shifted), y2),
+          _mm256_set1_pd(0.0625), _CMP_LE_OQ);
+      bounded = _mm256_or_pd(cardioid, bulb);
+      stats->interior += __builtin_popcount(_mm256_movemask_pd(bounded));
+
+      /* Interior lanes start out finished */
+      active = _mm256_andnot_pd(bounded, all);
+    }
+
+    for (iter = 0; iter < row->maxiter && _mm256_movemask_pd(active); ++iter) {
+      __m256d z2_real = _mm256_sub_pd(_mm256_mul_pd(z_real, z_real),
+                                      _mm256_mul_pd(z_imag, z_imag));
+      __m256d z2_imag = _mm256_add_pd(_mm256_mul_pd(z_real, z_imag),
+                                      _mm256_mul_pd(z_imag, z_real));
+      __m256d z_norm;
+      __m256d inside;
+
+      z_real = _mm256_add_pd(z2_real, cr);
+      z_imag = _mm256_add_pd(z2_imag, ci);
+      z_norm = _mm256_add_pd(_mm256_mul_pd(z_real, z_real),
+                             _mm256_mul_pd(z_imag, z_imag));
+
+      /* Active lanes are all ones, i.e. -1: subtracting counts them */
+      count = _mm256_sub_epi64(count, _mm256_castpd_si256(active));
+      inside = _mm256_cmp_pd(z_norm, four, _CMP_LT_OQ);
+      // keep |z|^2 of the lanes escaping now for the smooth count
+      escape_norm = _mm256_blendv_pd(escape_norm, z_norm,
+                                     _mm256_andnot_pd(inside, active));
+      active = _mm256_and_pd(active, inside);
+
+      if (row->periodicity) {
+        __m256d cyclic = _mm256_and_pd(
+            _mm256_cmp_pd(
+                _mm256_andnot_pd(sign, _mm256_sub_pd(z_real, check_real)), eps,
+                _CMP_LT_OQ),
+            _mm256_cmp_pd(
+                _mm256_andnot_pd(sign, _mm256_sub_pd(z_imag, check_imag)), eps,
+                _CMP_LT_OQ));
+
+        cyclic = _mm256_and_pd(cyclic, active);
+        stats->periodic += __builtin_popcount(_mm256_movemask_pd(cyclic));
+        bounded = _mm256_or_pd(bounded, cyclic);
+        active = _mm256_andnot_pd(cyclic, active);
+        if (iter + 1 == check_at) {
+          check_real = z_real;
+          check_imag = z_imag;
+          check_at <<= 1;
+        }
+      }
+    }
+
+    _mm256_storeu_si256((__m256i *)lanes, count);
+    _mm256_storeu_pd(norms, escape_norm);
+    for (i = 0; i < 4; ++i) {
+      stats->iterations += lanes[i];
+      iters[x + i - from] =
+          (_mm256_movemask_pd(bounded) >> i) & 1 ? row->maxiter : (int)lanes[i];
+      if (smooth)
+        smooth[x + i - from] = smoothCount(row, iters[x + i - from], norms[i]);
+    }
+  }
+
+  kernelRowScalar(row, x, to, iters + (x - from),
+                  smooth ? smooth + (x - from) : NULL, stats);
+}
+
+/**
+ * AVX-512 kernel, iterating 8 adjacent columns in lock step using mask
+ * registers for the escaped lanes (see kernelRowAVX2()).
+ */
+__attribute__((target("avx512f"))) static void
+kernelRowAVX512(const row_t *row, int from, int to, int *iters,
+                float *smooth, mandel_stats_t *stats) {
+  const __m512d four = _mm512_set1_pd(4.0);
+  const __m512d eps = _mm512_set1_pd(PERIODICITY_EPS);
+  const __m512d ci = _mm512_set1_pd(row->c_imag);
+  const __m512d y2 = _mm512_set1_pd(row->c_imag * row->c_imag);
+  const __m512i one = _mm512_set1_epi64(1);
+  const __m256i lane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+  int x;
+
+  for (x = from; x + 8 <= to; x += 8) {
+    __m256i column =
+        row->columns
+            ? _mm256_loadu_si256((const __m256i *)(row->columns + x))
+            : _mm256_add_epi32(_mm256_set1_epi32(x), lane);
+    __m512d cr =
+        _mm512_add_pd(_mm512_set1_pd(row->xmin),
+                      _mm512_mul_pd(_mm512_cvtepi32_pd(column),
+                                    _mm512_set1_pd(row->dx)));
+    __m512d z_real = _mm512_setzero_pd();
+    __m512d z_imag = _mm512_setzero_pd();
+    __m512d check_real = _mm512_setzero_pd();
+    __m512d check_imag = _mm512_setzero_pd();
+    __m512d escape_norm = _mm512_setzero_pd();
+    __m512i count = _mm512_setzero_si512();
+    __mmask8 active;
+    __mmask8 bounded;
+    int check_at = 1;
+    int iter;
+
+    /* Cardioid and bulb test, see isInterior() */
+    {
+      __m512d shifted = _mm512_sub_pd(cr, _mm512_set1_pd(0.25));
+      __m512d q = _mm512_add_pd(_mm512_mul_pd(shifted, shifted), y2);
+
+      bounded = _mm512_cmp_pd_mask(
+          _mm512_mul_pd(q, _mm512_add_pd(q, shifted)),
+          _mm512_mul_pd(_mm512_set1_pd(0.25), y2), _CMP_LE_OQ);
+      shifted = _mm512_add_pd(cr, _mm512_set1_pd(1.0));
+      bounded |= _mm512_cmp_pd_mask(
+          _mm512_add_pd(_mm512_mul_pd(shifted, shifted), y2),
+          _mm512_set1_pd(0.0625), _CMP_LE_OQ);
+      stats->interior += __builtin_popcount(bounded);
+
+      /* Interior lanes start out finished */
+      active = (__mmask8)~bounded;
+    }
+
+    for (iter = 0; iter < row->maxiter && active; ++iter) {
+      __m512d z2_real = _mm512_sub_pd(_mm512_mul_pd(z_real, z_real),
+                                      _mm512_mul_pd(z_imag, z_imag));
+      __m512d z2_imag = _mm512_add_pd(_mm512_mul_pd(z_real, z_imag),
+                                      _mm512_mul_pd(z_imag, z_real));
+      __m512d z_norm;
+      __mmask8 inside;
+
+      z_real = _mm512_add_pd(z2_real, cr);
+      z_imag = _mm512_add_pd(z2_imag, ci);
+      z_norm = _mm512_add_pd(_mm512_mul_pd(z_real, z_real),
+                             _mm512_mul_pd(z_imag, z_imag));
+
+      count = _mm512_mask_add_epi64(count, active, count, one);
+      inside = _mm512_mask_cmp_pd_mask(active, z_norm, four, _CMP_LT_OQ);
+      // keep |z|^2 of the lanes escaping now for the smooth count
+      escape_norm =
+          _mm512_mask_mov_pd(escape_norm, active & (__mmask8)~inside, z_norm);
+      active = inside;
+
+      if (row->periodicity) {
+        __mmask8 cyclic = _mm512_mask_cmp_pd_mask(
+            active, _mm512_abs_pd(_mm512_sub_pd(z_real, check_real)), eps,
+            _CMP_LT_OQ);
+
+        cyclic = _mm512_mask_cmp_pd_mask(
+            cyclic, _mm512_abs_pd(_mm512_sub_pd(z_imag, check_imag)), eps,
+            _CMP_LT_OQ);
+        stats->periodic += __builtin_popcount(cyclic);
+        bounded |= cyclic;
+        active &= (__mmask8)~cyclic;
+        if (iter + 1 == check_at) {
+          check_real = z_real;
+          check_imag = z_imag;
+          check_at <<= 1;
+        }
+      }
+    }
+
+    stats->iterations += _mm512_reduce_add_epi64(count);
+    _mm256_storeu_si256(
+        (__m256i *)(iters + x - from),
+        _mm512_cvtepi64_epi32(_mm512_mask_mov_epi64(
+            count, bounded, _mm512_set1_epi64(row->maxiter))));
+    if (smooth) {
+      double norms[8];
+      int i;
+
+      _mm512_storeu_pd(norms, escape_norm);
+      for (i = 0; i < 8; ++i)
+        smooth[x + i - from] = smoothCount(row, iters[x + i - from], norms[i]);
+    }
+  }
+
+  kernelRowScalar(row, x, to, iters + (x - from),
+                  smooth ? smooth + (x - from) : NULL, stats);
+}
+
+/**
+ * Single-precision AVX2 kernel, iterating 8 adjacent columns in lock step
+ * (see kernelRowAVX2()). Bit-identical to kernelRowFloat().
+ */
+__attribute__((target("avx2"))) static void
+kernelRowFloatAVX2(const row_t *row, int from, int to, int *iters,
+                   float *smooth, mandel_stats_t *stats) {
+  const __m256 four = _mm256_set1_ps(4.0f);
+  const __m256 eps = _mm256_set1_ps(PERIODICITY_EPS_FLOAT);
+  const __m256 sign = _mm256_set1_ps(-0.0f);
+  const __m256 all = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+  const __m256 ci = _mm256_set1_ps((float)row->c_imag);
+  const __m256 y2 = _mm256_mul_ps(ci, ci);
+  const __m256i lane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+  int x;
+
+  for (x = from; x + 8 <= to; x += 8) {
+    __m256i column =
+        row->columns
+            ? _mm256_loadu_si256((const __m256i *)(row->columns + x))
+            : _mm256_add_epi32(_mm256_set1_epi32(x), lane);
+    __m256 cr =
+        _mm256_add_ps(_mm256_set1_ps((float)row->xmin),
+                      _mm256_mul_ps(_mm256_cvtepi32_ps(column),
+                                    _mm256_set1_ps((float)row->dx)));
+    __m256 z_real = _mm256_setzero_ps();
+    __m256 z_imag = _mm256_setzero_ps();
+    __m256 check_real = _mm256_setzero_ps();
+    __m256 check_imag = _mm256_setzero_ps();
+    __m256 escape_norm = _mm256_setzero_ps();
+    __m256 active;
+    __m256 bounded;
+    __m256i count = _mm256_setzero_si256();
+    int lanes[8];
+    float norms[8];
+    int check_at = 1;
+    int iter;
+    int i;
+
+    /* Cardioid and bulb test, see isInteriorFloat() */
+    {
+      __m256 shifted = _mm256_sub_ps(cr, _mm256_set1_ps(0.25f));
+      __m256 q = _mm256_add_ps(_mm256_mul_ps(shifted, shifted), y2);
+      __m256 cardioid =
+          _mm256_cmp_ps(_mm256_mul_ps(q, _mm256_add_ps(q, shifted)),
+                        _mm256_mul_ps(_mm256_set1_ps(0.25f), y2), _CMP_LE_OQ);
+      __m256 bulb;
+
+      shifted = _mm256_add_ps(cr, _mm256_set1_ps(1.0f));
+      bulb = _mm256_cmp_ps(_mm256_add_ps(_mm256_mul_ps(shifted, shifted), y2),
+                           _mm256_set1_ps(0.0625f), _CMP_LE_OQ);
+      bounded = _mm256_or_ps(cardioid, bulb);
+      stats->interior += __builtin_popcount(_mm256_movemask_ps(bounded));
+
+      /* Interior lanes start out finished */
+      active = _mm256_andnot_ps(bounded, all);
+    }
+
+    for (iter = 0; iter < row->maxiter && _mm256_movemask_ps(active); ++iter) {
+      __m256 z2_real = _mm256_sub_ps(_mm256_mul_ps(z_real, z_real),
+                                     _mm256_mul_ps(z_imag, z_imag));
+      __m256 z2_imag = _mm256_add_ps(_mm256_mul_ps(z_real, z_imag),
+                                     _mm256_mul_ps(z_imag, z_real));
+      __m256 z_norm;
+      __m256 inside;
+
+      z_real = _mm256_add_ps(z2_real, cr);
+      z_imag = _mm256_add_ps(z2_imag, ci);
+      z_norm = _mm256_add_ps(_mm256_mul_ps(z_real, z_real),
+                             _mm256_mul_ps(z_imag, z_imag));
+
+      /* Active lanes are all ones, i.e. -1: subtracting counts them */
+      count = _mm256_sub_epi32(count, _mm256_castps_si256(active));
+      inside = _mm256_cmp_ps(z_norm, four, _CMP_LT_OQ);
+      escape_norm = _mm256_blendv_ps(escape_norm, z_norm,
+                                     _mm256_andnot_ps(inside, active));
+      active = _mm256_and_ps(active, inside);
+
+      if (row->periodicity) {
+        __m256 cyclic = _mm256_and_ps(
+            _mm256_cmp_ps(
+                _mm256_andnot_ps(sign, _mm256_sub_ps(z_real, check_real)), eps,
+                _CMP_LT_OQ),
+            _mm256_cmp_ps(
+                _mm256_andnot_ps(sign, _mm256_sub_ps(z_imag, check_imag)), eps,
+                _CMP_LT_OQ));
+
+        cyclic = _mm256_and_ps(cyclic, active);
+        stats->periodic += __builtin_popcount(_mm256_movemask_ps(cyclic));
+        bounded = _mm256_or_ps(bounded, cyclic);
+        active = _mm256_andnot_ps(cyclic, active);
+        if (iter + 1 == check_at) {
+          check_real = z_real;
+          check_imag = z_imag;
+          check_at <<= 1;
+        }
+      }
+    }
+
+    _mm256_storeu_si256((__m256i *)lanes, count);
+    _mm256_storeu_ps(norms, escape_norm);
+    for (i = 0; i < 8; ++i) {
+      stats->iterations += lanes[i];
+      iters[x + i - from] =
+          (_mm256_movemask_ps(bounded) >> i) & 1 ? row->maxiter : lanes[i];
+      if (smooth)
+        smooth[x + i - from] = smoothCount(row, iters[x + i - from], norms[i]);
+    }
+  }
+
+  kernelRowFloat(row, x, to, iters + (x - from),
+                 smooth ? smooth + (x - from) : NULL, stats);
+}
+
+/**
+ * Single-precision AVX-512 kernel, iterating 16 adjacent columns in lock
+ * step (see kernelRowAVX512()). Bit-identical to kernelRowFloat().
+ */
+__attribute__((target("avx512f"))) static void
+kernelRowFloatAVX512(const row_t *row, int from, int to, int *iters,
+                     float *smooth, mandel_stats_t *stats) {
+  const __m512 four = _mm512_set1_ps(4.0f);
+  const __m512 eps = _mm512_set1_ps(PERIODICITY_EPS_FLOAT);
+  const __m512 ci = _mm512_set1_ps((float)row->c_imag);
+  const __m512 y2 = _mm512_mul_ps(ci, ci);
+  const __m512i one = _mm512_set1_epi32(1);
+  const __m512i lane = _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10,
+                                         11, 12, 13, 14, 15);
+  int x;
+
+  for (x = from; x + 16 <= to; x += 16) {
+    __m512i column = row->columns
+                         ? _mm512_loadu_si512(row->columns + x)
+                         : _mm512_add_epi32(_mm512_set1_epi32(x), lane);
+    __m512 cr =
+        _mm512_add_ps(_mm512_set1_ps((float)row->xmin),
+                      _mm512_mul_ps(_mm512_cvtepi32_ps(column),
+                                    _mm512_set1_ps((float)row->dx)));
+    __m512 z_real = _mm512_setzero_ps();
+    __m512 z_imag = _mm512_setzero_ps();
+    __m512 check_real = _mm512_setzero_ps();
+    __m512 check_imag = _mm512_setzero_ps();
+    __m512 escape_norm = _mm512_setzero_ps();
+    __m512i count = _mm512_setzero_si512();
+    __mmask16 active;
+    __mmask16 bounded;
+    int check_at = 1;
+    int iter;
+
+    /* Cardioid and bulb test, see isInteriorFloat() */
+    {
+      __m512 shifted = _mm512_sub_ps(cr, _mm512_set1_ps(0.25f));
+      __m512 q = _mm512_add_ps(_mm512_mul_ps(shifted, shifted), y2);
+
+      bounded = _mm512_cmp_ps_mask(
+          _mm512_mul_ps(q, _mm512_add_ps(q, shifted)),
+          _mm512_mul_ps(_mm512_set1_ps(0.25f), y2), _CMP_LE_OQ);
+      shifted = _mm512_add_ps(cr, _mm512_set1_ps(1.0f));
+      bounded |= _mm512_cmp_ps_mask(
+          _mm512_add_ps(_mm512_mul_ps(shifted, shifted), y2),
+          _mm512_set1_ps(0.0625f), _CMP_LE_OQ);
+      stats->interior += __builtin_popcount(bounded);
+
+      /* Interior lanes start out finished */
+      active = (__mmask16)~bounded;
+    }
+
+    for (iter = 0; iter < row->maxiter && active; ++iter) {
+      __m512 z2_real = _mm512_sub_ps(_mm512_mul_ps(z_real, z_real),
+                                     _mm512_mul_ps(z_imag, z_imag));
+      __m512 z2_imag = _mm512_add_ps(_mm512_mul_ps(z_real, z_imag),
+                                     _mm512_mul_ps(z_imag, z_real));
+      __m512 z_norm;
+      __mmask16 inside;
+
+      z_real = _mm512_add_ps(z2_real, cr);
+      z_imag = _mm512_add_ps(z2_imag, ci);
+      z_norm = _mm512_add_ps(_mm512_mul_ps(z_real, z_real),
+                             _mm512_mul_ps(z_imag, z_imag));
+
+      count = _mm512_mask_add_epi32(count, active, count, one);
+      inside = _mm512_mask_cmp_ps_mask(active, z_norm, four, _CMP_LT_OQ);
+      escape_norm =
+          _mm512_mask_mov_ps(escape_norm, active & (__mmask16)~inside, z_norm);
+      active = inside;
+
+      if (row->periodicity) {
+        __mmask16 cyclic = _mm512_mask_cmp_ps_mask(
+            active, _mm512_abs_ps(_mm512_sub_ps(z_real, check_real)), eps,
+            _CMP_LT_OQ);
+
+        cyclic = _mm512_mask_cmp_ps_mask(
+            cyclic, _mm512_abs_ps(_mm512_sub_ps(z_imag, check_imag)), eps,
+            _CMP_LT_OQ);
+        stats->periodic += __builtin_popcount(cyclic);
+        bounded |= cyclic;
+        active &= (__mmask16)~cyclic;
+        if (iter + 1 == check_at) {
+          check_real = z_real;
+          check_imag = z_imag;
+          check_at <<= 1;
+        }
+      }
+    }
+
+    stats->iterations += _mm512_reduce_add_epi32(count);
+    _mm512_storeu_si512(
+        iters + x - from,
+        _mm512_mask_mov_epi32(count, bounded, _mm512_set1_epi32(row->maxiter)));
+    if (smooth) {
+      float norms[16];
+      int i;
+
+      _mm512_storeu_ps(norms, escape_norm);
+      for (i = 0; i < 16; ++i)
+        smooth[x + i - from] = smoothCount(row, iters[x + i - from], norms[i]);
+    }
+  }
+
+  kernelRowFloat(row, x, to, iters + (x - from),
+                 smooth ? smooth + (x - from) : NULL, stats);
+}
+
+#endif /* KERNEL_X86 */
+
+/** Kernels selected by kernelInit(), one per precision_t */
+static kernel_fn_t kernels[] = {kernelRowFloat, kernelRowScalar, kernelRowDD};
+
+/** Names of the precision_t values, also accepted by MANDEL_PRECISION */
+static const char *precision_names[] = {"float", "double", "double-double"};
+
+/** Relative rounding error of the precision_t values */
+static const double precision_epsilon[] = {FLT_EPSILON, DBL_EPSILON,
+                                           DBL_EPSILON * DBL_EPSILON};
+
+/**
+ * Selects the widest escape-time kernels supported by the CPU. The
+ * environment variable MANDEL_KERNEL ("scalar", "avx2" or "avx512") may be
+ * used to force a narrower kernel, e.g. for validation runs. The
+ * double-double kernel is always scalar.
+ *
+ * @return Name of the selected kernel
+ */
+const char *kernelInit(void) {
+  const char *request = getenv("MANDEL_KERNEL");
+
+  if (request && strcmp(request, "scalar") != 0 &&
+      strcmp(request, "avx2") != 0 && strcmp(request, "avx512") != 0) {
+    fprintf(stderr, "Unknown kernel \"%s\", using default\n", request);
+    request = NULL;
+  }
+
+#ifdef KERNEL_X86
+  __builtin_cpu_init();
+  if ((!request || strcmp(request, "avx512") == 0) &&
+      __builtin_cpu_supports("avx512f")) {
+    kernels[PRECISION_FLOAT] = kernelRowFloatAVX512;
+    kernels[PRECISION_DOUBLE] = kernelRowAVX512;
+    return "avx512";
+  }
+  if ((!request || strcmp(request, "scalar") != 0) &&
+      __builtin_cpu_supports("avx2")) {
+    kernels[PRECISION_FLOAT] = kernelRowFloatAVX2;
+    kernels[PRECISION_DOUBLE] = kernelRowAVX2;
+    return "avx2";
+  }
+#endif
+
+  kernels[PRECISION_FLOAT] = kernelRowFloat;
+  kernels[PRECISION_DOUBLE] = kernelRowScalar;
+  return "scalar";
+}
+
+/**
+ * Pixel spacing of the view in @p data: square pixels data->width wide
+ * divided among the columns if the width is set, as by perturbRender(),
+ * else the section xmin to xmax by ymin to ymax.
+ */
+static void viewSpacing(const mandel_t *data, double *dx, double *dy) {
+  if (data->width > 0.0) {
+    *dx = data->width / data->columns;
+    *dy = *dx;
+  } else {
+    *dx = (data->xmax - data->xmin) / data->columns;
+    *dy = (data->ymax - data->ymin) / data->rows;
+  }
+}
+
+/**
+ * Sets the center of the view in @p data (view_real and view_imag) in
+ * double-double, from the decimal data->center_real and center_imag where
+ * given, else from the middle of the section. The double-double kernel
+ * places its pixels around it, as xmin and the others are rounded to double
+ * and far apart from the center of a deep view. Has to be called whenever
+ * the view changes.
+ *
+ * @param  data  Mandelbrot parameters, with the view set
+ */
+void kernelCenter(mandel_t *data) {
+  dd_t real = ddTwoSum(data->xmin, data->xmax);
+  dd_t imag = ddTwoSum(data->ymin, data->ymax);
+
+  real.hi /= 2;
+  real.lo /= 2;
+  imag.hi /= 2;
+  imag.lo /= 2;
+  if (data->center_real)
+    real = ddFromString(data->center_real);
+  if (data->center_imag)
+    imag = ddFromString(data->center_imag);
+  data->view_real = real.hi;
+  data->view_real_lo = real.lo;
+  data->view_imag = imag.hi;
+  data->view_imag_lo = imag.lo;
+}
+
+/**
+ * Selects the narrowest arithmetic that resolves the pixels of the view in
+ * @p data and stores it in data->precision: the pixel spacing has to exceed
+ * the rounding error at the largest coordinate of the view (or of the orbit,
+ * which reaches 2) by PRECISION_MARGIN. The environment variable
+ * MANDEL_PRECISION ("float", "double" or "double-double") forces a
+ * precision, e.g. for validation runs. Warns on rank 0 if even
+ * double-double is not precise enough, as all processes come to the same
+ * result.
+ *
+ * @param  data  Mandelbrot parameters, with the view set
+ *
+ * @return Name of the selected precision
+ */
+const char *kernelPrecision(mandel_t *data) {
+  const char *request = getenv("MANDEL_PRECISION");
+  double dx;
+  double dy;
+  double spacing;
+  double scale = 2.0;
+  int precision;
+  int rank;
+
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  viewSpacing(data, &dx, &dy);
+  spacing = dx < dy ? dx : dy;
+  scale = fmax(scale, fmax(fabs(data->xmin), fabs(data->xmax)));
+  scale = fmax(scale, fmax(fabs(data->ymin), fabs(data->ymax)));
+
+  for (precision = PRECISION_FLOAT; precision < PRECISION_DD; ++precision)
+    if (spacing >= scale * precision_epsilon[precision] * PRECISION_MARGIN)
+      break;
+  if (rank == 0 && precision == PRECISION_DD &&
+      spacing < scale * precision_epsilon[PRECISION_DD] * PRECISION_MARGIN)
+    fprintf(stderr, "Warning: view too deep for double-double precision\n");
+
+  if (request) {
+    int i;
+
+    for (i = PRECISION_FLOAT; i <= PRECISION_DD; ++i)
+      if (strcmp(request, precision_names[i]) == 0)
+        break;
+    if (i > PRECISION_DD) {
+      if (rank == 0)
+        fprintf(stderr, "Unknown precision \"%s\", using default\n",
+                request);
+    } else {
+      precision = i;
+    }
+  }
+
+  data->precision = (precision_t)precision;
+  return precision_names[precision];
+}
+
+/**
+ * Sets up the parameters of row @p y of the image described by @p data.
+ */
+static void rowInit(const mandel_t *data, int y, row_t *row) {
+  row->xmin = data->xmin;
+  row->dx = (data->xmax - data->xmin) / data->columns;
+  row->c_imag = data->ymin + (y * ((data->ymax - data->ymin) / data->rows));
+  row->c_imag_lo = 0.0;
+  row->c_real = 0.0;
+  row->c_real_lo = 0.0;
+  row->half = 0.0;
+  if (data->precision == PRECISION_DD) {
+    // around the exact center, see kernelCenter()
+    dd_t center = {data->view_imag, data->view_imag_lo};
+    dd_t c_imag;
+    double dy;
+
+    viewSpacing(data, &row->dx, &dy);
+    c_imag = ddAdd(center, ddTwoProd(y - data->rows / 2.0, dy));
+    row->c_real = data->view_real;
+    row->c_real_lo = data->view_real_lo;
+    row->half = data->columns / 2.0;
+    row->c_imag = c_imag.hi;
+    row->c_imag_lo = c_imag.lo;
+  }
+  row->columns = NULL;
+  row->maxiter = data->maxiter;
+  row->periodicity = data->periodicity;
+}
+
+/**
+ * Calculates the iteration counts of the pixels @p from (inclusive) to
+ * @p to (exclusive) in row @p y of the image described by @p data.
+ *
+ * @param  data   Mandelbrot parameters
+ * @param  y      Image row
+ * @param  from   First column
+ * @param  to     Column after the last one
+ * @param  iters  Output: iteration count per pixel, @p iters[0] is @p from
+ * @param  smooth Output: continuous iteration counts, or NULL if not needed
+ * @param  stats  Statistics to add the pixels and iterations to
+ */
+void kernelRow(const mandel_t *data, int y, int from, int to, int *iters,
+               float *smooth, mandel_stats_t *stats) {
+  row_t row;
+
+  rowInit(data, y, &row);
+  kernels[data->precision](&row, from, to, iters, smooth, stats);
+  stats->pixels += to - from;
+}
+
+/**
+ * Like kernelRow(), but for the @p count pixels in the columns
+ * @p columns[0 .. count - 1] of row @p y, which need not be adjacent. They
+ * are still iterated in lock step by the vector kernels.
+ *
+ * @param  data     Mandelbrot parameters
+ * @param  y        Image row
+ * @param  columns  Columns of the pixels
+ * @param  count    Number of pixels
+ * @param  iters    Output: iteration count per pixel
+ * @param  smooth   Output: continuous iteration counts, or NULL if not needed
+ * @param  stats    Statistics to add the pixels and iterations to
+ */
+void kernelColumns(const mandel_t *data, int y, const int *columns,
+                   int count, int *iters, float *smooth,
+                   mandel_stats_t *stats) {
+  row_t row;
+
+  rowInit(data, y, &row);
+  row.columns = columns;
+  kernels[data->precision](&row, 0, count, iters, smooth, stats);
+  stats->pixels += count;
+}
@@ -1,32 +1,531 @@
+#include <getopt.h>
+#include <omp.h>
 #include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include <mpi.h>
 
+#include "checkpoint.h"
+#include "kernel.h"
 #include "mandelbrot.h"
+#include "report.h"
+#include "schedule.h"
+#include "trace.h"
+#include "utility.h"
 
-/** Width of output image in pixels */
+/** Width of output image in pixels (default) */
 #define IMG_WIDTH 4096
 
-/** Height of output image in pixels */
+/** Height of output image in pixels (default) */
 #define IMG_HEIGHT 4096
 
 /** Maximum number of iterations to perform */
 #define MAX_ITER 5000
 
+/** Longest name of the image of a progressive pass */
+#define PASS_NAME 4096
+
 /**
- * Main program.
+ * Prints the command line usage of the program.
+ *
+ * @param  program  Name of the executable
+ */
+static void usage(const char *program) {
+  fprintf(stderr,
+          "Usage: %s [options]\n"
+          "  -s, --schedule=KIND[,CHUNK]\n"
+          "      OpenMP schedule: static, dynamic or guided (default: "
+          "OMP_SCHEDULE)\n"
+          "  -t, --threads=N\n"
+          "      OpenMP threads per process (default: OMP_NUM_THREADS)\n"
+          "  -e, --engine=ENGINE\n"
+          "      pixel (every pixel on its own, default) or rect "
+          "(Mariani-Silver)\n"
+          "  -m, --maxiter=N\n"
+          "      Maximum number of iterations (default: 5000)\n"
+          "  -x, --center-re=DECIMAL\n"
+          "  -y, --center-im=DECIMAL\n"
+          "      Center of the view\n"
+          "  -w, --width=WIDTH\n"
+          "      Width of the view in the complex plane\n"
+          "  -P, --no-periodicity\n"
+          "      Iterate cyclic orbits up to the maximum number of iterations\n"
+          "  -p, --palette=NAME\n"
+          "      Colors of the iteration counts: hsv (default) or gray\n"
+          "  -S, --smooth\n"
+          "      Color continuous iteration counts instead of integer ones\n"
+          "  -d, --dist=DIST\n"
+          "      master (rank 0 hands out work items, default), steal\n"
+          "      (every rank computes and steals items from the others) or\n"
+          "      node (rank 0 hands out chunks of items to one process per\n"
+          "      node, which hands out their items within the node)\n"
+          "  -i, --items=KIND\n"
+          "      Work items the image is cut into: rows (default) or tiles\n"
+          "  -b, --item-size=N\n"
+          "      Rows per batch or tile edge length (default: 1 row, 64 pixel "
+          "tiles)\n"
+          "  -F, --fixed\n"
+          "      One batch or tile per work item instead of guided item sizes\n"
+          "  -W, --write-buffers=N\n"
+          "      Items whose pixels are written while the next ones are\n"
+          "      computed (default: 2)\n"
+          "  -O, --output=NAME\n"
+          "      Output image (default: output.ppm), compressed if the name\n"
+          "      ends in .png or .qoi (needs row items)\n"
+          "  -g, --size=WIDTHxHEIGHT\n"
+          "      Size of the image in pixels (default: 4096x4096)\n"
+          "  -M, --memory=MB\n"
+          "      Memory for the pixels of a work item; larger items are\n"
+          "      computed and written in bands that fit (default: no limit)\n"
+          "  -R, --progressive\n"
+          "      Render in passes of rising resolution and write the image\n"
+          "      of each pass but the last (needs the pixel engine and PPM)\n"
+          "  -C, --checkpoint\n"
+          "      Keep a map of the finished cells next to the output, e.g.\n"
+          "      output.ppm.done, until the image is complete (needs PPM)\n"
+          "  -r, --resume\n"
+          "      Continue the image of an interrupted --checkpoint run with\n"
+          "      the same options, with any number of processes\n"
+          "  -j, --report=FILE\n"
+          "      Append the timings of the run to FILE as a line of JSON\n"
+          "      (see bench.sh)\n"
+          "  -T, --trace=FILE\n"
+          "      Write a trace of all processes for Perfetto or\n"
+          "      chrome://tracing to FILE (needs a build with make TRACE=1)\n"
+          "  -h, --help\n"
+          "      Print this help\n",
+          program);
+}
+
+/**
+ * Sets the OpenMP runtime schedule from a string of the form KIND[,CHUNK].
+ *
+ * @param  arg  Schedule description, e.g. "dynamic,4"
+ *
+ * @return 0 on success, -1 if @p arg is not a valid schedule
+ */
+static int parseSchedule(const char *arg) {
+  const char *comma = strchr(arg, ',');
+  size_t length = comma ? (size_t)(comma - arg) : strlen(arg);
+  omp_sched_t kind;
+  int chunk = 0;
+
+  if (length == 6 && strncmp(arg, "static", length) == 0)
+    kind = omp_sched_static;
+  else if (length == 7 && strncmp(arg, "dynamic", length) == 0)
+    kind = omp_sched_dynamic;
+  else if (length == 6 && strncmp(arg, "guided", length) == 0)
+    kind = omp_sched_guided;
+  else
+    return -1;
+
+  if (comma) {
+    chunk = atoi(comma + 1);
+    if (chunk < 1)
+      return -1;
+  }
+
+  omp_set_schedule(kind, chunk);
+  return 0;
+}
+
+/**
+ * Parses the command line options. All processes parse the same arguments,
+ * so they all come to the same result; only rank 0 reports errors.
+ *
+ * @param  argc  Number of arguments
+ * @param  argv  Argument vector
+ * @param  rank  Rank of the calling process
+ * @param  data     Mandelbrot parameters to set from the options
+ * @param  palette  Output: colors given with --palette
+ *
+ * @return 0 to continue, 1 if the program should exit successfully, -1 on
+ *         invalid options
  */
+static int parseOptions(int argc, char *argv[], int rank, mandel_t *data,
+                        palette_kind_t *palette) {
+  static const struct option options[] = {
+      {"schedule", required_argument, NULL, 's'},
+      {"threads", required_argument, NULL, 't'},
+      {"engine", required_argument, NULL, 'e'},
+      {"maxiter", required_argument, NULL, 'm'},
+      {"center-re", required_argument, NULL, 'x'},
+      {"center-im", required_argument, NULL, 'y'},
+      {"width", required_argument, NULL, 'w'},
+      {"no-periodicity", no_argument, NULL, 'P'},
+      {"palette", required_argument, NULL, 'p'},
+      {"smooth", no_argument, NULL, 'S'},
+      {"dist", required_argument, NULL, 'd'},
+      {"items", required_argument, NULL, 'i'},
+      {"item-size", required_argument, NULL, 'b'},
+      {"fixed", no_argument, NULL, 'F'},
+      {"write-buffers", required_argument, NULL, 'W'},
+      {"output", required_argument, NULL, 'O'},
+      {"size", required_argument, NULL, 'g'},
+      {"memory", required_argument, NULL, 'M'},
+      {"progressive", no_argument, NULL, 'R'},
+      {"checkpoint", no_argument, NULL, 'C'},
+      {"resume", no_argument, NULL, 'r'},
+      {"report", required_argument, NULL, 'j'},
+      {"trace", required_argument, NULL, 'T'},
+      {"help", no_argument, NULL, 'h'},
+      {NULL, 0, NULL, 0}};
+  int opt;
+
+  opterr = (rank == 0);
+  while ((opt = getopt_long(argc, argv,
+                            "s:t:e:m:x:y:w:Pp:Sd:i:b:FW:O:g:M:RCrj:T:h",
+                            options, NULL)) != -1) {
+    switch (opt) {
+    case 's':
+      if (parseSchedule(optarg) != 0) {
+        if (rank == 0)
+          fprintf(stderr, "Invalid schedule \"%s\"!\n", optarg);
+        return -1;
+      }
+      break;
+    case 't':
+      if (atoi(optarg) < 1) {
+        if (rank == 0)
+          fprintf(stderr, "Invalid number of threads \"%s\"!\n", optarg);
+        return -1;
+      }
+      omp_set_num_threads(atoi(optarg));
+      break;
+    case 'e':
+      if (strcmp(optarg, "pixel") == 0) {
+        data->engine = ENGINE_PIXEL;
+      } else if (strcmp(optarg, "rect") == 0) {
+        data->engine = ENGINE_RECT;
+      } else {
+        if (rank == 0)
+          fprintf(stderr, "Invalid engine \"%s\"!\n", optarg);
+        return -1;
+      }
+      break;
+    case 'm':
+      if (atoi(optarg) < 1) {
+        if (rank == 0)
+          fprintf(stderr, "Invalid number of iterations \"%s\"!\n", optarg);
+        return -1;
+      }
+      data->maxiter = atoi(optarg);
+      break;
+    case 'x':
+    case 'y': {
+      char *end;
+
+      strtod(optarg, &end);
+      if (end == optarg || *end != '\0') {
+        if (rank == 0)
+          fprintf(stderr, "Invalid center \"%s\"!\n", optarg);
+        return -1;
+      }
+      if (opt == 'x')
+        data->center_real = optarg;
+      else
+        data->center_imag = optarg;
+      break;
+    }
+    case 'w':
+      data->width = atof(optarg);
+      if (data->width <= 0.0) {
+        if (rank == 0)
+          fprintf(stderr, "Invalid width \"%s\"!\n", optarg);
+        return -1;
+      }
+      break;
+    case 'P':
+      data->periodicity = 0;
+      break;
+    case 'p':
+      if (paletteParse(optarg, palette) != 0) {
+        if (rank == 0)
+          fprintf(stderr, "Invalid palette \"%s\"!\n", optarg);
+        return -1;
+      }
+      break;
+    case 'S':
+      data->smooth = 1;
+      break;
+    case 'd':
+      if (strcmp(optarg, "master") == 0) {
+        data->dist = DIST_MASTER;
+      } else if (strcmp(optarg, "steal") == 0) {
+        data->dist = DIST_STEAL;
+      } else if (strcmp(optarg, "node") == 0) {
+        data->dist = DIST_NODE;
+      } else {
+        if (rank == 0)
+          fprintf(stderr, "Invalid distribution \"%s\"!\n", optarg);
+        return -1;
+      }
+      break;
+    case 'i':
+      if (strcmp(optarg, "rows") == 0) {
+        data->items = ITEMS_ROWS;
+      } else if (strcmp(optarg, "tiles") == 0) {
+        data->items = ITEMS_TILES;
+      } else {
+        if (rank == 0)
+          fprintf(stderr, "Invalid kind of work items \"%s\"!\n", optarg);
+        return -1;
+      }
+      break;
+    case 'b':
+      if (atoi(optarg) < 1) {
+        if (rank == 0)
+          fprintf(stderr, "Invalid item size \"%s\"!\n", optarg);
+        return -1;
+      }
+      data->item_size = atoi(optarg);
+      break;
+    case 'F':
+      data->guided = 0;
+      break;
+    case 'W':
+      if (atoi(optarg) < 1) {
+        if (rank == 0)
+          fprintf(stderr, "Invalid number of write buffers \"%s\"!\n",
+                  optarg);
+        return -1;
+      }
+      data->write_depth = atoi(optarg);
+      break;
+    case 'O':
+      data->output = optarg;
+      break;
+    case 'g': {
+      char end;
+
+      if (sscanf(optarg, "%dx%d%c", &data->columns, &data->rows, &end) !=
+              2 ||
+          data->columns < 1 || data->rows < 1) {
+        if (rank == 0)
+          fprintf(stderr, "Invalid image size \"%s\"!\n", optarg);
+        return -1;
+      }
+      break;
+    }
+    case 'M':
+      if (atoll(optarg) < 1) {
+        if (rank == 0)
+          fprintf(stderr, "Invalid memory size \"%s\"!\n", optarg);
+        return -1;
+      }
+      data->memory = (size_t)atoll(optarg) << 20;
+      break;
+    case 'R':
+      data->progressive = 1;
+      break;
+    case 'C':
+      data->checkpoint = 1;
+      break;
+    case 'r':
+      data->checkpoint = 1;
+      data->resume = 1;
+      break;
+    case 'j':
+      data->report = optarg;
+      break;
+    case 'T':
+#ifndef MANDEL_TRACE
+      if (rank == 0)
+        fprintf(stderr, "Tracing needs a build with \"make TRACE=1\"!\n");
+      return -1;
+#endif
+      data->trace = optarg;
+      break;
+    case 'h':
+      if (rank == 0)
+        usage(argv[0]);
+      return 1;
+    default:
+      if (rank == 0)
+        usage(argv[0]);
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
 void master_main(mandel_t *data);
 
-int main() {
-  MPI_Init(NULL, NULL);
+/**
+ * Computes the image of data->step (see mandel_t) into the file
+ * @p filename: rank 0 writes the header, then all processes open the file
+ * and compute and write the pixels. A resumed image (see data->resume) is
+ * opened as it is, and only its missing cells are computed. The time spent
+ * on finishing the output is added to data->io_time. Has to be called by
+ * all processes.
+ *
+ * @return 0 on success, -1 if the file could not be created
+ */
+static int renderImage(mandel_t *data, const char *filename) {
+  int columns = (data->columns + data->step - 1) / data->step;
+  int rows = (data->rows + data->step - 1) / data->step;
+  int rank;
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+  unsigned char header[CODEC_MAX_HEADER];
+  if (rank == 0 && !data->resume) { // only rank 0 writes the header
+    FILE *fp;
+    /* Open output file */
+    fp = fopen(filename, "w");
+    if (!fp) {
+      fprintf(stderr, "Could not create output file \"%s\"!\n", filename);
+      return -1;
+    }
+
+    /* Write the header of the format */
+    fwrite(header, 1, codecHeader(data->codec, columns, rows, header), fp);
+    fclose(fp);
+  }
+
+  // barrier to ensure that file was properly closed on rank 0 before any
+  // process may open it
+  TRACE_START(barrier_start);
+  MPI_Barrier(MPI_COMM_WORLD);
+  TRACE_STOP(TRACE_BARRIER, barrier_start, 0);
+
+  // with a completion map, every process syncs the image on its own (see
+  // checkpointFlush()), and MPI_File_sync() is collective over the handle
+  TRACE_START(open_start);
+  MPI_File_open(data->checkpoint ? MPI_COMM_SELF : MPI_COMM_WORLD, filename,
+                data->resume ? MPI_MODE_WRONLY
+                             : MPI_MODE_WRONLY | MPI_MODE_EXCL |
+                                   MPI_MODE_APPEND,
+                MPI_INFO_NULL, &(data->file));
+  TRACE_STOP(TRACE_OPEN, open_start, 0);
+  // the pixels follow the header written above; the size of the file does
+  // not tell where, as the other processes may already be writing pixels
+  data->header_offset = codecHeader(data->codec, columns, rows, header);
+  if (writePoolInit(data) != 0)
+    return -1;
+
+  if (data->dist == DIST_STEAL) { // everybody computes
+    mandelbrotSteal(data);
+  } else if (data->dist == DIST_NODE) { // a master per node
+    mandelbrotNode(data);
+  } else if (rank == 0) { // master
+    master_main(data);
+  } else { // worker
+    mandelbrot(data);
+  }
+  double start_time = MPI_Wtime();
+  TRACE_START(flush_start);
+  writePoolFinish(data);
+  TRACE_STOP(TRACE_FLUSH, flush_start, 0);
+  if (data->codec != CODEC_PPM) {
+    TRACE_START(finish_start);
+    compressedFinish(data);
+    TRACE_STOP(TRACE_FINISH, finish_start, 0);
+  }
+  TRACE_START(close_start);
+  MPI_File_close(&(data->file));
+  TRACE_STOP(TRACE_CLOSE, close_start, 0);
+  data->io_time += MPI_Wtime() - start_time;
+
+  return 0;
+}
+
+/**
+ * Main program.
+ */
+
+int main(int argc, char *argv[]) {
+  // only the main thread of each process calls MPI
+  int provided;
+  MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &provided);
 
   int rank, numprocs;
   MPI_Comm_rank(MPI_COMM_WORLD, &rank);
   MPI_Comm_size(MPI_COMM_WORLD, &numprocs);
 
+  if (provided < MPI_THREAD_FUNNELED && rank == 0) {
+    fprintf(stderr, "Warning: MPI library does not support threads\n");
+  }
+
+  /* Allocate mandelbrot data structure */
+  mandel_t *data = (mandel_t *)malloc(sizeof(mandel_t));
+  if (!data) {
+    fprintf(stderr, "Memory allocation error!\n");
+    return EXIT_FAILURE;
+  }
+
+  /* Defaults of the options */
+  data->periodicity = 1;
+  data->engine = ENGINE_PIXEL;
+  data->smooth = 0;
+  data->dist = DIST_MASTER;
+  data->items = ITEMS_ROWS;
+  data->item_size = 0;
+  data->guided = 1;
+  data->columns = IMG_WIDTH;
+  data->rows = IMG_HEIGHT;
+  data->memory = 0;
+  data->progressive = 0;
+  data->step = 1;
+  data->previous = MPI_FILE_NULL;
+  data->checkpoint = 0;
+  data->resume = 0;
+  data->done = NULL;
+  data->write_depth = 2;
+  data->output = "output.ppm";
+  data->report = NULL;
+  data->trace = NULL;
+  data->maxiter = MAX_ITER;
+  data->center_real = NULL;
+  data->center_imag = NULL;
+  data->width = 0.0;
+
+  palette_kind_t palette = PALETTE_HSV;
+  int status = parseOptions(argc, argv, rank, data, &palette);
+  if (status != 0) {
+    free(data);
+    MPI_Finalize();
+    return status > 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+  if (data->item_size == 0)
+    data->item_size = data->items == ITEMS_TILES ? 64 : 1;
+  data->codec = codecFromName(data->output);
+  data->segments = NULL;
+  data->segment_count = 0;
+  data->segment_capacity = 0;
+  if (data->codec != CODEC_PPM && data->items == ITEMS_TILES) {
+    if (rank == 0)
+      fprintf(stderr, "Compressed output needs row items!\n");
+    free(data);
+    MPI_Finalize();
+    return EXIT_FAILURE;
+  }
+  if (data->progressive &&
+      (data->engine != ENGINE_PIXEL || data->codec != CODEC_PPM)) {
+    if (rank == 0)
+      fprintf(stderr,
+              "Progressive rendering needs the pixel engine and PPM output!\n");
+    free(data);
+    MPI_Finalize();
+    return EXIT_FAILURE;
+  }
+  if (data->checkpoint && (data->codec != CODEC_PPM || data->progressive)) {
+    if (rank == 0)
+      fprintf(stderr, "Checkpoints need PPM output of a single pass!\n");
+    free(data);
+    MPI_Finalize();
+    return EXIT_FAILURE;
+  }
+
+  /* Select the escape-time kernel for this CPU */
+  const char *kernel = kernelInit();
+  if (rank == 0) {
+    printf("Escape-time kernel: %s\n", kernel);
+    printf("OpenMP threads per process: %d\n", omp_get_max_threads());
+  }
+
   /* Parameters */
 
   // teil der komplexen ebene, der betrachtet werden soll:  (globale werte)
@@ -35,13 +534,20 @@ int main() {
   double xmax = -1.172643;
   double ymax = -0.296321;
 
-  char *filename = "output.ppm";
+  // a given center (and width) replaces the section above, keeping the
+  // aspect ratio of the image
+  if (data->center_real || data->center_imag || data->width > 0.0) {
+    double width = data->width > 0.0 ? data->width : xmax - xmin;
+    double height = width * data->rows / data->columns;
+    double center_real = data->center_real ? atof(data->center_real)
+                                           : (xmin + xmax) / 2;
+    double center_imag = data->center_imag ? atof(data->center_imag)
+                                           : (ymin + ymax) / 2;
 
-  /* Allocate mandelbrot data structure */
-  mandel_t *data = (mandel_t *)malloc(sizeof(mandel_t));
-  if (!data) {
-    fprintf(stderr, "Memory allocation error!\n");
-    return EXIT_FAILURE;
+    xmin = center_real - width / 2;
+    xmax = center_real + width / 2;
+    ymin = center_imag - height / 2;
+    ymax = center_imag + height / 2;
   }
 
   /* Initialize data */
@@ -49,69 +555,163 @@ int main() {
   data->ymin = ymin;
   data->xmax = xmax;
   data->ymax = ymax;
-  data->maxiter = MAX_ITER;
-  data->columns = IMG_WIDTH;
-  data->rows = IMG_HEIGHT;
+  kernelCenter(data);
+  data->palette = paletteCreate(palette, data->maxiter);
+  if (!data->palette) {
+    return EXIT_FAILURE;
+  }
+  data->stats.pixels = 0;
+  data->stats.iterations = 0;
+  data->stats.interior = 0;
+  data->stats.periodic = 0;
+  data->stats.filled = 0;
+  data->compute_time = 0.0;
+  data->io_time = 0.0;
 
-  if (rank == 0) { // only rank 0 writes the header
-    FILE *fp;
-    /* Open output file */
-    fp = fopen(filename, "w");
-    if (!fp) {
-      fprintf(stderr, "Could not create output file \"%s\"!\n", filename);
-      return EXIT_FAILURE;
-    }
+  /* Select the arithmetic for the depth of the view */
+  report_t report;
+  report.kernel = kernel;
+  report.precision = kernelPrecision(data);
+  if (rank == 0)
+    printf("Precision: %s\n", report.precision);
 
-    /* Write PPM header */
-    fprintf(fp, "P6\n%d %d\n255\n", IMG_WIDTH, IMG_HEIGHT);
-    fclose(fp);
+  if (data->trace && traceInit() != 0)
+    return EXIT_FAILURE;
+
+  // the first process of every node is its sub-master, see mandelbrotNode()
+  data->node = MPI_COMM_NULL;
+  data->leaders = MPI_COMM_NULL;
+  int local = rank;
+  int local_size = numprocs;
+  if (data->dist == DIST_NODE) {
+    int nodes;
+
+    MPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, rank,
+                        MPI_INFO_NULL, &(data->node));
+    MPI_Comm_rank(data->node, &local);
+    MPI_Comm_size(data->node, &local_size);
+    MPI_Comm_split(MPI_COMM_WORLD, local == 0 ? 0 : MPI_UNDEFINED, rank,
+                   &(data->leaders));
+    if (rank == 0) {
+      MPI_Comm_size(data->leaders, &nodes);
+      printf("Nodes: %d\n", nodes);
+    }
   }
 
-  // barrier to ensure that file was properly closed on rank 0 before any
-  // process may open it
-  MPI_Barrier(MPI_COMM_WORLD);
+  if (data->checkpoint && checkpointOpen(data) != 0) {
+    paletteFree(data->palette);
+    free(data);
+    MPI_Finalize();
+    return EXIT_FAILURE;
+  }
 
-  MPI_File_open(MPI_COMM_WORLD, filename,
-                MPI_MODE_WRONLY | MPI_MODE_EXCL | MPI_MODE_APPEND,
-                MPI_INFO_NULL, &(data->file));
+  double run_time = MPI_Wtime();
+  if (data->progressive) {
+    // the coarse passes go to images of their own, every pass reads the
+    // samples that it shares with the one before from its image
+    char filename[PASS_NAME];
 
-  if (rank == 0) { // master
-    master_main(data);
-  } else { // worker
-    mandelbrot(data);
+    for (data->step = PROGRESSIVE_FIRST; data->step > 1; data->step /= 2) {
+      passFileName(data->output, data->step, filename, sizeof(filename));
+      if (renderImage(data, filename) != 0)
+        return EXIT_FAILURE;
+      if (data->previous != MPI_FILE_NULL)
+        MPI_File_close(&(data->previous));
+      MPI_File_open(MPI_COMM_WORLD, filename, MPI_MODE_RDONLY, MPI_INFO_NULL,
+                    &(data->previous));
+      data->previous_offset = data->header_offset;
+      if (rank == 0)
+        printf("Pass 1/%d: %2.6f seconds, preview %s\n", data->step,
+               MPI_Wtime() - run_time, filename);
+    }
   }
+  if (renderImage(data, data->output) != 0)
+    return EXIT_FAILURE;
+  if (data->previous != MPI_FILE_NULL)
+    MPI_File_close(&(data->previous));
+  if (data->checkpoint)
+    checkpointClose(data);
+  report.io = data->io_time;
+  report.total = MPI_Wtime() - run_time;
+  report.compute = data->compute_time;
+  // with workers, a master only computes while none of them is waiting
+  report.worker = data->dist == DIST_STEAL || local != 0 || local_size == 1;
+  statsReport(&data->stats);
 
-  MPI_File_close(&(data->file));
+  status = 0;
+  if (data->report)
+    status = reportWrite(data->report, data, &report);
+  if (data->trace && traceWrite(data->trace) != 0)
+    status = -1;
+  paletteFree(data->palette);
+  if (data->node != MPI_COMM_NULL)
+    MPI_Comm_free(&(data->node));
+  if (data->leaders != MPI_COMM_NULL)
+    MPI_Comm_free(&(data->leaders));
   free(data);
 
   MPI_Finalize();
-  return EXIT_SUCCESS;
+  return status == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
+/**
+ * Master: hands out the work items to the workers on request. While no
+ * request is pending, the master computes small items itself; with a single
+ * process it computes the whole image.
+ *
+ * @param  data  Mandelbrot parameters
+ */
 void master_main(mandel_t *data) {
 
   int numprocs;
   MPI_Comm_size(MPI_COMM_WORLD, &numprocs);
+  int workers = numprocs - 1;
+  int stopped = 0;
   int buffer = 0;
+  int pending = 0;
+  double start_time = get_wtime();
 
+  schedule_t schedule;
+  item_t item;
+  MPI_Request request;
   MPI_Status status;
 
-  for (int row = 0; row < data->rows; row++) {
-    MPI_Recv(&buffer, 1, MPI_INT, MPI_ANY_SOURCE, MESSAGE_TAG, MPI_COMM_WORLD,
-             &status);
-    int from = status.MPI_SOURCE;
-    // tell him which row to calculate next
-    buffer = row;
-    MPI_Send(&buffer, 1, MPI_INT, from, MESSAGE_TAG, MPI_COMM_WORLD);
-  }
+  scheduleInit(&schedule, data, numprocs);
+
+  if (workers > 0)
+    MPI_Irecv(&buffer, 1, MPI_INT, MPI_ANY_SOURCE, MESSAGE_TAG,
+              MPI_COMM_WORLD, &request);
+
+  while (stopped < workers) {
+    MPI_Test(&request, &pending, &status);
+    if (!pending && scheduleNext(&schedule, &item, 1)) {
+      // nobody is waiting, compute a single cell in the meantime
+      mandelbrotItem(data, &item);
+      continue;
+    }
+    if (!pending) {
+      TRACE_START(wait_start);
+      MPI_Wait(&request, &status);
+      TRACE_STOP(TRACE_WAIT_WORKER, wait_start, 0);
+    }
 
-  // numprocs -1 iterations as one do not message itself
-  for (int i = 0; i < numprocs - 1; i++) {
-    MPI_Recv(&buffer, 1, MPI_INT, MPI_ANY_SOURCE, MESSAGE_TAG, MPI_COMM_WORLD,
-             &status);
     int from = status.MPI_SOURCE;
-    // tell him to stop
-    buffer = -1;
-    MPI_Send(&buffer, 1, MPI_INT, from, MESSAGE_TAG, MPI_COMM_WORLD);
+    // tell him which item to calculate next, or to stop
+    if (!scheduleNext(&schedule, &item, 0)) {
+      item.x0 = item.y0 = item.x1 = item.y1 = -1;
+      stopped++;
+    }
+    MPI_Send(&item, ITEM_INTS, MPI_INT, from, MESSAGE_TAG, MPI_COMM_WORLD);
+
+    if (stopped < workers)
+      MPI_Irecv(&buffer, 1, MPI_INT, MPI_ANY_SOURCE, MESSAGE_TAG,
+                MPI_COMM_WORLD, &request);
   }
+
+  // without workers the master computes everything
+  while (scheduleNext(&schedule, &item, 0))
+    mandelbrotItem(data, &item);
+
+  printf("Calculation time (master): %2.6f seconds\n",
+         get_wtime() - start_time);
 }
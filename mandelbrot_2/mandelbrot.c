@@ -1,12 +1,620 @@
-#include <math.h>
+#include <limits.h>
+#include <omp.h>
 #include <stdio.h>
 #include <stdlib.h>
 
+#include "checkpoint.h"
+#include "engine.h"
+#include "kernel.h"
 #include "mandelbrot.h"
+#include "schedule.h"
+#include "trace.h"
 #include "utility.h"
 
+/** Edge length of the square blocks of a work item the threads work on */
+#define BLOCK_SIZE 64
+
 /*--- Implementation -------------------------------------------------------*/
 
+/**
+ * Allocates the pool of data->write_depth item buffers. The buffers grow
+ * with the items they are given.
+ *
+ * @param  data  Mandelbrot parameters
+ *
+ * @return 0 on success, -1 if out of memory
+ */
+int writePoolInit(mandel_t *data) {
+  int i;
+
+  data->buffers =
+      (write_buffer_t *)calloc(data->write_depth, sizeof(write_buffer_t));
+  data->next_buffer = 0;
+  if (!data->buffers) {
+    fprintf(stderr, "Memory allocation error!\n");
+    return -1;
+  }
+  for (i = 0; i < data->write_depth; ++i)
+    data->buffers[i].finished.y0 = -1;
+  return 0;
+}
+
+/**
+ * Waits for the writes of a buffer of the pool and, with a completion map,
+ * marks the item they finished (see checkpointMark()).
+ */
+static void waitBuffer(mandel_t *data, write_buffer_t *buffer) {
+  MPI_Waitall(buffer->count, buffer->requests, MPI_STATUSES_IGNORE);
+  buffer->count = 0;
+  if (data->done && buffer->finished.y0 != -1)
+    checkpointMark(data, &buffer->finished);
+  buffer->finished.y0 = -1;
+}
+
+/**
+ * Waits for all writes still in flight and releases the pool of item
+ * buffers. Has to be called before the output file is closed. The buffers
+ * are waited for in the order they were taken, like in takeBuffer(), so
+ * the items are finished in order; with a completion map, all of them are
+ * written to it (see checkpointFlush()).
+ *
+ * @param  data  Mandelbrot parameters
+ */
+void writePoolFinish(mandel_t *data) {
+  int i;
+
+  for (i = 0; i < data->write_depth; ++i) {
+    write_buffer_t *buffer =
+        &data->buffers[(data->next_buffer + i) % data->write_depth];
+
+    waitBuffer(data, buffer);
+    free(buffer->pixels);
+    free(buffer->requests);
+  }
+  if (data->done)
+    checkpointFlush(data);
+  free(data->buffers);
+  data->buffers = NULL;
+}
+
+/**
+ * Takes the next buffer of the pool, in round-robin order, for an item of
+ * @p size bytes in @p rows rows. The buffer is only handed out once the
+ * writes of the item it held before have completed.
+ *
+ * @return The buffer, or NULL if out of memory
+ */
+static write_buffer_t *takeBuffer(mandel_t *data, size_t size, int rows) {
+  write_buffer_t *buffer = &data->buffers[data->next_buffer];
+
+  data->next_buffer = (data->next_buffer + 1) % data->write_depth;
+
+  waitBuffer(data, buffer);
+
+  if (buffer->size < size) {
+    char *pixels = (char *)realloc(buffer->pixels, size);
+
+    if (!pixels)
+      return NULL;
+    buffer->pixels = pixels;
+    buffer->size = size;
+  }
+  if (buffer->capacity < rows) {
+    MPI_Request *requests = (MPI_Request *)realloc(
+        buffer->requests, rows * sizeof(MPI_Request));
+
+    if (!requests)
+      return NULL;
+    buffer->requests = requests;
+    buffer->capacity = rows;
+  }
+
+  return buffer;
+}
+
+/**
+ * Compresses the full rows of a work item (see compressRows()) and keeps
+ * them in data->segments, see compressedFinish().
+ *
+ * @param  data    Mandelbrot parameters
+ * @param  item    Work item of full rows
+ * @param  pixels  RGB pixels of the item
+ */
+static void compressItem(mandel_t *data, const item_t *item,
+                         const char *pixels) {
+  item_segment_t *segment;
+
+  if (data->segment_count == data->segment_capacity) {
+    int capacity = data->segment_capacity ? 2 * data->segment_capacity : 64;
+    item_segment_t *segments = (item_segment_t *)realloc(
+        data->segments, capacity * sizeof(item_segment_t));
+
+    if (!segments) {
+      fprintf(stderr, "Memory allocation error!\n");
+      MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+    }
+    data->segments = segments;
+    data->segment_capacity = capacity;
+  }
+
+  segment = &data->segments[data->segment_count++];
+  segment->y0 = item->y0;
+  if (compressRows(data->codec, (const unsigned char *)pixels,
+                   (size_t)data->columns * 3, 3, data->columns,
+                   item->y1 - item->y0, &segment->segment) != 0) {
+    fprintf(stderr, "Memory allocation error!\n");
+    MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+  }
+}
+
+/**
+ * Compares two work items by their first row, for qsort().
+ */
+static int compareRows(const void *a, const void *b) {
+  unsigned long long row_a = *(const unsigned long long *)a;
+  unsigned long long row_b = *(const unsigned long long *)b;
+
+  return (row_a > row_b) - (row_a < row_b);
+}
+
+/**
+ * Compares two compressed items by their first row, for qsort().
+ */
+static int compareSegments(const void *a, const void *b) {
+  int row_a = ((const item_segment_t *)a)->y0;
+  int row_b = ((const item_segment_t *)b)->y0;
+
+  return (row_a > row_b) - (row_a < row_b);
+}
+
+/**
+ * Writes the items compressed by all processes (see compressItem()) to
+ * the output file, which must be a PNG or QOI file.
+ *
+ * The items were computed in any order, so their positions in the file are
+ * only known once the sizes of all of them are: every process gathers the
+ * first row, size and checksum of all items (MPI_Allgatherv()), sorts them
+ * by row and sums up the sizes in front of its own ones, which it finds by
+ * walking through them in the order of their rows as well. Then all processes
+ * write their items in parallel, and rank 0 writes the trailer behind the
+ * last one. Has to be called by all processes; prints the compressed size
+ * on rank 0.
+ *
+ * @param  data  Mandelbrot parameters
+ */
+void compressedFinish(mandel_t *data) {
+  int rank;
+  int numprocs;
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  MPI_Comm_size(MPI_COMM_WORLD, &numprocs);
+
+  int *counts = (int *)malloc(numprocs * sizeof(int));
+  int *displs = (int *)malloc(numprocs * sizeof(int));
+  unsigned long long *local;
+  unsigned long long *all;
+  MPI_Request *requests;
+  MPI_Offset offset;
+  segment_t checksum;
+  unsigned char trailer[CODEC_MAX_HEADER];
+  int trailer_size;
+  int total = 0;
+  int i;
+  int j;
+
+  /* Row, size, checksum and deflated length of every item: 4 values */
+  local = (unsigned long long *)malloc((4 * data->segment_count + 1) *
+                                       sizeof(unsigned long long));
+  requests = (MPI_Request *)malloc((data->segment_count + 1) *
+                                   sizeof(MPI_Request));
+  if (!counts || !displs || !local || !requests) {
+    fprintf(stderr, "Memory allocation error!\n");
+    MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+  }
+  for (i = 0; i < data->segment_count; ++i) {
+    local[4 * i] = data->segments[i].y0;
+    local[4 * i + 1] = data->segments[i].segment.size;
+    local[4 * i + 2] = data->segments[i].segment.adler;
+    local[4 * i + 3] = data->segments[i].segment.length;
+  }
+
+  i = 4 * data->segment_count;
+  MPI_Allgather(&i, 1, MPI_INT, counts, 1, MPI_INT, MPI_COMM_WORLD);
+  for (i = 0; i < numprocs; ++i) {
+    displs[i] = total;
+    total += counts[i];
+  }
+  all = (unsigned long long *)malloc((total + 1) *
+                                     sizeof(unsigned long long));
+  if (!all) {
+    fprintf(stderr, "Memory allocation error!\n");
+    MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+  }
+  MPI_Allgatherv(local, 4 * data->segment_count, MPI_UNSIGNED_LONG_LONG,
+                 all, counts, displs, MPI_UNSIGNED_LONG_LONG, MPI_COMM_WORLD);
+  qsort(all, total / 4, 4 * sizeof(unsigned long long), compareRows);
+  qsort(data->segments, data->segment_count, sizeof(item_segment_t),
+        compareSegments);
+
+  /* Items in the order of their rows, each after the ones above it */
+  segmentInit(&checksum);
+  offset = data->header_offset;
+  j = 0;
+  for (i = 0; i < total / 4; ++i) {
+    segment_t part;
+
+    // the own items come in the same order, every item has its own row
+    if (j < data->segment_count &&
+        (unsigned long long)data->segments[j].y0 == all[4 * i]) {
+      segment_t *own = &data->segments[j].segment;
+
+      MPI_File_iwrite_at(data->file, offset, own->data, (int)own->size,
+                         MPI_BYTE, &requests[j]);
+      j++;
+    }
+
+    segmentInit(&part);
+    part.adler = (uint32_t)all[4 * i + 2];
+    part.length = (size_t)all[4 * i + 3];
+    segmentAppend(&checksum, &part);
+    offset += all[4 * i + 1];
+  }
+
+  trailer_size = codecTrailer(data->codec, checksum.adler, trailer);
+  if (rank == 0) {
+    unsigned char header[CODEC_MAX_HEADER];
+    MPI_Offset size = offset + trailer_size;
+    // the same image as PPM, for comparison
+    double ppm_size = codecHeader(CODEC_PPM, data->columns, data->rows,
+                                  header) +
+                      3.0 * data->columns * data->rows;
+
+    MPI_File_write_at(data->file, offset, trailer, trailer_size, MPI_BYTE,
+                      MPI_STATUS_IGNORE);
+    printf("Compressed to %.1f MB (%.1f%% of PPM)\n", size / 1e6,
+           100.0 * size / ppm_size);
+  }
+  MPI_Waitall(data->segment_count, requests, MPI_STATUSES_IGNORE);
+
+  for (i = 0; i < data->segment_count; ++i)
+    free(data->segments[i].segment.data);
+  free(data->segments);
+  data->segments = NULL;
+  data->segment_count = 0;
+  data->segment_capacity = 0;
+  free(requests);
+  free(all);
+  free(local);
+  free(displs);
+  free(counts);
+}
+
+/**
+ * Returns non-zero if pixel (@p x, @p y) of the image of a progressive pass
+ * is a sample of the previous pass, which it has with even coordinates.
+ */
+static int isSample(const mandel_t *data, int x, int y) {
+  return data->step < PROGRESSIVE_FIRST && x % 2 == 0 && y % 2 == 0;
+}
+
+/**
+ * Computes the block [x0, x1) x [y0, y1) of the image of a progressive pass
+ * like engineRect() does for the whole image, but with the pixel engine.
+ * Pixel (x, y) of the pass is pixel (x, y) * data->step of the image, so
+ * it gets exactly the same count. The samples of the previous pass (see
+ * isSample()) are not computed again but set to -1.
+ */
+static void passBlock(const mandel_t *data, int x0, int y0, int x1, int y1,
+                      int *iters, float *smooth, mandel_stats_t *stats) {
+  int columns[BLOCK_SIZE];
+  int x;
+  int y;
+
+  for (y = y0; y < y1; ++y) {
+    int *row = iters + (y - y0) * BLOCK_SIZE;
+    float *row_smooth = smooth ? smooth + (y - y0) * BLOCK_SIZE : NULL;
+    int count = 0;
+
+    for (x = x0; x < x1; ++x)
+      if (!isSample(data, x, y))
+        columns[count++] = x * data->step;
+    kernelColumns(data, y * data->step, columns, count, row, row_smooth,
+                  stats);
+
+    // spread the counts over the row, from the back, where no count that
+    // is still to be moved can be overwritten
+    for (x = x1 - 1; x >= x0; --x) {
+      if (isSample(data, x, y)) {
+        row[x - x0] = -1;
+      } else {
+        --count;
+        row[x - x0] = row[count];
+        if (row_smooth)
+          row_smooth[x - x0] = row_smooth[count];
+      }
+    }
+  }
+}
+
+/**
+ * Reads the samples of the previous pass within a work item of a
+ * progressive pass from the image of the previous pass: pixel (x / 2,
+ * y / 2) there for every pixel (x, y) of the item with even coordinates.
+ *
+ * @return Packed RGB rows of the samples, from the one of the first even
+ *         row and column of the item on; to be freed by the caller
+ */
+static unsigned char *readSamples(const mandel_t *data, const item_t *item) {
+  int columns = (data->columns + 2 * data->step - 1) / (2 * data->step);
+  int x0 = (item->x0 + 1) / 2;
+  int y0 = (item->y0 + 1) / 2;
+  int width = (item->x1 + 1) / 2 - x0;
+  int height = (item->y1 + 1) / 2 - y0;
+  unsigned char *samples =
+      (unsigned char *)malloc((size_t)width * height * 3 + 1);
+  int y;
+  TRACE_START(trace_start);
+
+  if (!samples) {
+    fprintf(stderr, "Memory allocation error!\n");
+    MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+  }
+  if (width == columns) {
+    // full rows are contiguous in the file
+    MPI_File_read_at(data->previous,
+                     data->previous_offset + (MPI_Offset)y0 * columns * 3,
+                     samples, width * height * 3, MPI_BYTE,
+                     MPI_STATUS_IGNORE);
+  } else {
+    for (y = 0; y < height; ++y)
+      MPI_File_read_at(data->previous,
+                       data->previous_offset +
+                           ((MPI_Offset)(y0 + y) * columns + x0) * 3,
+                       samples + (size_t)y * width * 3, width * 3, MPI_BYTE,
+                       MPI_STATUS_IGNORE);
+  }
+  TRACE_STOP(TRACE_READ, trace_start, (long long)width * height * 3);
+
+  return samples;
+}
+
+/**
+ * Computes the pixels of a work item and starts writing them to the output
+ * file.
+ *
+ * The item is cut into blocks of BLOCK_SIZE x BLOCK_SIZE pixels, which all
+ * OpenMP threads of the calling process compute into one shared buffer
+ * according to the runtime schedule (see omp_set_schedule() and
+ * OMP_SCHEDULE), using the engine selected in data->engine for each block.
+ * The iteration counts are colored with a lookup in data->palette into a
+ * buffer of the write pool (see takeBuffer()). The item is written from
+ * there with nonblocking writes, so the next items can be computed while
+ * it drains; writePoolFinish() waits for the last ones.
+ *
+ * An item whose pixels take more than data->memory bytes (or than a single
+ * write can take) is computed and written in bands of rows that fit, but at
+ * least one row at a time, so huge images only need memory for a band.
+ * The time spent on the pixels and on their output is added to
+ * data->compute_time and data->io_time.
+ *
+ * In a progressive pass (see data->step), the item is part of the image of
+ * the pass, and its blocks are computed by passBlock(); the samples of the
+ * previous pass are read from its image (see readSamples()) instead.
+ *
+ * @param  data      Mandelbrot parameters
+ * @param  item      Work item, or band of one
+ * @param  finished  Item that is finished once @p item is written, if any
+ */
+static void computeItem(mandel_t *data, const item_t *item,
+                        const item_t *finished) {
+  int width = item->x1 - item->x0;
+  int height = item->y1 - item->y0;
+  int columns = (data->columns + data->step - 1) / data->step;
+  int blocks_x = (width + BLOCK_SIZE - 1) / BLOCK_SIZE;
+  int blocks_y = (height + BLOCK_SIZE - 1) / BLOCK_SIZE;
+  int block;
+  int y;
+  size_t limit = INT_MAX;
+
+  /* Items too large for the limit are done band by band */
+  if (data->memory > 0 && data->memory < limit)
+    limit = data->memory;
+  if ((size_t)width * height * 3 > limit) {
+    size_t rows = limit / ((size_t)width * 3);
+    item_t band = *item;
+
+    if (rows < 1)
+      rows = 1;
+    for (band.y0 = item->y0; band.y0 < item->y1; band.y0 = band.y1) {
+      band.y1 = (size_t)(item->y1 - band.y0) > rows ? band.y0 + (int)rows
+                                                    : item->y1;
+      computeItem(data, &band, band.y1 == item->y1 ? finished : NULL);
+    }
+    return;
+  }
+
+  // buffer for the pixels of the item (RGB), free once its last write is done
+  double start_time = MPI_Wtime();
+  TRACE_START(trace_start);
+  write_buffer_t *buffer =
+      takeBuffer(data, sizeof(char) * width * height * 3, height);
+  TRACE_STOP(TRACE_BUFFER, trace_start, 0);
+  data->io_time += MPI_Wtime() - start_time;
+  // iteration counts of the current block, one buffer per thread
+  int *iters =
+      malloc(sizeof(int) * omp_get_max_threads() * BLOCK_SIZE * BLOCK_SIZE);
+  // continuous iteration counts, only if smooth coloring was requested
+  float *smooth =
+      data->smooth ? malloc(sizeof(float) * omp_get_max_threads() *
+                            BLOCK_SIZE * BLOCK_SIZE)
+                   : NULL;
+  if (buffer == NULL || iters == NULL || (data->smooth && smooth == NULL)) {
+    fprintf(stderr, "Memory allocation error!\n");
+    MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+  }
+  char *local_img = buffer->pixels;
+  if (finished)
+    buffer->finished = *finished;
+
+  // samples of the previous pass, and the width of their rows
+  unsigned char *samples = NULL;
+  int samples_width = (item->x1 + 1) / 2 - (item->x0 + 1) / 2;
+  if (data->progressive && data->step < PROGRESSIVE_FIRST) {
+    start_time = MPI_Wtime();
+    samples = readSamples(data, item);
+    data->io_time += MPI_Wtime() - start_time;
+  }
+
+  // The actual calculation
+  start_time = MPI_Wtime();
+  TRACE_START(item_start);
+#pragma omp parallel
+  {
+    mandel_stats_t stats = {0, 0, 0, 0, 0};
+
+#pragma omp for schedule(runtime)
+    for (block = 0; block < blocks_x * blocks_y; ++block) {
+      int x;
+      int x0 = item->x0 + (block % blocks_x) * BLOCK_SIZE;
+      int y0 = item->y0 + (block / blocks_x) * BLOCK_SIZE;
+      int x1 = x0 + BLOCK_SIZE < item->x1 ? x0 + BLOCK_SIZE : item->x1;
+      int y1 = y0 + BLOCK_SIZE < item->y1 ? y0 + BLOCK_SIZE : item->y1;
+      int offset = omp_get_thread_num() * BLOCK_SIZE * BLOCK_SIZE;
+      int *block_iters = iters + offset;
+      float *block_smooth = smooth ? smooth + offset : NULL;
+      TRACE_START(block_start);
+
+      if (data->progressive)
+        passBlock(data, x0, y0, x1, y1, block_iters, block_smooth, &stats);
+      else
+        engineRect(data, x0, y0, x1, y1, block_iters, block_smooth,
+                   BLOCK_SIZE, &stats);
+
+      /* Iterate over all pixels of the block */
+      for (y = y0; y < y1; ++y) {
+        char *local_img_row =
+            local_img + ((y - item->y0) * width - item->x0) * 3;
+
+        for (x = x0; x < x1; ++x) {
+          int i = (y - y0) * BLOCK_SIZE + (x - x0);
+          color_t color;
+
+          if (block_iters[i] < 0) {
+            // a sample of the previous pass, already colored
+            const unsigned char *sample =
+                samples + (((size_t)(y - item->y0) / 2) * samples_width +
+                           (x - item->x0) / 2) *
+                              3;
+
+            local_img_row[x * 3] = sample[0];
+            local_img_row[x * 3 + 1] = sample[1];
+            local_img_row[x * 3 + 2] = sample[2];
+            continue;
+          }
+          color = block_smooth ? paletteSmooth(data->palette, block_smooth[i])
+                               : data->palette->colors[block_iters[i]];
+
+          // set pixel
+          local_img_row[x * 3] = color.red;
+          local_img_row[x * 3 + 1] = color.green;
+          local_img_row[x * 3 + 2] = color.blue;
+        }
+      }
+      TRACE_STOP(TRACE_BLOCK, block_start, block);
+    }
+
+    /* Merge the statistics of all threads */
+#pragma omp atomic
+    data->stats.pixels += stats.pixels;
+#pragma omp atomic
+    data->stats.iterations += stats.iterations;
+#pragma omp atomic
+    data->stats.interior += stats.interior;
+#pragma omp atomic
+    data->stats.periodic += stats.periodic;
+#pragma omp atomic
+    data->stats.filled += stats.filled;
+  }
+
+  // write item to output data
+  TRACE_STOP(TRACE_ITEM, item_start, item->y0);
+  data->compute_time += MPI_Wtime() - start_time;
+  start_time = MPI_Wtime();
+  TRACE_START(write_start);
+  if (data->codec != CODEC_PPM) {
+    // compressed rows go to the file once all items are done
+    compressItem(data, item, local_img);
+  } else if (width == columns) {
+    // full rows are contiguous in the file
+    MPI_Offset offset =
+        data->header_offset + (MPI_Offset)item->y0 * columns * 3;
+    MPI_File_iwrite_at(data->file, offset, local_img, width * height * 3,
+                       MPI_CHAR, &buffer->requests[buffer->count++]);
+  } else {
+    for (y = item->y0; y < item->y1; ++y) {
+      // calculating the correct position of this line in the output file
+      MPI_Offset offset =
+          data->header_offset + ((MPI_Offset)y * columns + item->x0) * 3;
+      MPI_File_iwrite_at(data->file, offset,
+                         local_img + (size_t)(y - item->y0) * width * 3,
+                         width * 3, MPI_CHAR,
+                         &buffer->requests[buffer->count++]);
+    }
+  }
+  TRACE_STOP(data->codec != CODEC_PPM ? TRACE_COMPRESS : TRACE_WRITE,
+             write_start, (long long)width * height * 3);
+  data->io_time += MPI_Wtime() - start_time;
+
+  free(iters);
+  free(smooth);
+  free(samples);
+}
+
+/**
+ * Computes the pixels of a work item and starts writing them to the output
+ * file, see computeItem(). With a completion map, the cells of the item are
+ * marked as finished once all its pixels have been written.
+ *
+ * @param  data  Mandelbrot parameters
+ * @param  item  Work item
+ */
+void mandelbrotItem(mandel_t *data, const item_t *item) {
+  computeItem(data, item, item);
+}
+
+/**
+ * Asks the master, rank @p master of @p comm, for work items and computes
+ * them until it is told to stop. The request for the next item is sent
+ * before computing the current one, so the answer is already there when
+ * the worker is done; a worker thus never has more than one request
+ * pending.
+ */
+static void workItems(mandel_t *data, int master, MPI_Comm comm) {
+  item_t item;
+  item_t next;
+  MPI_Request requests[2];
+  int request = 0;
+
+  TRACE_START(wait_start);
+  MPI_Send(&request, 1, MPI_INT, master, MESSAGE_TAG, comm);
+  MPI_Recv(&item, ITEM_INTS, MPI_INT, master, MESSAGE_TAG, comm,
+           MPI_STATUS_IGNORE);
+  TRACE_STOP(TRACE_WAIT_ITEM, wait_start, 0);
+
+  while (item.y0 != -1) {
+    // prefetch the next work item
+    MPI_Isend(&request, 1, MPI_INT, master, MESSAGE_TAG, comm, &requests[0]);
+    MPI_Irecv(&next, ITEM_INTS, MPI_INT, master, MESSAGE_TAG, comm,
+              &requests[1]);
+
+    mandelbrotItem(data, &item);
+
+    TRACE_START(next_start);
+    MPI_Waitall(2, requests, MPI_STATUSES_IGNORE);
+    TRACE_STOP(TRACE_WAIT_ITEM, next_start, 0);
+    item = next;
+  }
+}
+
 /**
  * Calculates an image of the mandelbrot set for the parameters given in
  * @p data (see description of mandel_t for details). This function takes
@@ -14,107 +622,355 @@
  * finishing the calculation. Also, this function prints the wall-clock
  * time required to do the calculations.
  *
+ * The worker asks the master (rank 0) for work items until it is told to
+ * stop, see workItems().
+ *
  * @param  data  Mandelbrot parameters
  *
  * @return Always NULL
  */
 void *mandelbrot(mandel_t *data) {
-  int x;
-  int y;
-  double dx;
-  double dy;
   double start_time;
   double end_time;
 
   /* Time measurement */
   start_time = get_wtime();
 
-  long long int header_offset;
+  /* Iterate over all work items */
+  workItems(data, 0, MPI_COMM_WORLD);
+
+  /* Time measurement */
+  end_time = get_wtime();
+  printf("Calculation time: %2.6f seconds\n", end_time - start_time);
+
+  return NULL;
+}
+
+/**
+ * Takes the next cell from the share of rank @p owner. The counters of all
+ * ranks live in @p win and are only ever incremented, so a share that has
+ * run dry stays empty.
+ *
+ * @return Index of the cell, or -1 if the share of @p owner is used up
+ */
+static int takeCell(MPI_Win win, int owner, int end) {
+  int one = 1;
+  int cell;
+  TRACE_START(trace_start);
+
+  MPI_Fetch_and_op(&one, &cell, MPI_INT, owner, 0, MPI_SUM, win);
+  MPI_Win_flush(owner, win);
+  TRACE_STOP(TRACE_TAKE_CELL, trace_start, owner);
+
+  return cell < end ? cell : -1;
+}
+
+/**
+ * Calculates the image without a master: every rank starts with an even
+ * share of the cells (see schedule_t) and works through it cell by cell.
+ * Once its own share is done, a rank steals the remaining cells of the
+ * others, one cell at a time, visiting them in round-robin order.
+ *
+ * The next cell of each share is a counter in an RMA window on its owner;
+ * owner and thieves both take cells with MPI_Fetch_and_op(), so no rank
+ * has to be involved in handing out work. Has to be called by all
+ * processes; prints the wall-clock time and the number of stolen cells.
+ *
+ * @param  data  Mandelbrot parameters
+ *
+ * @return Always NULL
+ */
+void *mandelbrotSteal(mandel_t *data) {
+  double start_time;
+  double end_time;
+  schedule_t schedule;
+  item_t item;
+  MPI_Win win;
+  int *counter;
+  int rank;
+  int numprocs;
+  int victim;
+  int cell;
+  int stolen = 0;
+
+  /* Time measurement */
+  start_time = get_wtime();
+
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  MPI_Comm_size(MPI_COMM_WORLD, &numprocs);
+  scheduleInit(&schedule, data, numprocs);
+
+  /* The share of rank r is [r * cells / n, (r + 1) * cells / n) */
+  MPI_Win_allocate(sizeof(int), sizeof(int), MPI_INFO_NULL, MPI_COMM_WORLD,
+                   &counter, &win);
+  *counter = (int)((long long)rank * schedule.cells / numprocs);
+  MPI_Win_lock_all(MPI_MODE_NOCHECK, win);
+  MPI_Win_sync(win);
+  // all counters have to be set before anybody takes cells
+  TRACE_START(barrier_start);
+  MPI_Barrier(MPI_COMM_WORLD);
+  TRACE_STOP(TRACE_BARRIER, barrier_start, 0);
 
-  // get the position where the actual data should begin:
-  MPI_File_seek(data->file, 0, MPI_SEEK_END);
-  MPI_File_get_position(data->file, &header_offset);
+  for (int i = 0; i < numprocs; i++) {
+    victim = (rank + i) % numprocs;
+    int end = (int)((long long)(victim + 1) * schedule.cells / numprocs);
 
-  // allocate enough space for one row of the img
-  char *local_img_row = malloc(sizeof(char) * data->columns * 3); // RGB
-  if (local_img_row == NULL) {
-    printf("Memory Allocation error!\n");
-    return NULL;
+    while ((cell = takeCell(win, victim, end)) != -1) {
+      // finished by the run that is resumed
+      if (data->done && data->done[cell])
+        continue;
+      scheduleCell(&schedule, cell, &item);
+      mandelbrotItem(data, &item);
+      if (victim != rank)
+        stolen++;
+    }
   }
 
-  /* Initialization */
-  dx = (data->xmax - data->xmin) / data->columns;
-  dy = (data->ymax - data->ymin) / data->rows;
+  MPI_Win_unlock_all(win);
+  MPI_Win_free(&win);
 
-  y = 0;
+  /* Time measurement */
+  end_time = get_wtime();
+  printf("Calculation time: %2.6f seconds (%d cells stolen)\n",
+         end_time - start_time, stolen);
 
-  /* Iterate over all rows */
-  int master = 0;
-  MPI_Send(&y, 1, MPI_INT, master, MESSAGE_TAG, MPI_COMM_WORLD);
-  MPI_Recv(&y, 1, MPI_INT, master, MESSAGE_TAG, MPI_COMM_WORLD,
-           MPI_STATUS_IGNORE);
+  return NULL;
+}
 
-  while (y != -1) {
+/** Requests a sub-master of --dist node waits for, see nodeMaster() */
+enum { NODE_WORKER, NODE_CHUNK, NODE_LEADER, NODE_REQUESTS };
 
-    double c_imag = data->ymin + (y * dy);
+/**
+ * State of a sub-master of --dist node, see nodeMaster().
+ */
+typedef struct {
+  mandel_t *data;
+  schedule_t local;   /**< Cells of the current chunk */
+  item_t chunk;       /**< Next chunk, y0 == -1 at the end of the image */
+  int chunks;         /**< Number of chunks worked on */
+  int request;        /**< Request for a chunk, its value is ignored */
+  MPI_Request send;   /**< Send of the request */
+  MPI_Request requests[NODE_REQUESTS]; /**< MPI_REQUEST_NULL if none */
+  int *waiting;       /**< Workers waiting for a chunk, oldest first */
+  int waiting_count;  /**< Number of waiting workers */
+  int stopped;        /**< Number of workers told to stop */
+} node_master_t;
 
-    /* Iterate over all columns */
-    for (x = 0; x < data->columns; ++x) {
-      color_t color;
-      double c_real = data->xmin + (x * dx);
-      int iter = 0;
-      double z_real = 0.0;
-      double z_imag = 0.0;
-      double z_norm = 0.0;
+/**
+ * Asks the master (rank 0 of data->leaders) for the next chunk.
+ */
+static void requestChunk(node_master_t *master) {
+  MPI_Comm leaders = master->data->leaders;
 
-      /* Check whether recursive Mandelbrot equation remains bounded */
-      // The actual calculation
-      while (z_norm < 4.0 && iter < data->maxiter) {
-        double z2_real = (z_real * z_real) - (z_imag * z_imag);
-        double z2_imag = (z_real * z_imag) + (z_imag * z_real);
+  MPI_Isend(&master->request, 1, MPI_INT, 0, MESSAGE_TAG, leaders,
+            &master->send);
+  MPI_Irecv(&master->chunk, ITEM_INTS, MPI_INT, 0, CHUNK_TAG, leaders,
+            &master->requests[NODE_CHUNK]);
+}
 
-        z_real = z2_real + c_real;
-        z_imag = z2_imag + c_imag;
-        z_norm = (z_real * z_real) + (z_imag * z_imag);
+/**
+ * Hands out the next item of the node. Once the current chunk is used up,
+ * the next one takes its place if it has arrived, and the one after it is
+ * requested right away, so it is usually there before it is needed.
+ *
+ * @return 1 if an item was handed out, 0 if the next chunk has not arrived
+ *         yet or the image is done
+ */
+static int nodeNext(node_master_t *master, item_t *item, int limit) {
+  while (!scheduleNext(&master->local, item, limit)) {
+    if (master->requests[NODE_CHUNK] != MPI_REQUEST_NULL ||
+        master->chunk.y0 == -1)
+      return 0;
+    scheduleChunk(&master->local, &master->chunk);
+    master->chunks++;
+    requestChunk(master);
+  }
+  return 1;
+}
 
-        ++iter;
-      }
+/**
+ * Answers the request of a worker of the node with its next item, or with
+ * a stop at the end of the image. A worker that asks while the next chunk
+ * is still on its way waits for it.
+ */
+static void serveWorker(node_master_t *master, int worker) {
+  item_t item;
 
-      /* Bounded => black */
-      if (iter == data->maxiter) {
-        color.red = 0;
-        color.green = 0;
-        color.blue = 0;
-        color.pad = 0;
-      }
-      /* Unbounded => compute nice color */
-      else {
-        color = HSVtoRGB(sqrt((double)iter / data->maxiter), 0.8, 0.8);
-      }
+  if (!nodeNext(master, &item, 0)) {
+    if (master->requests[NODE_CHUNK] != MPI_REQUEST_NULL) {
+      master->waiting[master->waiting_count++] = worker;
+      return;
+    }
+    item.x0 = item.y0 = item.x1 = item.y1 = -1;
+    master->stopped++;
+  }
+  MPI_Send(&item, ITEM_INTS, MPI_INT, worker, MESSAGE_TAG, master->data->node);
+}
+
+/**
+ * Sub-master of a node: hands out the items of the chunks that the master
+ * gives the node to the other processes of the node on request, like
+ * master_main() does for the whole image, and computes single cells while
+ * none of them is waiting. The sub-master of the first node is the master
+ * as well: it hands out the chunks to all sub-masters, itself included,
+ * from a guided schedule of the whole image.
+ *
+ * @return Number of chunks the node worked on
+ */
+static int nodeMaster(mandel_t *data) {
+  node_master_t master;
+  schedule_t global;
+  MPI_Status status;
+  item_t item;
+  int leader;
+  int nodes;
+  int workers;
+  int buffer = 0;
+  int leader_buffer = 0;
+  int leaders_stopped = 0;
+  int index;
+  int flag;
+  int i;
+
+  MPI_Comm_rank(data->leaders, &leader);
+  MPI_Comm_size(data->leaders, &nodes);
+  MPI_Comm_size(data->node, &workers);
+  workers--;
 
-      // set pixel
-      local_img_row[x * 3] = color.red;
-      local_img_row[x * 3 + 1] = color.green;
-      local_img_row[x * 3 + 2] = color.blue;
+  master.data = data;
+  master.chunks = 0;
+  master.request = 0;
+  master.waiting = (int *)malloc((workers + 1) * sizeof(int));
+  master.waiting_count = 0;
+  master.stopped = 0;
+  if (!master.waiting) {
+    fprintf(stderr, "Memory allocation error!\n");
+    MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+  }
+  for (i = 0; i < NODE_REQUESTS; ++i)
+    master.requests[i] = MPI_REQUEST_NULL;
+  // no chunk until the first one arrives
+  scheduleInit(&master.local, data, workers + 1);
+  master.local.end = 0;
+
+  if (leader == 0) {
+    scheduleInit(&global, data, nodes);
+    // the chunks are always guided, so the master only hands out a few;
+    // --fixed applies to the items within a node
+    global.guided = 1;
+    MPI_Irecv(&leader_buffer, 1, MPI_INT, MPI_ANY_SOURCE, MESSAGE_TAG,
+              data->leaders, &master.requests[NODE_LEADER]);
+  }
+  requestChunk(&master);
+
+  for (;;) {
+    // every worker that is neither stopped nor waiting may ask
+    if (master.requests[NODE_WORKER] == MPI_REQUEST_NULL &&
+        master.stopped + master.waiting_count < workers)
+      MPI_Irecv(&buffer, 1, MPI_INT, MPI_ANY_SOURCE, MESSAGE_TAG, data->node,
+                &master.requests[NODE_WORKER]);
+
+    MPI_Testany(NODE_REQUESTS, master.requests, &index, &flag, &status);
+    if (!flag || index == MPI_UNDEFINED) {
+      if (nodeNext(&master, &item, 1)) {
+        // nobody is waiting, compute a single cell in the meantime
+        mandelbrotItem(data, &item);
+        continue;
+      }
+      if (flag) // nothing left to compute or to wait for
+        break;
+      TRACE_START(wait_start);
+      MPI_Waitany(NODE_REQUESTS, master.requests, &index, &status);
+      TRACE_STOP(TRACE_WAIT_WORKER, wait_start, 0);
     }
 
-    // write row to output data
-    // calculating the correct position of this line in the output file
-    int offset = header_offset + (y * (data->columns * 3));
-    MPI_File_write_at(data->file, offset, local_img_row, data->columns * 3,
-                      MPI_CHAR, MPI_STATUS_IGNORE);
+    if (index == NODE_WORKER) {
+      serveWorker(&master, status.MPI_SOURCE);
+    } else if (index == NODE_CHUNK) {
+      int count = master.waiting_count;
 
-    // ask master for next row to work on
-    MPI_Send(&y, 1, MPI_INT, master, MESSAGE_TAG, MPI_COMM_WORLD);
-    MPI_Recv(&y, 1, MPI_INT, master, MESSAGE_TAG, MPI_COMM_WORLD,
-             MPI_STATUS_IGNORE);
+      MPI_Wait(&master.send, MPI_STATUS_IGNORE);
+      // the waiting workers get the chunk first
+      master.waiting_count = 0;
+      for (i = 0; i < count; ++i)
+        serveWorker(&master, master.waiting[i]);
+    } else {
+      // a sub-master asks for its next chunk
+      if (!scheduleNext(&global, &item, 0)) {
+        item.x0 = item.y0 = item.x1 = item.y1 = -1;
+        leaders_stopped++;
+      }
+      MPI_Send(&item, ITEM_INTS, MPI_INT, status.MPI_SOURCE, CHUNK_TAG,
+               data->leaders);
+      if (leaders_stopped < nodes)
+        MPI_Irecv(&leader_buffer, 1, MPI_INT, MPI_ANY_SOURCE, MESSAGE_TAG,
+                  data->leaders, &master.requests[NODE_LEADER]);
+    }
   }
 
-  free(local_img_row);
+  free(master.waiting);
+  return master.chunks;
+}
 
-  /* Time measurement */
-  end_time = get_wtime();
-  printf("Calculation time: %2.6f seconds\n", end_time - start_time);
+/**
+ * Calculates the image with a master per node (see nodeMaster()): the
+ * master only hands out large chunks of cells to one sub-master per node,
+ * and the other processes of a node get their items from its sub-master
+ * over data->node. The messages of the master thus grow with the number
+ * of nodes rather than of processes. Has to be called by all processes;
+ * prints the wall-clock time, and on the sub-masters the number of chunks.
+ *
+ * @param  data  Mandelbrot parameters
+ *
+ * @return Always NULL
+ */
+void *mandelbrotNode(mandel_t *data) {
+  double start_time = get_wtime();
+  int local;
+
+  MPI_Comm_rank(data->node, &local);
+  if (local == 0) {
+    int chunks = nodeMaster(data);
+
+    printf("Calculation time (node master): %2.6f seconds (%d chunks)\n",
+           get_wtime() - start_time, chunks);
+  } else {
+    workItems(data, 0, data->node);
+    printf("Calculation time: %2.6f seconds\n", get_wtime() - start_time);
+  }
 
   return NULL;
 }
+
+/**
+ * Sums up the statistics of all processes and prints them on rank 0.
+ * Has to be called by all processes.
+ *
+ * @param  stats  Statistics of the calling process
+ */
+void statsReport(const mandel_stats_t *stats) {
+  long long local[5];
+  long long total[5];
+  int rank;
+
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+  local[0] = stats->pixels;
+  local[1] = stats->iterations;
+  local[2] = stats->interior;
+  local[3] = stats->periodic;
+  local[4] = stats->filled;
+  MPI_Reduce(local, total, 5, MPI_LONG_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+
+  if (rank == 0) {
+    printf("Pixels computed: %lld, iterations: %lld (%.1f per pixel)\n",
+           total[0], total[1], total[0] ? (double)total[1] / total[0] : 0.0);
+    if (total[4] > 0) {
+      printf("Pixels filled by rectangle subdivision: %lld\n", total[4]);
+    }
+    printf("Cardioid/bulb interior pixels skipped: %lld (%.1f%%)\n", total[2],
+           total[0] ? 100.0 * total[2] / total[0] : 0.0);
+    printf("Periodic orbits stopped early: %lld (%.1f%%)\n", total[3],
+           total[0] ? 100.0 * total[3] / total[0] : 0.0);
+  }
+}
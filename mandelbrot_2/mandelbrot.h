@@ -3,10 +3,104 @@
 
 #include <mpi.h>
 
+#include "compress.h"
+#include "palette.h"
+
 #define MESSAGE_TAG 42
 
+/**
+ * Tag of the chunks of --dist node, which rank 0 also sends to itself, so
+ * they must not match its receive of the requests
+ */
+#define CHUNK_TAG 43
+
+/** Number of MPI_INTs in a work item message */
+#define ITEM_INTS 4
+
+/** Distance of the samples of the first pass of --progressive in pixels */
+#define PROGRESSIVE_FIRST 8
+
 /*--- Type definitions -----------------------------------------------------*/
 
+/**
+ * Engines computing the iteration counts of a region of the image.
+ */
+typedef enum {
+  ENGINE_PIXEL, /**< Every pixel on its own */
+  ENGINE_RECT   /**< Mariani-Silver rectangle subdivision */
+} engine_t;
+
+/**
+ * Arithmetic the escape-time kernels iterate in.
+ */
+typedef enum {
+  PRECISION_FLOAT,  /**< Single precision, for overviews */
+  PRECISION_DOUBLE, /**< Double precision */
+  PRECISION_DD      /**< Double-double, about 106 bits of mantissa */
+} precision_t;
+
+/**
+ * Kinds of cells the image is cut into for the distribution of work.
+ */
+typedef enum {
+  ITEMS_ROWS, /**< Batches of full rows */
+  ITEMS_TILES /**< Square tiles */
+} item_kind_t;
+
+/**
+ * Ways of distributing the work items among the processes.
+ */
+typedef enum {
+  DIST_MASTER, /**< Rank 0 hands out the items on request */
+  DIST_STEAL,  /**< Static partition, idle ranks steal from the others */
+  DIST_NODE    /**< Rank 0 hands out chunks to a sub-master per node */
+} dist_t;
+
+/**
+ * Work item: the rectangle [x0, x1) x [y0, y1) of the image. An item with
+ * y0 == -1 tells a worker to stop.
+ */
+typedef struct {
+  int x0; /**< First column */
+  int y0; /**< First row */
+  int x1; /**< Column after the last one */
+  int y1; /**< Row after the last one */
+} item_t;
+
+/**
+ * Buffer of the pixels of a work item, which stays in use until all its
+ * rows have been written (see mandelbrotItem()).
+ */
+typedef struct {
+  char *pixels;          /**< RGB pixels of the item, row by row */
+  size_t size;           /**< Capacity of pixels in bytes */
+  MPI_Request *requests; /**< Writes of the rows, one per request */
+  int count;             /**< Number of writes started */
+  int capacity;          /**< Capacity of requests */
+  item_t finished;       /**< Item done with the writes, y0 == -1 if none */
+} write_buffer_t;
+
+/**
+ * Compressed rows of a work item. They are kept until the sizes of all
+ * items, and with them the positions in the file, are known (see
+ * compressedFinish()).
+ */
+typedef struct {
+  int y0;            /**< First row of the item */
+  segment_t segment; /**< Compressed rows */
+} item_segment_t;
+
+/**
+ * Statistics of the calculation, used to report the work done per run.
+ */
+typedef struct {
+  long long pixels;     /**< Number of pixels computed */
+  long long iterations; /**< Number of iterations performed */
+  long long interior;   /**< Pixels found inside the cardioid or bulb */
+  long long periodic;   /**< Pixels stopped early by the periodicity check */
+  long long filled;     /**< Pixels filled in by rectangle subdivision */
+} mandel_stats_t;
+
 /**
  * This structure is used to pass the set of required parameters to the
  * mandelbrot() call.
@@ -18,16 +112,70 @@ typedef struct {
   double xmax; /**< Upper bound in complex plane (real part) */
   double ymax; /**< Upper bound in complex plane (imag. part) */
   int maxiter; /**< Maximum number of iterations */
+  palette_t *palette; /**< Colors of the iteration counts */
+  const char *center_real; /**< Center (decimal), NULL for the default */
+  const char *center_imag; /**< Center (decimal), NULL for the default */
+  double width;            /**< Width of the view, xmax - xmin if <= 0 */
+  double view_real;        /**< Center (real part), see kernelCenter() */
+  double view_real_lo;     /**< Low part of view_real, for double-double */
+  double view_imag;        /**< Center (imag. part), see kernelCenter() */
+  double view_imag_lo;     /**< Low part of view_imag, for double-double */
+  int smooth;         /**< Non-zero to color continuous iteration counts */
+  int periodicity; /**< Non-zero to stop iterating cyclic orbits early */
+  engine_t engine; /**< Engine to compute the pixels with */
+  precision_t precision; /**< Arithmetic of the escape-time kernels */
 
   /* Input: image size & offsets */
   int columns; /**< Number of pixels to draw in x direction */
   int rows;    /**< Number of pixels to draw in y direction */
+  size_t memory; /**< Bytes for the pixels of an item, 0 for no limit */
+  int progressive; /**< Non-zero to compute in passes of rising resolution */
+  int step; /**< Distance of the samples of the current pass, 1 for all */
 
+  /* Input: distribution of the work */
+  dist_t dist;       /**< How the items are distributed */
+  item_kind_t items; /**< Kind of cells the image is cut into */
+  int item_size;     /**< Rows per batch or edge length of a tile */
+  int guided;        /**< Non-zero to hand out larger items first */
+  MPI_Comm node;     /**< Processes of the node, for DIST_NODE */
+  MPI_Comm leaders;  /**< First processes of all nodes, for DIST_NODE */
+
+  const char *output; /**< Name of the image */
+  const char *report; /**< File to append the timings to, or NULL */
+  const char *trace;  /**< File to write the trace to, or NULL */
   MPI_File file;
+  MPI_Offset header_offset; /**< Position of the first pixel in the file */
+  MPI_File previous;          /**< Image of the previous pass, see step */
+  MPI_Offset previous_offset; /**< Position of its first pixel */
+  int write_depth;          /**< Number of items being written at once */
+  write_buffer_t *buffers;  /**< Pool of write_depth item buffers */
+  int next_buffer;          /**< Buffer the next item goes to */
+  codec_t codec;            /**< Format of the file */
+  int checkpoint;           /**< Non-zero to keep a completion map */
+  int resume;               /**< Non-zero to continue from the map */
+  unsigned char *done;      /**< Non-zero per finished cell, or NULL */
+  MPI_File done_file;       /**< Completion map, see checkpoint.c */
+  int *marked;              /**< Cells of the items not yet in the map */
+  int mark_count;           /**< Number of items in marked */
+  item_segment_t *segments; /**< Compressed items of this process */
+  int segment_count;        /**< Number of compressed items */
+  int segment_capacity;     /**< Capacity of segments */
+
+  /* Output: statistics */
+  mandel_stats_t stats; /**< Work done by this process */
+  double compute_time;  /**< Seconds computing and coloring items */
+  double io_time;       /**< Seconds compressing and handing items to MPI */
 } mandel_t;
 
 /*--- Function prototypes --------------------------------------------------*/
 
 void *mandelbrot(mandel_t *data);
+void mandelbrotItem(mandel_t *data, const item_t *item);
+void *mandelbrotSteal(mandel_t *data);
+void *mandelbrotNode(mandel_t *data);
+void statsReport(const mandel_stats_t *stats);
+int writePoolInit(mandel_t *data);
+void writePoolFinish(mandel_t *data);
+void compressedFinish(mandel_t *data);
 
 #endif /* !_MANDELBROT_H */
@@ -0,0 +1,85 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "palette.h"
+
+/*--- Implementation -------------------------------------------------------*/
+
+/**
+ * Looks up a color scheme by its name ("hsv" or "gray").
+ *
+ * @param  name  Name of the color scheme
+ * @param  kind  Output: color scheme
+ *
+ * @return 0 on success, -1 if @p name is unknown
+ */
+int paletteParse(const char *name, palette_kind_t *kind) {
+  if (strcmp(name, "hsv") == 0)
+    *kind = PALETTE_HSV;
+  else if (strcmp(name, "gray") == 0)
+    *kind = PALETTE_GRAY;
+  else
+    return -1;
+  return 0;
+}
+
+/**
+ * Computes the colors of all iteration counts from 0 to @p maxiter once, so
+ * that coloring a pixel is a table lookup.
+ *
+ * @param  kind     Color scheme
+ * @param  maxiter  Maximum number of iterations
+ *
+ * @return Pointer to the palette if successful, NULL otherwise
+ */
+palette_t *paletteCreate(palette_kind_t kind, int maxiter) {
+  palette_t *palette;
+  int iter;
+
+  palette = (palette_t *)malloc(sizeof(palette_t));
+  if (!palette) {
+    fprintf(stderr, "Memory allocation error!\n");
+    return NULL;
+  }
+  palette->colors = (color_t *)malloc((maxiter + 1) * sizeof(color_t));
+  if (!palette->colors) {
+    fprintf(stderr, "Memory allocation error!\n");
+    free(palette);
+    return NULL;
+  }
+  palette->kind = kind;
+  palette->maxiter = maxiter;
+
+  for (iter = 0; iter < maxiter; ++iter) {
+    double level = sqrt((double)iter / maxiter);
+    color_t color;
+
+    if (kind == PALETTE_GRAY) {
+      color.red = color.green = color.blue = (unsigned char)(255.0 * level);
+      color.pad = 0;
+    } else {
+      color = HSVtoRGB(level, 0.8, 0.8);
+    }
+    palette->colors[iter] = color;
+  }
+
+  /* Bounded => black */
+  palette->colors[maxiter].red = 0;
+  palette->colors[maxiter].green = 0;
+  palette->colors[maxiter].blue = 0;
+  palette->colors[maxiter].pad = 0;
+
+  return palette;
+}
+
+/**
+ * Releases all resources occupied by the given palette.
+ *
+ * @param  palette  Palette to be freed
+ */
+void paletteFree(palette_t *palette) {
+  free(palette->colors);
+  free(palette);
+}
@@ -0,0 +1,26 @@
+#ifndef _REPORT_H
+#define _REPORT_H
+
+#include "mandelbrot.h"
+
+/*--- Type definitions -----------------------------------------------------*/
+
+/**
+ * Configuration and timings of a run of one process, summarized over all
+ * processes by reportWrite().
+ */
+typedef struct {
+  const char *kernel;    /**< Escape-time kernel (see kernelInit()) */
+  const char *precision; /**< Arithmetic of the kernels */
+  double compute;        /**< Seconds computing and coloring items */
+  double io;             /**< Seconds writing the image */
+  double total;          /**< Seconds from the start to the written image */
+  int worker;            /**< Non-zero if items are distributed to it */
+} report_t;
+
+/*--- Function prototypes --------------------------------------------------*/
+
+int reportWrite(const char *filename, const mandel_t *data,
+                const report_t *report);
+
+#endif /* !_REPORT_H */
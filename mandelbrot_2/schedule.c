@@ -0,0 +1,152 @@
+#include "schedule.h"
+
+/*--- Implementation -------------------------------------------------------*/
+
+/**
+ * Initializes a schedule handing out the image described by @p data.
+ *
+ * @param  schedule   Schedule to initialize
+ * @param  data       Mandelbrot parameters (image size and item options)
+ * @param  consumers  Number of processes the items are shared among
+ */
+void scheduleInit(schedule_t *schedule, const mandel_t *data, int consumers) {
+  // the image of a progressive pass has every data->step-th pixel
+  schedule->columns = (data->columns + data->step - 1) / data->step;
+  schedule->rows = (data->rows + data->step - 1) / data->step;
+
+  if (data->items == ITEMS_TILES) {
+    schedule->cell_w = data->item_size;
+    schedule->cell_h = data->item_size;
+  } else {
+    schedule->cell_w = schedule->columns;
+    schedule->cell_h = data->item_size;
+  }
+
+  schedule->cells_x =
+      (schedule->columns + schedule->cell_w - 1) / schedule->cell_w;
+  schedule->cells =
+      schedule->cells_x *
+      ((schedule->rows + schedule->cell_h - 1) / schedule->cell_h);
+  schedule->next = 0;
+  schedule->end = schedule->cells;
+  schedule->guided = data->guided;
+  schedule->consumers = consumers > 0 ? consumers : 1;
+  schedule->done = data->done;
+}
+
+/**
+ * Hands out the next work item. With a guided schedule, an item consists of
+ * a share of the remaining cells that shrinks towards the end of the image,
+ * otherwise of a single cell. Items never cross a row of tiles, so that they
+ * stay rectangular. Cells finished by a run that is resumed (see
+ * schedule->done) are skipped, and an item ends before the next of them.
+ *
+ * @param  schedule  Schedule
+ * @param  item      Output: next work item
+ * @param  limit     Maximum number of cells in the item, 0 for no limit
+ *
+ * @return 1 if an item was handed out, 0 if the image (or the chunk, see
+ *         scheduleChunk()) is done
+ */
+int scheduleNext(schedule_t *schedule, item_t *item, int limit) {
+  int remaining;
+  int count = 1;
+  int first;
+  int i;
+
+  if (schedule->done)
+    while (schedule->next < schedule->end && schedule->done[schedule->next])
+      schedule->next++;
+  remaining = schedule->end - schedule->next;
+  if (remaining <= 0)
+    return 0;
+
+  if (schedule->guided && remaining / (2 * schedule->consumers) > 1)
+    count = remaining / (2 * schedule->consumers);
+  if (limit > 0 && count > limit)
+    count = limit;
+
+  first = schedule->next;
+  if (schedule->done) {
+    for (i = 1; i < count && i < remaining && !schedule->done[first + i]; ++i)
+      ;
+    count = i;
+  }
+  if (schedule->cells_x > 1) {
+    /* Tiles: stay within the current row of tiles */
+    int cx = first % schedule->cells_x;
+
+    if (count > schedule->cells_x - cx)
+      count = schedule->cells_x - cx;
+
+    item->x0 = cx * schedule->cell_w;
+    item->x1 = (cx + count) * schedule->cell_w;
+    item->y0 = (first / schedule->cells_x) * schedule->cell_h;
+    item->y1 = item->y0 + schedule->cell_h;
+  } else {
+    /* Row batches: any number of consecutive batches */
+    if (count > remaining)
+      count = remaining;
+
+    item->x0 = 0;
+    item->x1 = schedule->columns;
+    item->y0 = first * schedule->cell_h;
+    item->y1 = (first + count) * schedule->cell_h;
+  }
+
+  if (item->x1 > schedule->columns)
+    item->x1 = schedule->columns;
+  if (item->y1 > schedule->rows)
+    item->y1 = schedule->rows;
+
+  schedule->next += count;
+  return 1;
+}
+
+/**
+ * Returns the work item consisting of a single cell.
+ *
+ * @param  schedule  Schedule
+ * @param  cell      Index of the cell, 0 <= @p cell < schedule->cells
+ * @param  item      Output: work item
+ */
+void scheduleCell(const schedule_t *schedule, int cell, item_t *item) {
+  item->x0 = (cell % schedule->cells_x) * schedule->cell_w;
+  item->y0 = (cell / schedule->cells_x) * schedule->cell_h;
+  item->x1 = item->x0 + schedule->cell_w;
+  item->y1 = item->y0 + schedule->cell_h;
+
+  if (item->x1 > schedule->columns)
+    item->x1 = schedule->columns;
+  if (item->y1 > schedule->rows)
+    item->y1 = schedule->rows;
+}
+
+/**
+ * Returns the cells of a work item of whole cells (see scheduleNext()),
+ * which are consecutive.
+ *
+ * @param  schedule  Schedule
+ * @param  item      Work item
+ * @param  first     Output: first cell of the item
+ * @param  end       Output: cell after the last one of the item
+ */
+void scheduleCells(const schedule_t *schedule, const item_t *item, int *first,
+                   int *end) {
+  *first = (item->y0 / schedule->cell_h) * schedule->cells_x +
+           item->x0 / schedule->cell_w;
+  *end = ((item->y1 - 1) / schedule->cell_h) * schedule->cells_x +
+         (item->x1 - 1) / schedule->cell_w + 1;
+}
+
+/**
+ * Restricts a schedule to the cells of a work item, e.g. a chunk that was
+ * handed out by another schedule of the same image: scheduleNext() then
+ * cuts the item into smaller ones, and is done at its end.
+ *
+ * @param  schedule  Schedule
+ * @param  item      Work item of whole cells
+ */
+void scheduleChunk(schedule_t *schedule, const item_t *item) {
+  scheduleCells(schedule, item, &schedule->next, &schedule->end);
+}
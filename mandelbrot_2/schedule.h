@@ -0,0 +1,36 @@
+#ifndef _SCHEDULE_H
+#define _SCHEDULE_H
+
+#include "mandelbrot.h"
+
+/*--- Type definitions -----------------------------------------------------*/
+
+/**
+ * Hands out the image in work items. The image is cut into cells (row
+ * batches or tiles, see mandel_t), and a work item consists of one or more
+ * consecutive cells that form a rectangle.
+ */
+typedef struct {
+  int columns;   /**< Image width in pixels */
+  int rows;      /**< Image height in pixels */
+  int cell_w;    /**< Width of a cell in pixels */
+  int cell_h;    /**< Height of a cell in pixels */
+  int cells_x;   /**< Number of cells in x direction */
+  int cells;     /**< Total number of cells */
+  int next;      /**< Next cell to hand out */
+  int end;       /**< Cell after the last one to hand out */
+  int guided;    /**< Non-zero to hand out larger items first */
+  int consumers; /**< Number of processes sharing the items */
+  const unsigned char *done; /**< Non-zero per finished cell, or NULL */
+} schedule_t;
+
+/*--- Function prototypes --------------------------------------------------*/
+
+void scheduleInit(schedule_t *schedule, const mandel_t *data, int consumers);
+int scheduleNext(schedule_t *schedule, item_t *item, int limit);
+void scheduleCell(const schedule_t *schedule, int cell, item_t *item);
+void scheduleCells(const schedule_t *schedule, const item_t *item, int *first,
+                   int *end);
+void scheduleChunk(schedule_t *schedule, const item_t *item);
+
+#endif /* !_SCHEDULE_H */
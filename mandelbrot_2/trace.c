@@ -0,0 +1,239 @@
+#include <omp.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <mpi.h>
+
+#include "trace.h"
+
+/*--- Type definitions -----------------------------------------------------*/
+
+/**
+ * Traced phase of a run, times in seconds of get_wtime().
+ */
+typedef struct {
+  trace_kind_t kind; /**< Phase */
+  double start;      /**< Begin of the phase */
+  double duration;   /**< Length of the phase */
+  long long arg;     /**< Number describing the event, see trace_kind_t */
+} trace_event_t;
+
+/**
+ * Ring of the last TRACE_EVENTS events of one thread. Only its thread ever
+ * writes to a ring, so recording an event needs neither locks nor atomics.
+ */
+typedef struct {
+  trace_event_t *events; /**< TRACE_EVENTS events */
+  long long count;       /**< Number of events recorded so far */
+  char pad[48];          /**< Keeps the counts in separate cache lines */
+} trace_ring_t;
+
+/*--- Module variables -----------------------------------------------------*/
+
+/** Names of the phases in the trace */
+static const char *names[TRACE_KINDS] = {
+    [TRACE_BLOCK] = "block",
+    [TRACE_ITEM] = "item",
+    [TRACE_COMPRESS] = "compress",
+    [TRACE_WRITE] = "write",
+    [TRACE_READ] = "read samples",
+    [TRACE_BUFFER] = "wait buffer",
+    [TRACE_WAIT_ITEM] = "wait item",
+    [TRACE_WAIT_WORKER] = "wait worker",
+    [TRACE_TAKE_CELL] = "take cell",
+    [TRACE_BARRIER] = "barrier",
+    [TRACE_OPEN] = "open",
+    [TRACE_FLUSH] = "flush",
+    [TRACE_FINISH] = "write compressed",
+    [TRACE_CLOSE] = "close"};
+
+/** Names of the numbers describing the events, NULL for none */
+static const char *args[TRACE_KINDS] = {[TRACE_BLOCK] = "block",
+                                        [TRACE_ITEM] = "row",
+                                        [TRACE_COMPRESS] = "bytes",
+                                        [TRACE_WRITE] = "bytes",
+                                        [TRACE_READ] = "bytes",
+                                        [TRACE_TAKE_CELL] = "owner"};
+
+/** One ring per OpenMP thread, NULL while tracing is off */
+static trace_ring_t *rings = NULL;
+
+/** Number of rings */
+static int ring_count = 0;
+
+/** Time all processes agree on as the start of the trace */
+static double epoch;
+
+/*--- Implementation -------------------------------------------------------*/
+
+/**
+ * Starts recording events (see TRACE_START() and TRACE_STOP()) in a ring
+ * per OpenMP thread. Has to be called by all processes: the clocks of the
+ * processes start together after a barrier, so the events of all processes
+ * line up in the trace.
+ *
+ * @return 0 on success, -1 if out of memory
+ */
+int traceInit(void) {
+  int i;
+
+  ring_count = omp_get_max_threads();
+  rings = (trace_ring_t *)calloc(ring_count, sizeof(trace_ring_t));
+  if (!rings) {
+    fprintf(stderr, "Memory allocation error!\n");
+    return -1;
+  }
+  for (i = 0; i < ring_count; ++i) {
+    rings[i].events =
+        (trace_event_t *)malloc(TRACE_EVENTS * sizeof(trace_event_t));
+    if (!rings[i].events) {
+      fprintf(stderr, "Memory allocation error!\n");
+      return -1;
+    }
+  }
+
+  MPI_Barrier(MPI_COMM_WORLD);
+  epoch = get_wtime();
+  return 0;
+}
+
+/**
+ * Records an event of the calling thread that lasted from @p start until
+ * now. Does nothing if tracing was not started with traceInit().
+ *
+ * @param  kind   Phase of the run
+ * @param  start  Begin of the phase (see get_wtime())
+ * @param  arg    Number describing the event, see trace_kind_t
+ */
+void traceRecord(trace_kind_t kind, double start, long long arg) {
+  double end = get_wtime();
+  int thread = omp_get_thread_num();
+  trace_event_t *event;
+
+  if (!rings || thread >= ring_count)
+    return;
+
+  event = &rings[thread].events[rings[thread].count++ % TRACE_EVENTS];
+  event->kind = kind;
+  event->start = start;
+  event->duration = end - start;
+  event->arg = arg;
+}
+
+/**
+ * Writes the events of one process as Chrome trace events, one process per
+ * rank and one thread per OpenMP thread, to @p fp.
+ */
+static void writeEvents(FILE *fp, int rank) {
+  int thread;
+
+  fprintf(fp,
+          "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": %d, "
+          "\"args\": {\"name\": \"rank %d\"}}",
+          rank, rank);
+  fprintf(fp,
+          ",\n{\"name\": \"process_sort_index\", \"ph\": \"M\", "
+          "\"pid\": %d, \"args\": {\"sort_index\": %d}}",
+          rank, rank);
+
+  for (thread = 0; thread < ring_count; ++thread) {
+    const trace_ring_t *ring = &rings[thread];
+    long long first = ring->count > TRACE_EVENTS ? ring->count - TRACE_EVENTS
+                                                 : 0;
+    long long i;
+
+    if (ring->count > TRACE_EVENTS)
+      fprintf(stderr, "Trace of rank %d, thread %d: %lld events lost\n",
+              rank, thread, first);
+
+    for (i = first; i < ring->count; ++i) {
+      const trace_event_t *event = &ring->events[i % TRACE_EVENTS];
+
+      fprintf(fp,
+              ",\n{\"name\": \"%s\", \"ph\": \"X\", \"pid\": %d, "
+              "\"tid\": %d, \"ts\": %.3f, \"dur\": %.3f",
+              names[event->kind], rank, thread,
+              (event->start - epoch) * 1e6, event->duration * 1e6);
+      if (args[event->kind])
+        fprintf(fp, ", \"args\": {\"%s\": %lld}", args[event->kind],
+                event->arg);
+      fputc('}', fp);
+    }
+  }
+}
+
+/**
+ * Stops tracing and writes the events of all processes as one trace in the
+ * Chrome JSON format to @p filename, to be opened with Perfetto or
+ * chrome://tracing. Every process formats its own events; the parts are
+ * put together at offsets from MPI_Exscan(), rank 0 adding the head and
+ * the last rank the end of the document. Has to be called by all
+ * processes.
+ *
+ * @param  filename  Name of the trace file
+ *
+ * @return 0 on success, -1 on errors
+ */
+int traceWrite(const char *filename) {
+  char *text = NULL;
+  size_t size = 0;
+  long long length;
+  long long offset = 0;
+  long long total;
+  FILE *fp;
+  MPI_File file;
+  int rank;
+  int numprocs;
+  int i;
+
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  MPI_Comm_size(MPI_COMM_WORLD, &numprocs);
+
+  fp = open_memstream(&text, &size);
+  if (!fp) {
+    fprintf(stderr, "Memory allocation error!\n");
+    MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+  }
+  if (rank == 0)
+    fprintf(fp, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+  else
+    fprintf(fp, ",\n");
+  writeEvents(fp, rank);
+  if (rank == numprocs - 1)
+    fprintf(fp, "\n]}\n");
+  if (fclose(fp) != 0) {
+    fprintf(stderr, "Memory allocation error!\n");
+    MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+  }
+
+  for (i = 0; i < ring_count; ++i)
+    free(rings[i].events);
+  free(rings);
+  rings = NULL;
+  ring_count = 0;
+
+  /* The part of each rank follows the ones of the lower ranks */
+  length = size;
+  MPI_Exscan(&length, &offset, 1, MPI_LONG_LONG, MPI_SUM, MPI_COMM_WORLD);
+  if (rank == 0)
+    offset = 0;
+  MPI_Allreduce(&length, &total, 1, MPI_LONG_LONG, MPI_SUM, MPI_COMM_WORLD);
+
+  if (MPI_File_open(MPI_COMM_WORLD, filename,
+                    MPI_MODE_WRONLY | MPI_MODE_CREATE, MPI_INFO_NULL,
+                    &file) != MPI_SUCCESS) {
+    if (rank == 0)
+      fprintf(stderr, "Could not create trace file \"%s\"!\n", filename);
+    free(text);
+    return -1;
+  }
+  MPI_File_set_size(file, total);
+  MPI_File_write_at_all(file, offset, text, (int)size, MPI_CHAR,
+                        MPI_STATUS_IGNORE);
+  MPI_File_close(&file);
+  free(text);
+
+  if (rank == 0)
+    printf("Trace written to %s (%.1f MB)\n", filename, total / 1e6);
+  return 0;
+}
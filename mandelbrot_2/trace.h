@@ -0,0 +1,54 @@
+#ifndef _TRACE_H
+#define _TRACE_H
+
+#include "utility.h"
+
+/** Number of events each thread keeps, older ones are overwritten */
+#define TRACE_EVENTS (1 << 16)
+
+/*--- Type definitions -----------------------------------------------------*/
+
+/**
+ * Phases of a run that are traced.
+ */
+typedef enum {
+  TRACE_BLOCK,       /**< A thread computes a block of an item (index) */
+  TRACE_ITEM,        /**< The threads compute an item (first row) */
+  TRACE_COMPRESS,    /**< An item is compressed (bytes) */
+  TRACE_WRITE,       /**< Writes of an item are started (bytes) */
+  TRACE_READ,        /**< Samples of the previous pass are read (bytes) */
+  TRACE_BUFFER,      /**< Waiting for a buffer of the write pool */
+  TRACE_WAIT_ITEM,   /**< A worker waits for the master to answer */
+  TRACE_WAIT_WORKER, /**< The master waits for a request of a worker */
+  TRACE_TAKE_CELL,   /**< A rank takes a cell from a share (owner) */
+  TRACE_BARRIER,     /**< Waiting in a barrier */
+  TRACE_OPEN,        /**< Opening the output file */
+  TRACE_FLUSH,       /**< Waiting for the last writes */
+  TRACE_FINISH,      /**< Writing the compressed items */
+  TRACE_CLOSE,       /**< Closing the output file */
+  TRACE_KINDS        /**< Number of kinds of events */
+} trace_kind_t;
+
+/*--- Function prototypes --------------------------------------------------*/
+
+int traceInit(void);
+void traceRecord(trace_kind_t kind, double start, long long arg);
+int traceWrite(const char *filename);
+
+/*--- Macros ---------------------------------------------------------------*/
+
+/*
+ * The events are only recorded in builds with MANDEL_TRACE ("make
+ * TRACE=1"); otherwise the macros are empty and tracing costs nothing.
+ * TRACE_START() starts the clock of an event, TRACE_STOP() records it
+ * together with a number describing it.
+ */
+#ifdef MANDEL_TRACE
+#define TRACE_START(start) double start = get_wtime()
+#define TRACE_STOP(kind, start, arg) traceRecord(kind, start, arg)
+#else
+#define TRACE_START(start)
+#define TRACE_STOP(kind, start, arg)
+#endif
+
+#endif /* !_TRACE_H */
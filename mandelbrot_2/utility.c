@@ -1,21 +1,41 @@
 #include <stdio.h>
-#include <sys/time.h>
+#include <string.h>
+#include <time.h>
 
 #include "utility.h"
 
 /*--- Implementation -------------------------------------------------------*/
 
 /**
- * Returns a wall-clock time value in seconds since the Epoch (i.e.,
- * 1970-01-01 00:00:00 +0000).
+ * Returns a wall-clock time value in seconds from an arbitrary starting
+ * point. The clock is monotonic, so differences of the values are not
+ * disturbed by adjustments of the system time.
  */
 double get_wtime() {
-  struct timeval tv;
+  struct timespec ts;
 
-  if (0 != gettimeofday(&tv, NULL))
-    fprintf(stderr, "Error calling gettimeofday()\n");
+  if (0 != clock_gettime(CLOCK_MONOTONIC, &ts))
+    fprintf(stderr, "Error calling clock_gettime()\n");
 
-  return tv.tv_sec + tv.tv_usec * 1e-6;
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/**
+ * Returns the name of the preview of a progressive rendering at 1/@p step
+ * of the resolution: the name of the image with "-STEP" in front of the
+ * extension, e.g. "output-8.ppm" for "output.ppm".
+ *
+ * @param  output  Name of the image
+ * @param  step    Distance of the samples of the preview in pixels
+ * @param  name    Output: name of the preview
+ * @param  size    Capacity of @p name
+ */
+void passFileName(const char *output, int step, char *name, size_t size) {
+  const char *dot = strrchr(output, '.');
+
+  if (!dot || strchr(dot, '/'))
+    dot = output + strlen(output);
+  snprintf(name, size, "%.*s-%d%s", (int)(dot - output), output, step, dot);
 }
 
 /**